@@ -0,0 +1,125 @@
+#!/usr/bin/env python3
+"""
+Runs the on-device encoder stress benchmark of the RP2040 HAL DRO and prints
+the CPU load and count accuracy for every edge rate.
+Requires pyusb: pip install pyusb
+"""
+
+import usb.core
+import usb.util
+import struct
+import time
+import sys
+
+# USB device identifiers
+VENDOR_ID = 0x2E8A  # Raspberry Pi Foundation (RP2040)
+PRODUCT_ID = 0xC0DE  # Our custom product ID
+
+# Request codes
+VENDOR_REQUEST_RUN_BENCHMARK = 0x08
+VENDOR_REQUEST_GET_BENCHMARK = 0x09
+
+# Sentinel value for data validation
+BENCHMARK_DATA_SENTINEL = 0x2A6F0B3D
+
+BENCHMARK_STATES = {0: "idle", 1: "running", 2: "done", 3: "unavailable"}
+BACKENDS = {0: "IRQ", 1: "DMA"}
+
+# Endpoints
+EP_IN = 0x81
+EP_OUT = 0x01
+
+def find_device():
+    """Find the USB device"""
+    dev = usb.core.find(idVendor=VENDOR_ID, idProduct=PRODUCT_ID)
+    if dev is None:
+        raise ValueError("Device not found")
+    return dev
+
+def setup_device(dev):
+    """Setup the USB device"""
+    dev.set_configuration()
+    cfg = dev.get_active_configuration()
+    intf = cfg[(0, 0)]
+    try:
+        if dev.is_kernel_driver_active(intf.bInterfaceNumber):
+            dev.detach_kernel_driver(intf.bInterfaceNumber)
+    except usb.core.USBError:
+        # On macOS, this might not be needed or supported
+        pass
+    usb.util.claim_interface(dev, intf.bInterfaceNumber)
+    return intf
+
+def flush_in(dev):
+    """Drop anything still queued on the IN endpoint"""
+    try:
+        while True:
+            dev.read(EP_IN, 64, timeout=10)
+    except usb.core.USBTimeoutError:
+        pass
+
+def get_benchmark(dev):
+    """Get the benchmark state and results"""
+    dev.write(EP_OUT, [VENDOR_REQUEST_GET_BENCHMARK], timeout=100)
+    data = bytes(dev.read(EP_IN, 64, timeout=500))
+
+    # [sentinel:4][state:1][backend:1][steps:1][reserved:1][max_rate:4][steps * 8]
+    if len(data) < 12:
+        return None
+    sentinel, state, backend, steps, _, max_rate = struct.unpack('<LBBBBL', data[:12])
+    if sentinel != BENCHMARK_DATA_SENTINEL:
+        print(f"Warning: Invalid benchmark sentinel 0x{sentinel:08X}, expected 0x{BENCHMARK_DATA_SENTINEL:08X}")
+        return None
+
+    results = []
+    for i in range(steps):
+        offset = 12 + i * 8
+        rate, load, ok, _ = struct.unpack('<LHBB', data[offset:offset + 8])
+        results.append((rate, load, ok != 0))
+    return state, backend, max_rate, results
+
+def main():
+    try:
+        print("Looking for RP2040 HAL DRO device...")
+        dev = find_device()
+        setup_device(dev)
+        flush_in(dev)
+
+        print("Starting encoder benchmark, the scale inputs are disabled while it runs")
+        dev.write(EP_OUT, [VENDOR_REQUEST_RUN_BENCHMARK], timeout=100)
+        time.sleep(0.1)
+        flush_in(dev)
+
+        while True:
+            time.sleep(0.25)
+            status = get_benchmark(dev)
+            if status is None:
+                continue
+            state, backend, max_rate, results = status
+            if state != 1:
+                break
+
+        if state == 3:
+            print("Benchmark unavailable, eight-axis firmware uses every PIO state machine for counting")
+            sys.exit(1)
+        if state != 2:
+            print(f"Benchmark did not complete, state: {BENCHMARK_STATES.get(state, state)}")
+            sys.exit(1)
+
+        print(f"\nCounting backend: {BACKENDS.get(backend, backend)}")
+        print(f"{'Edges/s/axis':>14} {'CPU load':>10} {'Counts':>8}")
+        print("-" * 34)
+        for rate, load, ok in results:
+            print(f"{rate:14d} {load / 10.0:9.1f}% {'exact' if ok else 'LOST':>8}")
+        print(f"\nHighest exact edge rate: {max_rate} edges/s per axis")
+
+    except usb.core.USBError as e:
+        print(f"USB Error: {e}")
+        print("Try running with sudo: sudo python3 benchmark_encoders.py")
+        sys.exit(1)
+    except ValueError as e:
+        print(f"Device Error: {e}")
+        sys.exit(1)
+
+if __name__ == "__main__":
+    main()
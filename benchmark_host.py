@@ -0,0 +1,170 @@
+#!/usr/bin/env python3
+"""
+Benchmarks the host side of the RP2040 HAL DRO without a board. Starts
+virtual_device from the firmware host build, runs the rp2040_encoder
+component against it under halrun once per I/O mode and prints for each
+the transfer and sample rates, the round trip percentiles of the request
+frames and the CPU time the component spent per sample.
+
+Needs LinuxCNC with the component installed and the firmware host build:
+cmake -S rp2040-firmware/host -B rp2040-firmware/build/host
+cmake --build rp2040-firmware/build/host
+"""
+
+import argparse
+import os
+import subprocess
+import sys
+import tempfile
+import time
+
+from frame_log import LOG_FLAG_OUT, decode_samples, frame_id, percentile, read_records
+
+DEFAULT_DEVICE = os.path.join(os.path.dirname(os.path.abspath(__file__)),
+                              'rp2040-firmware', 'build', 'host', 'virtual_device_irq')
+
+# name, stream-rate, wire-format
+MODES = [
+    ('poll scaled', 0, 0),
+    ('poll counts', 0, 1),
+    ('stream 1 kHz scaled', 1000, 0),
+    ('stream 1 kHz counts', 1000, 1),
+    ('stream 1 kHz delta', 1000, 2),
+    ('stream 10 kHz counts', 10000, 1),
+    ('stream 10 kHz delta', 10000, 2),
+]
+
+COMPONENT_START_S = 10
+
+def wait_for(condition, timeout):
+    """Polls condition until it returns something or the timeout passes"""
+    deadline = time.monotonic() + timeout
+    while time.monotonic() < deadline:
+        result = condition()
+        if result:
+            return result
+        time.sleep(0.05)
+    return None
+
+def component_pid():
+    """PID of the running rp2040_encoder, None without one"""
+    result = subprocess.run(['pgrep', '-nx', 'rp2040_encoder'], capture_output=True, text=True)
+    return int(result.stdout) if result.returncode == 0 else None
+
+def cpu_seconds(pid):
+    """CPU seconds of all threads of a process, from the scheduler
+    statistics where the kernel keeps them, otherwise in clock ticks"""
+    try:
+        total = 0
+        for task in os.listdir(f'/proc/{pid}/task'):
+            with open(f'/proc/{pid}/task/{task}/schedstat') as f:
+                total += int(f.read().split()[0])
+        return total / 1e9
+    except OSError:
+        with open(f'/proc/{pid}/stat') as f:
+            fields = f.read().rsplit(')', 1)[1].split()
+        return (int(fields[11]) + int(fields[12])) / os.sysconf('SC_CLK_TCK')
+
+def analyze(log, start_us, end_us):
+    """Transfer counts, samples and round trips of the requests sent
+    between start_us and end_us"""
+    stats = {'transfers': 0, 'requests': 0, 'samples': 0}
+    sent = {}
+    trips = []
+    for time_us, _, flags, transfer in read_records(log):
+        request_id = frame_id(transfer)
+        if flags & LOG_FLAG_OUT:
+            if start_us <= time_us < end_us:
+                stats['requests'] += 1
+                sent[request_id] = time_us
+            continue
+        if request_id in sent:
+            trips.append(max(0, time_us - sent.pop(request_id)))
+        if start_us <= time_us < end_us:
+            stats['transfers'] += 1
+            stats['samples'] += len(decode_samples(transfer))
+    stats['trips'] = sorted(trips)
+    return stats
+
+def run_mode(args, workdir, index, stream_rate, wire_format):
+    """Runs the component in one mode, returns its stats and CPU seconds"""
+    log = os.path.join(workdir, f'mode{index}.rpel')
+    hal = os.path.join(workdir, f'mode{index}.hal')
+    with open(hal, 'w') as f:
+        f.write(f"loadusr -W rp2040_encoder socket={args.socket} record={log}\n"
+                f"setp rp2040_encoder.0.stream-rate {stream_rate}\n"
+                f"setp rp2040_encoder.0.wire-format {wire_format}\n"
+                f"setp rp2040_encoder.0.keepalive-ms 0\n"
+                f"setp rp2040_encoder.0.test-mode 1\n"
+                f"loadusr -w sleep {args.warmup + args.duration + 1}\n")
+
+    halrun = subprocess.Popen(['halrun', '-f', hal], stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+    try:
+        pid = wait_for(component_pid, COMPONENT_START_S)
+        if pid is None:
+            raise RuntimeError("rp2040_encoder did not start")
+        time.sleep(args.warmup)
+        start, cpu_start = time.monotonic(), cpu_seconds(pid)
+        time.sleep(args.duration)
+        end, cpu_end = time.monotonic(), cpu_seconds(pid)
+        halrun.wait()
+    finally:
+        if halrun.poll() is None:
+            halrun.terminate()
+            halrun.wait()
+        subprocess.run(['halrun', '-U'], stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+
+    # The log is on CLOCK_MONOTONIC, as is time.monotonic() on Linux
+    stats = analyze(log, int(start * 1e6), int(end * 1e6))
+    stats['seconds'] = end - start
+    stats['cpu'] = cpu_end - cpu_start
+    return stats
+
+def print_row(name, stats):
+    seconds = stats['seconds']
+    trips = stats['trips']
+    rtt = (f"{percentile(trips, 0.5):7d} {percentile(trips, 0.9):7d} {percentile(trips, 0.99):7d} {trips[-1]:7d}"
+           if trips else f"{'-':>7} {'-':>7} {'-':>7} {'-':>7}")
+    cpu = f"{stats['cpu'] * 1e6 / stats['samples']:8.1f}" if stats['samples'] else f"{'-':>8}"
+    print(f"{name:<22} {stats['transfers'] / seconds:8.0f} {stats['requests'] / seconds:8.0f} "
+          f"{stats['samples'] / seconds:8.0f} {rtt} {cpu}")
+
+def main():
+    parser = argparse.ArgumentParser(description='Host side benchmark of the RP2040 encoder interface')
+    parser.add_argument('--device', default=DEFAULT_DEVICE, help='virtual_device executable')
+    parser.add_argument('--loop-us', type=int, default=20,
+                        help='Emulated time per pass of the device main loop')
+    parser.add_argument('-d', '--duration', type=float, default=5.0, help='Seconds measured per mode')
+    parser.add_argument('-w', '--warmup', type=float, default=1.0,
+                        help='Seconds per mode before measuring, for the handshake and settings')
+
+    args = parser.parse_args()
+
+    if component_pid() is not None:
+        print("Error: rp2040_encoder is already running")
+        sys.exit(1)
+
+    with tempfile.TemporaryDirectory() as workdir:
+        args.socket = os.path.join(workdir, 'device.sock')
+        try:
+            device = subprocess.Popen([args.device, '--socket', args.socket, '--loop-us', str(args.loop_us)],
+                                      stdout=subprocess.DEVNULL)
+        except OSError as e:
+            print(f"Error: cannot start {args.device}: {e}")
+            sys.exit(1)
+        try:
+            if not wait_for(lambda: os.path.exists(args.socket), COMPONENT_START_S):
+                raise RuntimeError("virtual_device did not start")
+            print(f"{'mode':<22} {'xfer/s':>8} {'req/s':>8} {'sample/s':>8} "
+                  f"{'rtt p50':>7} {'p90':>7} {'p99':>7} {'max':>7} {'cpu us':>8}")
+            for index, (name, stream_rate, wire_format) in enumerate(MODES):
+                print_row(name, run_mode(args, workdir, index, stream_rate, wire_format))
+        except (OSError, RuntimeError, ValueError) as e:
+            print(f"Error: {e}")
+            sys.exit(1)
+        finally:
+            device.terminate()
+            device.wait()
+
+if __name__ == "__main__":
+    main()
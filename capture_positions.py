@@ -0,0 +1,193 @@
+#!/usr/bin/env python3
+"""
+Records raw encoder counts at up to 50 kHz on the RP2040 HAL DRO around a
+trigger, downloads the capture buffer in bulk and writes it to a binary file
+for backlash, chatter and vibration analysis.
+Requires pyusb: pip install pyusb
+
+File layout, little endian:
+  [magic 'DROC':4][version:2][axes:1][sample_size:1][rate_hz:4][count:4]
+  [trigger_index:4][missed:4][first_time_us:8][trigger:1][axis:1][reserved:2]
+followed by count samples of [time_us:4][count per axis:4 * axes], where
+time_us is the low word of the device timestamp.
+"""
+
+import usb.core
+import usb.util
+import argparse
+import struct
+import time
+import sys
+
+# USB device identifiers
+VENDOR_ID = 0x2E8A  # Raspberry Pi Foundation (RP2040)
+PRODUCT_ID = 0xC0DE  # Our custom product ID
+
+# Request codes
+VENDOR_REQUEST_START_CAPTURE = 0x0A
+VENDOR_REQUEST_GET_CAPTURE = 0x0B
+VENDOR_REQUEST_READ_CAPTURE = 0x0C
+VENDOR_REQUEST_TRIGGER_CAPTURE = 0x0D
+
+# Sentinel value for data validation
+CAPTURE_DATA_SENTINEL = 0x6D4B2E17
+
+CAPTURE_STATES = {0: "idle", 1: "armed", 2: "triggered", 3: "done"}
+TRIGGERS = {"immediate": 0, "rising": 1, "falling": 2, "motion": 3, "manual": 4}
+
+FILE_MAGIC = b'DROC'
+FILE_VERSION = 1
+
+# Endpoints
+EP_IN = 0x81
+EP_OUT = 0x01
+
+def find_device():
+    """Find the USB device"""
+    dev = usb.core.find(idVendor=VENDOR_ID, idProduct=PRODUCT_ID)
+    if dev is None:
+        raise ValueError("Device not found")
+    return dev
+
+def setup_device(dev):
+    """Setup the USB device"""
+    dev.set_configuration()
+    cfg = dev.get_active_configuration()
+    intf = cfg[(0, 0)]
+    try:
+        if dev.is_kernel_driver_active(intf.bInterfaceNumber):
+            dev.detach_kernel_driver(intf.bInterfaceNumber)
+    except usb.core.USBError:
+        # On macOS, this might not be needed or supported
+        pass
+    usb.util.claim_interface(dev, intf.bInterfaceNumber)
+    return intf
+
+def flush_in(dev):
+    """Drop anything still queued on the IN endpoint"""
+    try:
+        while True:
+            dev.read(EP_IN, 64, timeout=10)
+    except usb.core.USBTimeoutError:
+        pass
+
+def get_capture(dev):
+    """Get the capture state and result description"""
+    dev.write(EP_OUT, [VENDOR_REQUEST_GET_CAPTURE], timeout=100)
+    data = bytes(dev.read(EP_IN, 64, timeout=500))
+
+    # [sentinel:4][state:1][axes:1][sample_size:1][trigger:1][rate:4][count:4]
+    # [trigger_offset:4][missed:4][first_time_us:8]
+    if len(data) < 32:
+        return None
+    fields = struct.unpack('<LBBBBLLLLQ', data[:32])
+    if fields[0] != CAPTURE_DATA_SENTINEL:
+        print(f"Warning: Invalid capture sentinel 0x{fields[0]:08X}, expected 0x{CAPTURE_DATA_SENTINEL:08X}")
+        return None
+    keys = ('state', 'axes', 'sample_size', 'trigger', 'rate', 'count', 'trigger_index', 'missed', 'first_time_us')
+    return dict(zip(keys, fields[1:]))
+
+def read_capture(dev, count, sample_size):
+    """Download count samples as one bulk transfer"""
+    dev.write(EP_OUT, [VENDOR_REQUEST_READ_CAPTURE] + list(struct.pack('<LL', 0, count)), timeout=100)
+    total = count * sample_size
+    data = bytearray()
+    while len(data) < total:
+        data += dev.read(EP_IN, total - len(data), timeout=2000)
+    return bytes(data)
+
+def write_capture(path, status, axis, data):
+    """Write the header and the raw samples"""
+    header = struct.pack('<4sHBBLLLLQBBH', FILE_MAGIC, FILE_VERSION, status['axes'], status['sample_size'],
+                         status['rate'], status['count'], status['trigger_index'], status['missed'],
+                         status['first_time_us'], status['trigger'], axis, 0)
+    with open(path, 'wb') as f:
+        f.write(header)
+        f.write(data)
+
+def write_csv(path, status, data):
+    """Write one line per sample, time relative to the trigger sample"""
+    axes = status['axes']
+    size = status['sample_size']
+    sample = struct.Struct('<L' + 'l' * axes)
+    trigger_time = sample.unpack_from(data, status['trigger_index'] * size)[0]
+    with open(path, 'w') as f:
+        f.write('time_us,' + ','.join(f'axis{i}' for i in range(axes)) + '\n')
+        for offset in range(0, len(data), size):
+            fields = sample.unpack_from(data, offset)
+            # The device time wraps every 71 minutes, differences stay valid
+            relative = ((fields[0] - trigger_time + 0x80000000) & 0xFFFFFFFF) - 0x80000000
+            f.write(f'{relative},' + ','.join(str(v) for v in fields[1:]) + '\n')
+
+def main():
+    parser = argparse.ArgumentParser(description='High-rate position capture for the RP2040 encoder interface')
+    parser.add_argument('output', help='Binary capture file to write')
+    parser.add_argument('-r', '--rate', type=int, default=10000,
+                        help='Sample rate in Hz, at most 50000 (default: 10000)')
+    parser.add_argument('-t', '--trigger', choices=TRIGGERS.keys(), default='immediate',
+                        help='Trigger condition (default: immediate)')
+    parser.add_argument('-a', '--axis', type=int, default=0,
+                        help='Axis the trigger watches (default: 0)')
+    parser.add_argument('-T', '--threshold', type=int, default=0,
+                        help='Trigger count for rising/falling, distance in counts for motion')
+    parser.add_argument('-p', '--pre', type=int, default=0,
+                        help='Samples to keep before the trigger (default: 0)')
+    parser.add_argument('-w', '--timeout', type=float, default=60.0,
+                        help='Seconds to wait for the trigger (default: 60)')
+    parser.add_argument('-c', '--csv', help='Also write the samples as CSV')
+
+    args = parser.parse_args()
+
+    try:
+        print("Looking for RP2040 HAL DRO device...")
+        dev = find_device()
+        setup_device(dev)
+        flush_in(dev)
+
+        start = struct.pack('<LBBlL', args.rate, TRIGGERS[args.trigger], args.axis, args.threshold, args.pre)
+        dev.write(EP_OUT, [VENDOR_REQUEST_START_CAPTURE] + list(start), timeout=100)
+        print(f"Capture armed at {args.rate} Hz, trigger {args.trigger}, Ctrl+C triggers manually")
+
+        deadline = time.time() + args.timeout
+        status = None
+        while True:
+            try:
+                time.sleep(0.1)
+            except KeyboardInterrupt:
+                dev.write(EP_OUT, [VENDOR_REQUEST_TRIGGER_CAPTURE], timeout=100)
+                continue
+            status = get_capture(dev)
+            if status is None:
+                continue
+            if status['state'] in (0, 3):
+                break
+            if time.time() > deadline:
+                dev.write(EP_OUT, [VENDOR_REQUEST_START_CAPTURE] + [0] * 14, timeout=100)
+                print("No trigger before the timeout, capture stopped")
+                sys.exit(1)
+
+        if status['state'] != 3:
+            print(f"Capture refused, check rate and axis. State: {CAPTURE_STATES.get(status['state'])}")
+            sys.exit(1)
+
+        print(f"Downloading {status['count']} samples ({status['count'] * status['sample_size']} bytes)...")
+        started = time.time()
+        data = read_capture(dev, status['count'], status['sample_size'])
+        elapsed = time.time() - started
+        print(f"Downloaded in {elapsed:.2f} s ({len(data) / elapsed / 1024:.0f} KiB/s)")
+
+        write_capture(args.output, status, args.axis, data)
+        if args.csv:
+            write_csv(args.csv, status, data)
+        print(f"Trigger at sample {status['trigger_index']}, {status['missed']} samples missed")
+
+    except usb.core.USBError as e:
+        print(f"USB Error: {e}")
+        print("Try running with sudo: sudo python3 capture_positions.py")
+        sys.exit(1)
+    except ValueError as e:
+        print(f"Device Error: {e}")
+        sys.exit(1)
+
+if __name__ == "__main__":
+    main()
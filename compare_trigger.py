@@ -0,0 +1,220 @@
+#!/usr/bin/env python3
+"""
+Arms a position compare channel of the RP2040 HAL DRO, which drives GPIO 28
+(channel 0) or 29 (channel 1) when an axis count crosses target positions,
+and prints the hits the device pushes. Targets are in counts.
+Requires pyusb: pip install pyusb
+"""
+
+import usb.core
+import usb.util
+import argparse
+import struct
+import time
+import sys
+
+# USB device identifiers
+VENDOR_ID = 0x2E8A  # Raspberry Pi Foundation (RP2040)
+PRODUCT_ID = 0xC0DE  # Our custom product ID
+
+# Request codes
+VENDOR_REQUEST_SET_COMPARE = 0x17
+VENDOR_REQUEST_ADD_COMPARE_TARGETS = 0x18
+VENDOR_REQUEST_GET_COMPARE = 0x19
+
+# Sentinel values for data validation
+COMPARE_STATUS_SENTINEL = 0x3A7E5C19
+COMPARE_HIT_SENTINEL = 0x71D2B84F
+
+MODE_OFF = 0
+MODE_LIST = 1
+MODE_PERIODIC = 2
+MODES = ("off", "list", "periodic")
+
+MAX_TARGETS = 256
+TARGETS_PER_REQUEST = 8
+
+# Endpoints
+EP_IN = 0x81
+EP_OUT = 0x01
+
+def find_device():
+    """Find the USB device"""
+    dev = usb.core.find(idVendor=VENDOR_ID, idProduct=PRODUCT_ID)
+    if dev is None:
+        raise ValueError("Device not found")
+    if dev.bcdDevice < 0x0280:
+        raise ValueError(f"Firmware {dev.bcdDevice >> 8}.{(dev.bcdDevice >> 4) & 0xF} has no position compare, 2.8 needed")
+    return dev
+
+def setup_device(dev):
+    """Setup the USB device"""
+    dev.set_configuration()
+    cfg = dev.get_active_configuration()
+    intf = cfg[(0, 0)]
+    try:
+        if dev.is_kernel_driver_active(intf.bInterfaceNumber):
+            dev.detach_kernel_driver(intf.bInterfaceNumber)
+    except usb.core.USBError:
+        # On macOS, this might not be needed or supported
+        pass
+    usb.util.claim_interface(dev, intf.bInterfaceNumber)
+    return intf
+
+def flush_in(dev):
+    """Drop anything still queued on the IN endpoint"""
+    try:
+        while True:
+            dev.read(EP_IN, 64, timeout=10)
+    except usb.core.USBTimeoutError:
+        pass
+
+def set_compare(dev, channel, axis, mode, pulse_us=0, first=0, spacing=0, count=0):
+    """[channel:1][axis:1][mode:1][reserved:1][pulse_us:2][first:4][spacing:4][count:4]"""
+    args = struct.pack('<BBBxHllL', channel, axis, mode, pulse_us, first, spacing, count)
+    dev.write(EP_OUT, bytes([VENDOR_REQUEST_SET_COMPARE]) + args, timeout=100)
+
+def add_targets(dev, channel, targets):
+    """Append targets to a disarmed channel, eight per request"""
+    for start in range(0, len(targets), TARGETS_PER_REQUEST):
+        chunk = targets[start:start + TARGETS_PER_REQUEST]
+        padded = chunk + [0] * (TARGETS_PER_REQUEST - len(chunk))
+        args = struct.pack(f'<BB{TARGETS_PER_REQUEST}l', channel, len(chunk), *padded)
+        dev.write(EP_OUT, bytes([VENDOR_REQUEST_ADD_COMPARE_TARGETS]) + args, timeout=100)
+
+def get_status(dev):
+    """Get mode, axis, targets, next index, hits and the last hit per channel"""
+    dev.write(EP_OUT, [VENDOR_REQUEST_GET_COMPARE], timeout=100)
+    # Hits pushed in between arrive first
+    for _ in range(32):
+        data = bytes(dev.read(EP_IN, 64, timeout=500))
+        if len(data) >= 8 and struct.unpack_from('<L', data)[0] == COMPARE_STATUS_SENTINEL:
+            break
+    else:
+        return None
+
+    # [sentinel:4][channels:1][reserved:3], per channel [mode:1][axis:1]
+    # [targets:2][next:4][hits:4][last_count:4][last_time_us:8]
+    channels = data[4]
+    if len(data) < 8 + channels * 24:
+        return None
+    return [struct.unpack_from('<BBHLLlQ', data, 8 + c * 24) for c in range(channels)]
+
+def parse_hit(data):
+    """[sentinel:4][channel:1][axis:1][queued:1][crossed:1][index:4][hits:4]
+    [lost:4][count:4][time_us:8]"""
+    if len(data) < 32:
+        return None
+    sentinel, channel, axis, queued, crossed, index, hits, lost, count, time_us = \
+        struct.unpack_from('<LBBBBLLLlQ', data)
+    if sentinel != COMPARE_HIT_SENTINEL:
+        return None
+    return {'channel': channel, 'axis': axis, 'queued': queued, 'crossed': crossed, 'index': index,
+            'hits': hits, 'lost': lost, 'count': count, 'time_us': time_us}
+
+def read_targets(path):
+    """One count per line, # starts a comment"""
+    targets = []
+    with open(path) as f:
+        for line in f:
+            line = line.split('#', 1)[0].strip()
+            if line:
+                targets.append(int(line))
+    return targets
+
+def print_status(dev):
+    """Print the state of every channel"""
+    status = get_status(dev)
+    if status is None:
+        print("No valid compare status")
+        return
+    for channel, (mode, axis, targets, index, hits, last_count, last_time_us) in enumerate(status):
+        name = MODES[mode] if mode < len(MODES) else f"mode {mode}"
+        print(f"channel {channel}: {name}, axis {axis}, {targets} targets, next {index}, {hits} hits, "
+              f"last at {last_count} ({last_time_us} us)")
+
+def watch_hits(dev):
+    """Print pushed hits until Ctrl+C"""
+    last_time_us = None
+    while True:
+        try:
+            data = bytes(dev.read(EP_IN, 64, timeout=1000))
+        except usb.core.USBTimeoutError:
+            continue
+        hit = parse_hit(data)
+        if hit is None:
+            continue
+        since = f", +{hit['time_us'] - last_time_us} us" if last_time_us is not None else ""
+        last_time_us = hit['time_us']
+        lost = f", {hit['lost']} lost" if hit['lost'] else ""
+        print(f"channel {hit['channel']} axis {hit['axis']}: target {hit['index']} at {hit['count']}, "
+              f"{hit['crossed']} crossed, {hit['hits']} hits{since}{lost}")
+
+def main():
+    parser = argparse.ArgumentParser(description='Position compare outputs of the RP2040 encoder interface')
+    parser.add_argument('-c', '--channel', type=int, default=0, choices=(0, 1),
+                        help='Compare channel, 0 drives GPIO 28 and 1 GPIO 29 (default 0)')
+    parser.add_argument('-a', '--axis', type=int, default=0,
+                        help='Axis to watch (default 0)')
+    parser.add_argument('-p', '--pulse-us', type=int, default=0,
+                        help='Output pulse per target in us, 0 toggles instead (default 0)')
+    parser.add_argument('-l', '--list', metavar='FILE',
+                        help='Targets in counts, one per line, strictly ascending or descending')
+    parser.add_argument('-f', '--first', type=int,
+                        help='First periodic target in counts')
+    parser.add_argument('-s', '--spacing', type=int,
+                        help='Counts between periodic targets, negative to count down')
+    parser.add_argument('-n', '--count', type=int, default=0,
+                        help='Periodic targets, 0 for no end (default 0)')
+    parser.add_argument('--off', action='store_true',
+                        help='Disarm the channel')
+    parser.add_argument('--status', action='store_true',
+                        help='Only print the state of the channels')
+
+    args = parser.parse_args()
+    periodic = args.first is not None or args.spacing is not None
+    if sum((bool(args.list), periodic, args.off, args.status)) != 1:
+        parser.error("give one of --list, --first/--spacing, --off or --status")
+    if periodic and (args.first is None or not args.spacing):
+        parser.error("periodic targets need --first and a nonzero --spacing")
+    if not 0 <= args.pulse_us <= 65535:
+        parser.error("--pulse-us is 0 to 65535")
+
+    try:
+        dev = find_device()
+        setup_device(dev)
+        flush_in(dev)
+
+        if args.status:
+            print_status(dev)
+            return
+
+        # Disarming also drops the targets of an earlier list
+        set_compare(dev, args.channel, 0, MODE_OFF)
+        if args.off:
+            return
+        if args.list:
+            targets = read_targets(args.list)
+            if not 0 < len(targets) <= MAX_TARGETS:
+                raise ValueError(f"{len(targets)} targets, 1 to {MAX_TARGETS} fit")
+            add_targets(dev, args.channel, targets)
+            set_compare(dev, args.channel, args.axis, MODE_LIST, args.pulse_us)
+        else:
+            set_compare(dev, args.channel, args.axis, MODE_PERIODIC, args.pulse_us,
+                        args.first, args.spacing, args.count)
+        time.sleep(0.05)
+        print_status(dev)
+        watch_hits(dev)
+
+    except KeyboardInterrupt:
+        pass
+    except usb.core.USBError as e:
+        print(f"USB Error: {e}")
+        print("Try running with sudo: sudo python3 compare_trigger.py")
+        sys.exit(1)
+    except (ValueError, OSError) as e:
+        print(f"Device Error: {e}")
+        sys.exit(1)
+
+if __name__ == "__main__":
+    main()
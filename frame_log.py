@@ -0,0 +1,230 @@
+#!/usr/bin/env python3
+"""
+Reads and writes frame logs of the RP2040 HAL DRO: every transfer received
+from the device with its host receive time, as written by
+`loadusr rp2040_encoder record=FILE` and `monitor_positions.py --log`, and
+replayed by `loadusr rp2040_encoder replay=FILE`. Version 2 logs of the
+component also hold the request frames it sent, so the summary reports
+how long the replies took.
+
+The file is a 16 byte header followed by one record per transfer, each a
+16 byte record header and the transfer padded to 8 bytes, so it can be
+mapped and walked in place.
+"""
+
+import argparse
+import csv
+import mmap
+import struct
+import sys
+
+LOG_MAGIC = 0x4C455052  # "RPEL"
+LOG_VERSION = 2
+LOG_HEADER = struct.Struct('<LHHQ')    # magic, version, header size, reserved
+RECORD_HEADER = struct.Struct('<QHBB4x')  # receive_us, length, board, flags
+LOG_FLAG_OUT = 0x01  # a request frame sent, version 2 only
+
+# Sentinel values for data validation
+POSITION_DATA_SENTINEL = 0x3F8A7C91
+COUNTS_DATA_SENTINEL = 0x5C1E93A6
+FRAME_MAGIC = 0xA5
+FRAME_HEADER_SIZE = 8
+VENDOR_REQUEST_GET_POSITION = 0x01
+
+FORMAT_COUNTS_DELTA = 2
+COUNTS_HEADER_SIZE = 20
+DEFAULT_AXES = 4
+
+class LogWriter:
+    """Appends transfers to a new frame log"""
+    def __init__(self, path):
+        self.file = open(path, 'wb')
+        self.file.write(LOG_HEADER.pack(LOG_MAGIC, LOG_VERSION, LOG_HEADER.size, 0))
+
+    def write(self, receive_us, data, board=0, flags=0):
+        data = bytes(data)
+        self.file.write(RECORD_HEADER.pack(receive_us, len(data), board, flags))
+        self.file.write(data)
+        self.file.write(b'\0' * (-len(data) % 8))
+
+    def close(self):
+        self.file.close()
+
+def read_records(path):
+    """Yields (time_us, board, flags, transfer) for every record, sent
+    request frames included"""
+    with open(path, 'rb') as f:
+        data = mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ)
+        try:
+            if len(data) < LOG_HEADER.size:
+                raise ValueError(f"{path} is no frame log")
+            magic, version, header_size, _ = LOG_HEADER.unpack_from(data, 0)
+            if magic != LOG_MAGIC or not 1 <= version <= LOG_VERSION:
+                raise ValueError(f"{path} is no frame log")
+            offset = header_size
+            while offset + RECORD_HEADER.size <= len(data):
+                time_us, length, board, flags = RECORD_HEADER.unpack_from(data, offset)
+                start = offset + RECORD_HEADER.size
+                if start + length > len(data):
+                    break
+                yield time_us, board, flags, data[start:start + length]
+                offset = start + length + (-length % 8)
+        finally:
+            data.close()
+
+def read_log(path):
+    """Yields (receive_us, board, transfer) for every transfer received"""
+    for receive_us, board, flags, transfer in read_records(path):
+        if not flags & LOG_FLAG_OUT:
+            yield receive_us, board, transfer
+
+def frame_id(transfer):
+    """Request id of a request or reply frame, None for other transfers"""
+    if len(transfer) < 8 or transfer[0] != FRAME_MAGIC:
+        return None
+    return struct.unpack_from('<H', transfer, 6)[0]
+
+def percentile(values, fraction):
+    """Nearest rank percentile of sorted values"""
+    return values[min(len(values) - 1, int(fraction * len(values)))]
+
+def round_trips(path):
+    """Microseconds from every logged request frame to its reply, per board"""
+    sent = {}
+    trips = {}
+    for time_us, board, flags, transfer in read_records(path):
+        request_id = frame_id(transfer)
+        if request_id is None:
+            continue
+        if flags & LOG_FLAG_OUT:
+            sent[(board, request_id)] = time_us
+        elif (board, request_id) in sent:
+            # The request is logged once sent, its reply can come first
+            trips.setdefault(board, []).append(max(0, time_us - sent.pop((board, request_id))))
+    return trips
+
+def decode_reply_samples(transfer):
+    """Samples in the GET_POSITION entries of a reply frame"""
+    if len(transfer) < FRAME_HEADER_SIZE:
+        return []
+    payload_length, = struct.unpack_from('<H', transfer, 4)
+    end = min(len(transfer), FRAME_HEADER_SIZE + payload_length)
+    offset = FRAME_HEADER_SIZE
+    samples = []
+    while offset + 2 <= end:
+        request, length = transfer[offset], transfer[offset + 1]
+        offset += 2
+        if offset + length > end:
+            break
+        if request == VENDOR_REQUEST_GET_POSITION:
+            samples += decode_samples(transfer[offset:offset + length])
+        offset += length
+    return samples
+
+def decode_samples(transfer):
+    """Samples in a position transfer or polled in a reply as (kind,
+    sequence, device_us, values), sequence and device_us are None for
+    firmware without numbering"""
+    if len(transfer) < 4:
+        return []
+    if transfer[0] == FRAME_MAGIC:
+        return decode_reply_samples(transfer)
+    sentinel, = struct.unpack_from('<L', transfer, 0)
+
+    if sentinel == POSITION_DATA_SENTINEL:
+        numbered = (len(transfer) - 16) % 8 == 0 and len(transfer) > 16
+        axes = (len(transfer) - 16) // 8 if numbered else (len(transfer) - 4) // 8
+        if axes < 1:
+            return []
+        values = list(struct.unpack_from(f'<{axes}d', transfer, 4))
+        if numbered:
+            sequence, device_us = struct.unpack_from('<LQ', transfer, 4 + axes * 8)
+            return [('scaled', sequence, device_us, values)]
+        return [('scaled', None, None, values)]
+
+    if sentinel == COUNTS_DATA_SENTINEL and len(transfer) >= COUNTS_HEADER_SIZE:
+        # [format:1][samples:1][axes:1][flags:1][sequence:4][timestamp:8]
+        fmt, count, axes = transfer[4], transfer[5], transfer[6] or DEFAULT_AXES
+        sequence, timestamp = struct.unpack_from('<LQ', transfer, 8)
+        offset = COUNTS_HEADER_SIZE
+        counts = [0] * axes
+        samples = []
+        for n in range(count):
+            delta = fmt == FORMAT_COUNTS_DELTA and n > 0
+            size = 2 + axes * (2 if delta else 4)
+            if offset + size > len(transfer):
+                break
+            time_offset, = struct.unpack_from('<H', transfer, offset)
+            if delta:
+                counts = [c + d for c, d in zip(counts, struct.unpack_from(f'<{axes}h', transfer, offset + 2))]
+            else:
+                counts = list(struct.unpack_from(f'<{axes}l', transfer, offset + 2))
+            samples.append(('counts', sequence + n, timestamp + time_offset, counts))
+            offset += size
+        return samples
+
+    return []
+
+def summarize(path):
+    """Print transfers, samples and sequence gaps per board"""
+    boards = {}
+    first_us = last_us = None
+    for receive_us, board, transfer in read_log(path):
+        stats = boards.setdefault(board, {'transfers': 0, 'replies': 0, 'samples': 0, 'gaps': 0, 'sequence': None})
+        stats['transfers'] += 1
+        if transfer[:1] == bytes([FRAME_MAGIC]):
+            stats['replies'] += 1
+        for _, sequence, _, _ in decode_samples(transfer):
+            stats['samples'] += 1
+            if sequence is not None:
+                if stats['sequence'] is not None and sequence != (stats['sequence'] + 1) & 0xFFFFFFFF:
+                    stats['gaps'] += 1
+                stats['sequence'] = sequence
+        first_us = receive_us if first_us is None else first_us
+        last_us = receive_us
+
+    if first_us is None:
+        print("Empty log")
+        return
+    seconds = (last_us - first_us) / 1e6
+    print(f"{seconds:.3f} s recorded")
+    trips = round_trips(path)
+    for board, stats in sorted(boards.items()):
+        rate = stats['samples'] / seconds if seconds > 0 else 0
+        print(f"board {board}: {stats['transfers']} transfers, {stats['replies']} replies, "
+              f"{stats['samples']} samples ({rate:.0f}/s), {stats['gaps']} sequence gaps")
+        times = sorted(trips.get(board, []))
+        if times:
+            print(f"  round trip us: p50 {percentile(times, 0.5)}, p90 {percentile(times, 0.9)}, "
+                  f"p99 {percentile(times, 0.99)}, max {times[-1]}")
+
+def export_csv(path, out):
+    """One row per sample with receive and device time"""
+    writer = csv.writer(out)
+    writer.writerow(['receive_us', 'board', 'kind', 'sequence', 'device_us'] + [f'axis_{i}' for i in range(8)])
+    for receive_us, board, transfer in read_log(path):
+        for kind, sequence, device_us, values in decode_samples(transfer):
+            writer.writerow([receive_us, board, kind, sequence, device_us] + values)
+
+def main():
+    parser = argparse.ArgumentParser(description='Frame logs of the RP2040 encoder interface')
+    parser.add_argument('log', help='Frame log to read')
+    parser.add_argument('-c', '--csv', metavar='FILE',
+                        help='Write the samples as CSV, - for stdout')
+
+    args = parser.parse_args()
+
+    try:
+        if args.csv == '-':
+            export_csv(args.log, sys.stdout)
+        elif args.csv:
+            with open(args.csv, 'w', newline='') as out:
+                export_csv(args.log, out)
+        else:
+            summarize(args.log)
+    except (OSError, ValueError) as e:
+        print(f"Error: {e}")
+        sys.exit(1)
+
+if __name__ == "__main__":
+    main()
@@ -12,11 +12,12 @@ import time
 import sys
 import argparse
 import datetime
-import csv
 import os
 from collections import deque
 import signal
 
+from frame_log import LogWriter
+
 # USB device identifiers
 VENDOR_ID = 0x2E8A  # Raspberry Pi Foundation (RP2040)
 PRODUCT_ID = 0xC0DE  # Our custom product ID
@@ -43,8 +44,7 @@ class PositionMonitor:
         self.start_positions = None
         self.max_positions = None
         self.min_positions = None
-        self.csv_writer = None
-        self.csv_file = None
+        self.log_writer = None
         self.read_count = 0
         self.success_count = 0
         self.start_time = time.time()
@@ -52,22 +52,20 @@ class PositionMonitor:
         # Setup signal handler for clean exit
         signal.signal(signal.SIGINT, self.signal_handler)
         
-        # Setup CSV logging if requested
+        # Setup logging if requested
         if args.log:
-            self.setup_csv_logging()
+            self.setup_logging()
     
     def signal_handler(self, sig, frame):
         """Handle Ctrl+C gracefully"""
         self.running = False
         print("\n\nShutting down...")
     
-    def setup_csv_logging(self):
-        """Setup CSV file for logging positions"""
+    def setup_logging(self):
+        """Setup a frame log of the raw responses, see frame_log.py"""
         timestamp = datetime.datetime.now().strftime("%Y%m%d_%H%M%S")
-        filename = f"position_log_{timestamp}.csv"
-        self.csv_file = open(filename, 'w', newline='')
-        self.csv_writer = csv.writer(self.csv_file)
-        self.csv_writer.writerow(['timestamp', 'x', 'y', 'z', 'a', 'elapsed_ms'])
+        filename = f"position_log_{timestamp}.rpel"
+        self.log_writer = LogWriter(filename)
         print(f"Logging positions to: {filename}")
     
     def get_position_fast(self):
@@ -79,7 +77,9 @@ class PositionMonitor:
                 return None
             
             # Read response with short timeout
-            data = self.dev.read(EP_IN, 64, timeout=10)
+            data = self.dev.read(EP_IN, 128, timeout=10)
+            if self.log_writer:
+                self.log_writer.write(time.monotonic_ns() // 1000, data)
             
             # Parse the data: [sentinel:4 bytes][positions:32 bytes] = 36 bytes total
             if len(data) >= 36:
@@ -89,7 +89,7 @@ class PositionMonitor:
                     # Clear USB read queue to remove any stale data
                     try:
                         while True:
-                            self.dev.read(EP_IN, 64, timeout=1)
+                            self.dev.read(EP_IN, 128, timeout=1)
                     except usb.core.USBTimeoutError:
                         pass  # Queue is now empty
                     return None
@@ -181,12 +181,6 @@ class PositionMonitor:
                     self.positions_history.append(positions)
                     self.update_statistics(positions)
                     
-                    # Log to CSV if enabled
-                    if self.csv_writer:
-                        timestamp = datetime.datetime.now().isoformat()
-                        elapsed_ms = (current_time - self.start_time) * 1000
-                        self.csv_writer.writerow([timestamp, positions[0], positions[1], positions[2], positions[3], elapsed_ms])
-                    
                     # Update display
                     if not self.args.quiet:
                         line = self.format_position_line(positions, elapsed)
@@ -216,9 +210,9 @@ class PositionMonitor:
         # Print summary
         self.print_summary()
         
-        # Close CSV file if open
-        if self.csv_file:
-            self.csv_file.close()
+        # Close the log if open
+        if self.log_writer:
+            self.log_writer.close()
     
     def print_summary(self):
         """Print monitoring summary"""
@@ -292,7 +286,7 @@ def main():
                         default='simple',
                         help='Display mode (default: simple)')
     parser.add_argument('-l', '--log', action='store_true',
-                        help='Log positions to CSV file')
+                        help='Log the raw responses to a frame log, frame_log.py --csv converts it')
     parser.add_argument('-n', '--newline', action='store_true',
                         help='Print each update on a new line')
     parser.add_argument('-q', '--quiet', action='store_true',
@@ -0,0 +1,167 @@
+#!/usr/bin/env python3
+"""
+Reads the performance counters of the RP2040 HAL DRO: how long encoder
+interrupts, main loop passes and USB replies take on the device, as log2
+histograms in microseconds, and the deepest encoder FIFO seen per axis.
+Requires pyusb: pip install pyusb
+"""
+
+import usb.core
+import usb.util
+import argparse
+import struct
+import time
+import sys
+
+# USB device identifiers
+VENDOR_ID = 0x2E8A  # Raspberry Pi Foundation (RP2040)
+PRODUCT_ID = 0xC0DE  # Our custom product ID
+
+# Request codes
+VENDOR_REQUEST_GET_PERF_COUNTERS = 0x11
+VENDOR_REQUEST_GET_PERF_HISTOGRAM = 0x12
+VENDOR_REQUEST_RESET_PERF_COUNTERS = 0x13
+
+# Sentinel values for data validation
+PERF_COUNTERS_SENTINEL = 0x1F5D3B79
+PERF_HISTOGRAM_SENTINEL = 0x6C2A8E41
+
+HISTOGRAMS = ("encoder irq", "main loop", "usb reply")
+
+# Endpoints
+EP_IN = 0x81
+EP_OUT = 0x01
+
+def find_device():
+    """Find the USB device"""
+    dev = usb.core.find(idVendor=VENDOR_ID, idProduct=PRODUCT_ID)
+    if dev is None:
+        raise ValueError("Device not found")
+    if dev.bcdDevice < 0x0240:
+        raise ValueError(f"Firmware {dev.bcdDevice >> 8}.{(dev.bcdDevice >> 4) & 0xF} has no performance counters, 2.4 needed")
+    return dev
+
+def setup_device(dev):
+    """Setup the USB device"""
+    dev.set_configuration()
+    cfg = dev.get_active_configuration()
+    intf = cfg[(0, 0)]
+    try:
+        if dev.is_kernel_driver_active(intf.bInterfaceNumber):
+            dev.detach_kernel_driver(intf.bInterfaceNumber)
+    except usb.core.USBError:
+        # On macOS, this might not be needed or supported
+        pass
+    usb.util.claim_interface(dev, intf.bInterfaceNumber)
+    return intf
+
+def flush_in(dev):
+    """Drop anything still queued on the IN endpoint"""
+    try:
+        while True:
+            dev.read(EP_IN, 64, timeout=10)
+    except usb.core.USBTimeoutError:
+        pass
+
+def get_counters(dev):
+    """Get count and maximum per histogram and the deepest FIFO per axis"""
+    dev.write(EP_OUT, [VENDOR_REQUEST_GET_PERF_COUNTERS], timeout=100)
+    data = bytes(dev.read(EP_IN, 64, timeout=500))
+
+    # [sentinel:4][axes:1][buckets:1][histograms:1][reserved:1]
+    # [count:4][max_us:4] per histogram, [fifo_max:1] per axis
+    if len(data) < 8:
+        return None
+    sentinel, axes, buckets, histograms = struct.unpack('<LBBBx', data[:8])
+    if sentinel != PERF_COUNTERS_SENTINEL:
+        print(f"Warning: Invalid counters sentinel 0x{sentinel:08X}, expected 0x{PERF_COUNTERS_SENTINEL:08X}")
+        return None
+    if len(data) < 8 + histograms * 8 + axes:
+        return None
+    stats = [struct.unpack_from('<LL', data, 8 + i * 8) for i in range(histograms)]
+    fifo = list(data[8 + histograms * 8:8 + histograms * 8 + axes])
+    return {'buckets': buckets, 'stats': stats, 'fifo_max': fifo}
+
+def get_histogram(dev, index):
+    """Get the buckets of one histogram"""
+    dev.write(EP_OUT, [VENDOR_REQUEST_GET_PERF_HISTOGRAM, index], timeout=100)
+    data = bytes(dev.read(EP_IN, 128, timeout=500))
+
+    # [sentinel:4][index:1][buckets:1][reserved:2][count:4 per bucket]
+    if len(data) < 8:
+        return None
+    sentinel, got_index, buckets = struct.unpack('<LBBxx', data[:8])
+    if sentinel != PERF_HISTOGRAM_SENTINEL or got_index != index or len(data) < 8 + buckets * 4:
+        print(f"Warning: Invalid histogram reply for index {index}")
+        return None
+    return list(struct.unpack_from(f'<{buckets}L', data, 8))
+
+def bucket_label(n, buckets):
+    """Range of durations counted in bucket n"""
+    if n == 0:
+        return "0 us"
+    if n == buckets - 1:
+        return f">= {1 << (n - 1)} us"
+    low = 1 << (n - 1)
+    high = (1 << n) - 1
+    return f"{low}-{high} us" if high > low else f"{low} us"
+
+def print_report(dev, bars):
+    """Print the counters and all histograms"""
+    counters = get_counters(dev)
+    if counters is None:
+        print("No valid counters")
+        return
+    for index, (count, max_us) in enumerate(counters['stats']):
+        name = HISTOGRAMS[index] if index < len(HISTOGRAMS) else f"histogram {index}"
+        print(f"{name}: {count} events, max {max_us} us")
+        if not bars:
+            continue
+        histogram = get_histogram(dev, index)
+        if histogram is None:
+            continue
+        peak = max(histogram) or 1
+        for n, value in enumerate(histogram):
+            if value:
+                print(f"  {bucket_label(n, len(histogram)):>14} {value:>10} {'#' * max(1, value * 40 // peak)}")
+    print("deepest FIFO per axis: " + " ".join(str(level) for level in counters['fifo_max']))
+
+def main():
+    parser = argparse.ArgumentParser(description='Performance counters of the RP2040 encoder interface')
+    parser.add_argument('-r', '--reset', action='store_true',
+                        help='Reset the counters first')
+    parser.add_argument('-w', '--watch', type=float, metavar='SECONDS',
+                        help='Repeat every SECONDS until Ctrl+C')
+    parser.add_argument('-s', '--summary', action='store_true',
+                        help='Only counts and maxima, no histograms')
+
+    args = parser.parse_args()
+
+    try:
+        dev = find_device()
+        setup_device(dev)
+        flush_in(dev)
+
+        if args.reset:
+            dev.write(EP_OUT, [VENDOR_REQUEST_RESET_PERF_COUNTERS], timeout=100)
+            time.sleep(args.watch or 1.0)
+
+        while True:
+            print_report(dev, not args.summary)
+            if not args.watch:
+                break
+            time.sleep(args.watch)
+            print()
+
+    except KeyboardInterrupt:
+        pass
+    except usb.core.USBError as e:
+        print(f"USB Error: {e}")
+        print("Try running with sudo: sudo python3 perf_counters.py")
+        sys.exit(1)
+    except ValueError as e:
+        print(f"Device Error: {e}")
+        sys.exit(1)
+
+if __name__ == "__main__":
+    main()
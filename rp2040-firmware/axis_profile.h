@@ -0,0 +1,80 @@
+#ifndef AXIS_PROFILE_H_
+#define AXIS_PROFILE_H_
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+// What the encoder inputs of a machine are wired to, fixed at build time.
+// A machine gets its own header defining kMachineProfile, selected with
+// AXIS_PROFILE; without one the board defaults below apply.
+
+enum class AxisType : uint8_t {
+    NONE = 0,    // nothing connected, neither claimed nor read, counts 0
+    LINEAR = 1,
+    ROTARY = 2
+};
+
+struct AxisProfile {
+    uint8_t pin;             // A input, B is the next pin
+    bool inverted;           // counts the other way, for a scale mounted backwards
+    AxisType type;
+    double counts_per_unit;  // the default scale is its inverse
+};
+
+template <size_t kAxes>
+using BoardProfile = std::array<AxisProfile, kAxes>;
+
+// GPIO 8 enables the level shifter and GPIO 16 drives the WS2812 on the
+// RP2040-Zero, so encoders 4 to 7 take the remaining header pins. Encoder 3
+// is a rotary table in degrees, the others linear scales in mm.
+template <size_t kAxes>
+constexpr BoardProfile<kAxes> default_axis_profile() {
+    static_assert(kAxes <= 8, "the default profile has eight axes");
+    constexpr std::array<uint8_t, 8> kPins = {0, 2, 4, 6, 9, 11, 13, 26};
+    BoardProfile<kAxes> profile{};
+    for (size_t i = 0; i < kAxes; i++) {
+        bool rotary = i == 3;
+        profile[i] = {kPins[i], false, rotary ? AxisType::ROTARY : AxisType::LINEAR, rotary ? 10.0 : 1000.0};
+    }
+    return profile;
+}
+
+// True if a connected axis reads the pin
+template <size_t kAxes>
+constexpr bool profile_uses_pin(const BoardProfile<kAxes>& profile, unsigned pin) {
+    for (const AxisProfile& axis : profile) {
+        if (axis.type != AxisType::NONE && (axis.pin == pin || axis.pin + 1u == pin)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Connected axes need both inputs on GPIO 0 to 29, no pin shared with
+// another axis and a positive resolution
+template <size_t kAxes>
+constexpr bool is_valid_axis_profile(const BoardProfile<kAxes>& profile) {
+    for (size_t i = 0; i < kAxes; i++) {
+        const AxisProfile& axis = profile[i];
+        if (axis.type == AxisType::NONE) {
+            continue;
+        }
+        if (axis.pin + 1u > 29 || !(axis.counts_per_unit > 0.0)) {
+            return false;
+        }
+        for (size_t j = i + 1; j < kAxes; j++) {
+            const AxisProfile& other = profile[j];
+            if (other.type != AxisType::NONE && other.pin + 1u >= axis.pin && other.pin <= axis.pin + 1u) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+#ifdef AXIS_PROFILE
+#include AXIS_PROFILE
+#endif
+
+#endif
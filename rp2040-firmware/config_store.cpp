@@ -0,0 +1,172 @@
+#include "config_store.h"
+
+#include <cstddef>
+#include <cstring>
+
+#include "encoder_benchmark.h"
+#include "pico/flash.h"
+#include "pico/time.h"
+#include "position.h"
+#include "usb_device.h"
+
+namespace {
+
+// Long enough for core1 to park itself in RAM
+constexpr uint32_t kFlashTimeoutMs = 100;
+
+struct FlashWrite {
+    uint32_t offset;
+    bool erase;
+    const uint8_t* page;
+};
+
+void write_flash(void* param) {
+    const FlashWrite* write = static_cast<const FlashWrite*>(param);
+    if (write->erase) {
+        flash_range_erase(write->offset - write->offset % FLASH_SECTOR_SIZE, FLASH_SECTOR_SIZE);
+    }
+    flash_range_program(write->offset, write->page, FLASH_PAGE_SIZE);
+}
+
+uint32_t fnv1a(uint32_t hash, const void* data, size_t length) {
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    for (size_t i = 0; i < length; i++) {
+        hash = (hash ^ bytes[i]) * 16777619u;
+    }
+    return hash;
+}
+
+}  // namespace
+
+ConfigStore& ConfigStore::instance() {
+    static ConfigStore store;
+    return store;
+}
+
+const ConfigStore::Record* ConfigStore::slot_record(size_t slot) {
+    return reinterpret_cast<const Record*>(XIP_BASE + kFlashOffset + slot * FLASH_PAGE_SIZE);
+}
+
+uint16_t ConfigStore::record_crc(const Record& record) {
+    return USBDevice::frame_crc(reinterpret_cast<const uint8_t*>(&record), offsetof(Record, crc));
+}
+
+bool ConfigStore::is_valid(const Record& record) {
+    return record.magic == kMagic && record.version == kVersion &&
+           record.axes == QuadratureEncoder::kNumEncoders && record.crc == record_crc(record);
+}
+
+bool ConfigStore::is_blank(size_t slot) {
+    const uint8_t* page = reinterpret_cast<const uint8_t*>(slot_record(slot));
+    for (size_t i = 0; i < FLASH_PAGE_SIZE; i++) {
+        if (page[i] != 0xFF) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool ConfigStore::load() {
+    newest_slot = -1;
+    for (size_t slot = 0; slot < kSlots; slot++) {
+        const Record& record = *slot_record(slot);
+        if (is_valid(record) && (newest_slot < 0 || record.sequence > sequence)) {
+            newest_slot = static_cast<int>(slot);
+            sequence = record.sequence;
+        }
+    }
+    if (newest_slot < 0) {
+        sequence = 0;
+        from_flash = false;
+        return false;
+    }
+
+    Record record;
+    memcpy(&record, slot_record(static_cast<size_t>(newest_slot)), sizeof(record));
+    Position& pos = Position::instance();
+    QuadratureEncoder& encoder = QuadratureEncoder::instance();
+    for (size_t i = 0; i < QuadratureEncoder::kNumEncoders; i++) {
+        pos.set_scale(i, record.scales[i]);
+        (void)encoder.set_sampling(i, record.samplings[i]);
+    }
+    from_flash = true;
+    return true;
+}
+
+void ConfigStore::changed() {
+    dirty = true;
+    changed_us = time_us_32();
+}
+
+void ConfigStore::task() {
+    if (!dirty || time_us_32() - changed_us < kSaveDelayUs) {
+        return;
+    }
+    // The benchmark times its steps, a stall would spoil them
+    if (EncoderBenchmark::instance().is_running()) {
+        return;
+    }
+    dirty = false;
+    save();
+}
+
+void ConfigStore::current(Record& record) {
+    record = Record{};
+    record.magic = kMagic;
+    record.version = kVersion;
+    record.axes = QuadratureEncoder::kNumEncoders;
+    for (size_t i = 0; i < QuadratureEncoder::kNumEncoders; i++) {
+        record.scales[i] = Position::instance().get_scale(i);
+        record.samplings[i] = QuadratureEncoder::instance().get_sampling(i);
+    }
+}
+
+void ConfigStore::save() {
+    static std::array<uint8_t, FLASH_PAGE_SIZE> page;
+    Record record;
+    current(record);
+
+    if (newest_slot >= 0) {
+        Record newest;
+        memcpy(&newest, slot_record(static_cast<size_t>(newest_slot)), sizeof(newest));
+        if (memcmp(&newest.scales, &record.scales, sizeof(record.scales)) == 0 &&
+            memcmp(&newest.samplings, &record.samplings, sizeof(record.samplings)) == 0) {
+            return;
+        }
+    }
+
+    // The next slot is blank unless it starts a sector due for erasing, or
+    // a save was cut short. Either way the write moves on to a fresh sector,
+    // which never holds the newest record.
+    size_t slot = newest_slot < 0 ? 0 : (static_cast<size_t>(newest_slot) + 1) % kSlots;
+    if (!is_blank(slot) && slot % kSlotsPerSector != 0) {
+        slot = (slot / kSlotsPerSector + 1) % kSectors * kSlotsPerSector;
+    }
+    bool erase = !is_blank(slot);
+
+    record.sequence = sequence + 1;
+    record.crc = record_crc(record);
+    page.fill(0xFF);
+    memcpy(page.data(), &record, sizeof(record));
+
+    FlashWrite write = {kFlashOffset + static_cast<uint32_t>(slot * FLASH_PAGE_SIZE), erase, page.data()};
+    if (flash_safe_execute(write_flash, &write, kFlashTimeoutMs) != PICO_OK || !is_valid(*slot_record(slot))) {
+        // Try again after the next change
+        return;
+    }
+    newest_slot = static_cast<int>(slot);
+    sequence = record.sequence;
+}
+
+uint32_t ConfigStore::settings_hash() {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < QuadratureEncoder::kNumEncoders; i++) {
+        double scale = Position::instance().get_scale(i);
+        const QuadratureEncoder::Sampling& sampling = QuadratureEncoder::instance().get_sampling(i);
+        hash = fnv1a(hash, &scale, sizeof(scale));
+        hash = fnv1a(hash, &sampling.clkdiv_int, sizeof(sampling.clkdiv_int));
+        hash = fnv1a(hash, &sampling.clkdiv_frac, sizeof(sampling.clkdiv_frac));
+        hash = fnv1a(hash, &sampling.filter_samples, sizeof(sampling.filter_samples));
+    }
+    return hash;
+}
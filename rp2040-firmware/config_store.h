@@ -0,0 +1,88 @@
+#ifndef CONFIG_STORE_H_
+#define CONFIG_STORE_H_
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+#include "hardware/flash.h"
+#include "quadrature_encoder.h"
+
+// Keeps the scales and sampling settings in flash so that they survive a
+// power cycle and the host does not have to send them again on connect.
+// Records go round robin through the pages of the last kSectors flash
+// sectors and the newest valid one is applied at boot. A sector is only
+// erased when the writes come round to it again, so each one takes an
+// erase per kSlotsPerSector saves.
+//
+// Flash is not readable while it is written, so a save stalls both cores
+// for about a millisecond, and an erase for about 50 ms more. The state
+// machines keep counting meanwhile; interrupts and samples due then come
+// late. Saves therefore wait until the settings stopped changing and skip
+// records that would not change anything.
+class ConfigStore {
+ public:
+    static constexpr size_t kSectors = 2;
+    static constexpr uint32_t kFlashOffset = PICO_FLASH_SIZE_BYTES - kSectors * FLASH_SECTOR_SIZE;
+    static constexpr size_t kSlotsPerSector = FLASH_SECTOR_SIZE / FLASH_PAGE_SIZE;
+    static constexpr size_t kSlots = kSectors * kSlotsPerSector;
+
+    // A save waits this long after the last change
+    static constexpr uint32_t kSaveDelayUs = 1000000;
+
+    static ConfigStore& instance();
+
+    // Applies the newest valid record. False when there is none, which
+    // leaves the defaults in place.
+    bool load();
+    // Called after a stored setting changed
+    void changed();
+    // Saves once the settings settled, call from the main loop
+    void task();
+
+    [[nodiscard]] bool is_from_flash() const { return from_flash; }
+    // Sequence number of the newest record, 0 before the first save
+    [[nodiscard]] uint32_t get_saves() const { return sequence; }
+
+    // FNV-1a over the settings in effect, per axis the scale as a double and
+    // the sampling as [uint16 clock divider][divider 256ths][filter samples].
+    // The host computes the same over what it would send.
+    [[nodiscard]] static uint32_t settings_hash();
+
+ private:
+    ConfigStore() = default;
+
+    static constexpr uint32_t kMagic = 0x31474643;  // "CFG1"
+    static constexpr uint16_t kVersion = 1;
+
+    struct Record {
+        uint32_t magic;
+        uint16_t version;
+        uint8_t axes;
+        uint8_t reserved;
+        uint32_t sequence;
+        uint32_t reserved2;
+        std::array<double, QuadratureEncoder::kNumEncoders> scales;
+        std::array<QuadratureEncoder::Sampling, QuadratureEncoder::kNumEncoders> samplings;
+        uint16_t crc;  // USBDevice::frame_crc() of everything before it
+    };
+    static_assert(sizeof(Record) <= FLASH_PAGE_SIZE);
+    // No padding for the CRC to cover
+    static_assert(offsetof(Record, crc) == 16 + QuadratureEncoder::kNumEncoders * (sizeof(double) + 4));
+
+    bool from_flash = false;
+    uint32_t sequence = 0;
+    int newest_slot = -1;
+
+    bool dirty = false;
+    uint32_t changed_us = 0;
+
+    [[nodiscard]] static const Record* slot_record(size_t slot);
+    [[nodiscard]] static bool is_valid(const Record& record);
+    [[nodiscard]] static bool is_blank(size_t slot);
+    [[nodiscard]] static uint16_t record_crc(const Record& record);
+    static void current(Record& record);
+    void save();
+};
+
+#endif
@@ -0,0 +1,181 @@
+#include "encoder_benchmark.h"
+
+#include <cstring>
+
+#include "hardware/clocks.h"
+#include "hardware/gpio.h"
+#include "pico/time.h"
+#include "quadrature_generator.pio.h"
+#include "usb_device.h"
+
+EncoderBenchmark& EncoderBenchmark::instance() {
+    static EncoderBenchmark benchmark;
+    if (!benchmark.initialized) {
+        benchmark.init();
+        benchmark.initialized = true;
+    }
+    return benchmark;
+}
+
+void EncoderBenchmark::init() {
+    if constexpr (!kAvailable) {
+        return;
+    }
+    program_offset = pio_add_program(pio, &quadrature_generator_program);
+    for (size_t i = 0; i < kNumGenerators; i++) {
+        generator_sms[i] = pio_claim_unused_sm(pio, true);
+    }
+}
+
+void EncoderBenchmark::start() {
+    if (!kAvailable || running) {
+        return;
+    }
+
+    // Cut the scales off so the generators are the only drivers
+    gpio_put(QuadratureEncoder::kLevelShifterEnablePin, 0);
+
+    for (size_t i = 0; i < kNumGenerators; i++) {
+        uint pin = QuadratureEncoder::kProfile[2 * i].pin;
+        quadrature_generator_program_init(pio, generator_sms[i], program_offset, pin);
+    }
+
+    // Reference loop rate with the lines parked and nothing to count
+    sleep_ms(1);
+    idle_loops_per_ms = spin(kStepDurationUs) / (kStepDurationUs / 1000);
+
+    results = {};
+    next_rate = 0;
+    done = false;
+    running = true;
+}
+
+void EncoderBenchmark::task() {
+    if (!running) {
+        return;
+    }
+
+    // One rate per call keeps USB serviced in between
+    run_rate(next_rate++);
+    if (next_rate == kNumRates) {
+        finish();
+    }
+}
+
+uint32_t EncoderBenchmark::spin(uint32_t duration_us) const {
+    uint32_t loops = 0;
+    uint32_t start = time_us_32();
+    while (time_us_32() - start < duration_us) {
+        loops++;
+    }
+    return loops;
+}
+
+void EncoderBenchmark::run_rate(size_t rate_idx) {
+    QuadratureEncoder& encoder = QuadratureEncoder::instance();
+    uint32_t clk = clock_get_hz(clk_sys);
+    uint32_t rate = kEdgeRates[rate_idx];
+
+    // Four edges per cycle, see quadrature_generator_cycle_clocks()
+    uint32_t cycle_clocks = 4 * (clk / rate);
+    uint32_t delay = cycle_clocks > quadrature_generator_cycle_clocks(0) ? (cycle_clocks - 13) / 4 : 0;
+    cycle_clocks = quadrature_generator_cycle_clocks(delay);
+    uint32_t cycles = static_cast<uint32_t>(static_cast<uint64_t>(clk) * kStepDurationUs / 1000000 / cycle_clocks);
+
+    for (size_t i = 0; i < QuadratureEncoder::kNumEncoders; i++) {
+        encoder.reset_count(i);
+    }
+
+    // Both generators get their words while stopped and start on the same
+    // clock. Started one after the other, the first can keep the CPU busy
+    // counting long enough to delay the second.
+    uint32_t mask = 0;
+    for (size_t i = 0; i < kNumGenerators; i++) {
+        pio_sm_put_blocking(pio, generator_sms[i], cycles - 1);
+        pio_sm_put_blocking(pio, generator_sms[i], delay);
+        mask |= 1u << generator_sms[i];
+    }
+    pio_enable_sm_mask_in_sync(pio, mask);
+
+    uint32_t elapsed_us = static_cast<uint32_t>(static_cast<uint64_t>(cycles) * cycle_clocks * 1000000 / clk);
+    uint32_t loops = spin(elapsed_us);
+
+    for (size_t i = 0; i < kNumGenerators; i++) {
+        (void)pio_sm_get_blocking(pio, generator_sms[i]);
+        pio_sm_set_enabled(pio, generator_sms[i], false);
+    }
+
+    // Give the slowest path a moment to report the final edge. With the
+    // encoder on core1 its loop is the only one to service it.
+    sleep_us(100);
+    if constexpr (!ENCODER_DUAL_CORE) {
+        encoder.service();
+    }
+
+    // The generated sequence 00 -> 01 -> 11 -> 10 counts down, or up on an
+    // inverted axis
+    bool ok = true;
+    for (size_t i = 0; i < QuadratureEncoder::kNumEncoders; i++) {
+        int32_t count = 0;
+        encoder.get_count(i, count);
+        int32_t expected = static_cast<int32_t>(4 * cycles);
+        ok = ok && count == (QuadratureEncoder::kProfile[i].inverted ? expected : -expected);
+    }
+
+    uint32_t expected_loops = static_cast<uint32_t>(static_cast<uint64_t>(idle_loops_per_ms) * elapsed_us / 1000);
+    uint32_t load = 0;
+    if (expected_loops > 0 && loops < expected_loops) {
+        load = static_cast<uint32_t>(static_cast<uint64_t>(expected_loops - loops) * 1000 / expected_loops);
+    }
+
+    results[rate_idx].edge_rate_hz = static_cast<uint32_t>(static_cast<uint64_t>(clk) * 4 / cycle_clocks);
+    results[rate_idx].load_permille = static_cast<uint16_t>(load);
+    results[rate_idx].counts_ok = ok;
+}
+
+void EncoderBenchmark::finish() {
+    QuadratureEncoder& encoder = QuadratureEncoder::instance();
+
+    for (size_t i = 0; i < kNumGenerators; i++) {
+        pio_sm_set_enabled(pio, generator_sms[i], false);
+        quadrature_generator_release_pins(QuadratureEncoder::kProfile[2 * i].pin);
+    }
+
+    gpio_put(QuadratureEncoder::kLevelShifterEnablePin, 1);
+
+    for (size_t i = 0; i < QuadratureEncoder::kNumEncoders; i++) {
+        encoder.reset_count(i);
+    }
+
+    running = false;
+    done = true;
+}
+
+bool EncoderBenchmark::get(uint8_t* out, size_t& bytes) const {
+    uint32_t sentinel = USBDevice::BENCHMARK_DATA_SENTINEL;
+    memcpy(out, &sentinel, sizeof(sentinel));
+    out[4] = !kAvailable ? 3 : (running ? 1 : (done ? 2 : 0));
+    out[5] = static_cast<uint8_t>(QuadratureEncoder::kBackend);
+    out[6] = kNumRates;
+    out[7] = 0;
+
+    // Highest rate up to which every step produced exact counts
+    uint32_t max_rate = 0;
+    for (const Result& result : results) {
+        if (!result.counts_ok) {
+            break;
+        }
+        max_rate = result.edge_rate_hz;
+    }
+    memcpy(out + 8, &max_rate, sizeof(max_rate));
+
+    bytes = 12;
+    for (const Result& result : results) {
+        memcpy(out + bytes, &result.edge_rate_hz, sizeof(result.edge_rate_hz));
+        memcpy(out + bytes + 4, &result.load_permille, sizeof(result.load_permille));
+        out[bytes + 6] = result.counts_ok ? 1 : 0;
+        out[bytes + 7] = 0;
+        bytes += 8;
+    }
+    return true;
+}
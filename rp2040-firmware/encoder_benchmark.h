@@ -0,0 +1,72 @@
+#ifndef ENCODER_BENCHMARK_H_
+#define ENCODER_BENCHMARK_H_
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+#include "hardware/pio.h"
+#include "quadrature_encoder.h"
+
+// On-device stress test for the counting backend. Spare pio1 state machines
+// drive known quadrature waveforms onto the encoder inputs (with the level
+// shifter disabled) at increasing edge rates. For every rate it measures how
+// much CPU the counting path takes and whether the final counts are exact.
+class EncoderBenchmark {
+ public:
+    static constexpr size_t kNumRates = 6;
+    static constexpr std::array<uint32_t, kNumRates> kEdgeRates = {50000, 100000, 250000, 500000, 1000000, 2000000};
+    static constexpr uint32_t kStepDurationUs = 100000;
+
+    // The generators need two spare pio1 state machines, which eight-encoder
+    // builds do not have, and each drives four consecutive pins, so the
+    // axis profile must wire encoders 0 and 1, and 2 and 3, next to each
+    // other. RUN_BENCHMARK is ignored otherwise.
+    static constexpr bool kAvailable = QuadratureEncoder::kNumPios < 2 && [] {
+        const auto& profile = QuadratureEncoder::kProfile;
+        for (size_t i = 0; i + 1 < profile.size(); i += 2) {
+            if (profile[i].type == AxisType::NONE || profile[i + 1].type == AxisType::NONE ||
+                profile[i + 1].pin != profile[i].pin + QuadratureEncoder::kPinsPerEncoder) {
+                return false;
+            }
+        }
+        return true;
+    }();
+
+    struct Result {
+        uint32_t edge_rate_hz;   // per axis, as actually generated
+        uint16_t load_permille;  // CPU time lost to the counting path
+        bool counts_ok;
+    };
+
+    static EncoderBenchmark& instance();
+
+    void start();
+    void task();
+    [[nodiscard]] bool is_running() const { return running; }
+
+    [[nodiscard]] bool get(uint8_t* out, size_t& bytes) const;
+
+ private:
+    EncoderBenchmark() = default;
+    bool initialized = false;
+    void init();
+
+    static constexpr size_t kNumGenerators = 2;
+
+    PIO pio = pio1;
+    uint program_offset = 0;
+    std::array<uint, kNumGenerators> generator_sms = {};
+
+    bool running = false;
+    bool done = false;
+    size_t next_rate = 0;
+    uint32_t idle_loops_per_ms = 0;
+    std::array<Result, kNumRates> results = {};
+
+    uint32_t spin(uint32_t duration_us) const;
+    void run_rate(size_t rate_idx);
+    void finish();
+};
+
+#endif
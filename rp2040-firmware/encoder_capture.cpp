@@ -0,0 +1,193 @@
+#include "encoder_capture.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "hardware/sync.h"
+#include "usb_device.h"
+
+std::array<EncoderCapture::Sample, EncoderCapture::kCapacity> EncoderCapture::samples = {};
+
+EncoderCapture& EncoderCapture::instance() {
+    static EncoderCapture capture;
+    return capture;
+}
+
+bool EncoderCapture::start(uint32_t new_rate_hz, Trigger new_trigger, uint8_t axis, int32_t new_threshold,
+                           uint32_t new_pre_samples) {
+    stop();
+    if (new_rate_hz == 0 || new_rate_hz > kMaxRateHz || axis >= QuadratureEncoder::kNumEncoders ||
+        new_trigger > Trigger::MANUAL) {
+        return false;
+    }
+
+    rate_hz = new_rate_hz;
+    period_us = 1000000 / rate_hz;
+    trigger = new_trigger;
+    trigger_axis = axis;
+    threshold = new_threshold;
+    pre_samples = trigger == Trigger::IMMEDIATE ? 0 : std::min<uint32_t>(new_pre_samples, kCapacity - 1);
+    head = 0;
+    trigger_index = 0;
+    missed = 0;
+    manual_trigger = false;
+    download_remaining = 0;
+    state = State::ARMED;
+
+    // Same core as the encoder sampling timer, away from USB when dual core
+    alarm_pool_t* pool = QuadratureEncoder::instance().get_sample_pool();
+    if (pool == nullptr) {
+        pool = alarm_pool_get_default();
+    }
+    // Negative delay means the period is measured from callback start to start
+    timer_running = alarm_pool_add_repeating_timer_us(pool, -static_cast<int64_t>(period_us), timer_callback,
+                                                      this, &timer);
+    if (!timer_running) {
+        state = State::IDLE;
+    }
+    return timer_running;
+}
+
+void EncoderCapture::stop() {
+    if (timer_running) {
+        cancel_repeating_timer(&timer);
+        timer_running = false;
+    }
+    if (state != State::DONE) {
+        state = State::IDLE;
+    }
+}
+
+bool EncoderCapture::triggered(int32_t count) {
+    if (manual_trigger) {
+        return true;
+    }
+    bool first = head == 0;
+    switch (trigger) {
+        case Trigger::IMMEDIATE:
+            return true;
+        case Trigger::RISING:
+            return !first && previous_count < threshold && count >= threshold;
+        case Trigger::FALLING:
+            return !first && previous_count > threshold && count <= threshold;
+        case Trigger::MOTION: {
+            if (first) {
+                armed_count = count;
+            }
+            int32_t moved = count - armed_count;
+            return moved >= threshold || -moved >= threshold;
+        }
+        case Trigger::MANUAL:
+            break;
+    }
+    return false;
+}
+
+void EncoderCapture::record() {
+    uint32_t index = head;
+    Sample& sample = samples[index % kCapacity];
+
+    std::array<int32_t, QuadratureEncoder::kNumEncoders> counts;
+    QuadratureEncoder::instance().get_all_counts(counts);
+    uint64_t now = time_us_64();
+    sample.time_us = static_cast<uint32_t>(now);
+    sample.counts = counts;
+
+    if (index > 0 && now - last_time_us >= period_us + period_us / 2) {
+        // The timer came late, the sample interval shows by how much
+        missed = missed + static_cast<uint32_t>((now - last_time_us) / period_us - 1);
+    }
+    last_time_us = now;
+
+    if (state == State::ARMED && triggered(counts[trigger_axis])) {
+        trigger_index = index;
+        state = State::TRIGGERED;
+    }
+    previous_count = counts[trigger_axis];
+
+    __dmb();
+    head = index + 1;
+
+    if (state == State::TRIGGERED && head - trigger_index >= kCapacity - pre_samples) {
+        state = State::DONE;
+    }
+}
+
+bool EncoderCapture::timer_callback(repeating_timer_t* rt) {
+    EncoderCapture* self = static_cast<EncoderCapture*>(rt->user_data);
+    self->record();
+    if (self->state == State::DONE) {
+        self->timer_running = false;
+        return false;
+    }
+    return true;
+}
+
+uint32_t EncoderCapture::result_first() const {
+    uint32_t taken = head;
+    uint32_t oldest = taken > kCapacity ? taken - kCapacity : 0;
+    if (state == State::ARMED || state == State::IDLE) {
+        return oldest;
+    }
+    uint32_t first = trigger_index > pre_samples ? trigger_index - pre_samples : 0;
+    return std::max(first, oldest);
+}
+
+uint32_t EncoderCapture::result_count() const {
+    return head - result_first();
+}
+
+bool EncoderCapture::get(uint8_t* out, size_t& bytes) const {
+    uint32_t sentinel = USBDevice::CAPTURE_DATA_SENTINEL;
+    memcpy(out, &sentinel, sizeof(sentinel));
+    out[4] = static_cast<uint8_t>(state);
+    out[5] = QuadratureEncoder::kNumEncoders;
+    out[6] = sizeof(Sample);
+    out[7] = static_cast<uint8_t>(trigger);
+
+    uint32_t first = result_first();
+    uint32_t count = head - first;
+    uint32_t trigger_offset = state == State::TRIGGERED || state == State::DONE ? trigger_index - first : 0;
+    uint32_t missed_samples = missed;
+
+    // Full timestamp of the first sample, rebuilt from its low word
+    uint64_t first_time = 0;
+    if (count > 0) {
+        first_time = last_time_us - static_cast<uint32_t>(static_cast<uint32_t>(last_time_us) -
+                                                          samples[first % kCapacity].time_us);
+    }
+
+    memcpy(out + 8, &rate_hz, sizeof(rate_hz));
+    memcpy(out + 12, &count, sizeof(count));
+    memcpy(out + 16, &trigger_offset, sizeof(trigger_offset));
+    memcpy(out + 20, &missed_samples, sizeof(missed_samples));
+    memcpy(out + 24, &first_time, sizeof(first_time));
+    bytes = 32;
+    return true;
+}
+
+bool EncoderCapture::start_download(uint32_t first, uint32_t count) {
+    if (state != State::DONE || first > result_count()) {
+        return false;
+    }
+    count = std::min(count, result_count() - first);
+    download_offset = first * sizeof(Sample);
+    download_remaining = count * sizeof(Sample);
+    return download_remaining > 0;
+}
+
+size_t EncoderCapture::read_download(uint8_t* out, size_t capacity) {
+    uint32_t base = result_first();
+    size_t bytes = 0;
+    while (bytes < capacity && download_remaining > 0) {
+        uint32_t index = download_offset / sizeof(Sample);
+        uint32_t within = download_offset % sizeof(Sample);
+        const auto* sample = reinterpret_cast<const uint8_t*>(&samples[(base + index) % kCapacity]);
+        size_t chunk = std::min<size_t>({capacity - bytes, sizeof(Sample) - within, download_remaining});
+        memcpy(out + bytes, sample + within, chunk);
+        bytes += chunk;
+        download_offset += chunk;
+        download_remaining -= chunk;
+    }
+    return bytes;
+}
@@ -0,0 +1,106 @@
+#ifndef ENCODER_CAPTURE_H_
+#define ENCODER_CAPTURE_H_
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+#include "pico/time.h"
+#include "quadrature_encoder.h"
+
+// Records count snapshots at up to 50 kHz into a RAM ring buffer for
+// backlash, chatter and vibration analysis. Recording runs continuously once
+// armed; the trigger fixes how much of the ring precedes it, the rest is
+// filled afterwards and the capture stops. The host then downloads the
+// samples in bulk.
+class EncoderCapture {
+ public:
+    static constexpr uint32_t kMaxRateHz = 50000;
+    static constexpr size_t kBufferBytes = 128 * 1024;
+
+    // One snapshot, as downloaded. time_us is the low word of time_us_64().
+    struct Sample {
+        uint32_t time_us;
+        std::array<int32_t, QuadratureEncoder::kNumEncoders> counts;
+    };
+    static constexpr size_t kCapacity = kBufferBytes / sizeof(Sample);
+
+    enum class Trigger : uint8_t {
+        IMMEDIATE = 0,  // the first sample
+        RISING = 1,     // the axis count reaches threshold from below
+        FALLING = 2,    // the axis count reaches threshold from above
+        MOTION = 3,     // the axis moved threshold counts from where it was armed
+        MANUAL = 4      // only VENDOR_REQUEST_TRIGGER_CAPTURE
+    };
+
+    enum class State : uint8_t {
+        IDLE = 0,
+        ARMED = 1,      // recording, waiting for the trigger
+        TRIGGERED = 2,  // recording the samples after the trigger
+        DONE = 3
+    };
+
+    static EncoderCapture& instance();
+
+    // Rate 0 stops a capture in progress. pre_samples is clamped to the
+    // buffer; a trigger before that many samples were taken gets fewer.
+    [[nodiscard]] bool start(uint32_t new_rate_hz, Trigger new_trigger, uint8_t axis, int32_t new_threshold,
+                             uint32_t new_pre_samples);
+    void stop();
+    // Any trigger mode also accepts this one
+    void trigger_now() { manual_trigger = true; }
+
+    [[nodiscard]] State get_state() const { return state; }
+
+    // Status reply: sentinel, state, axes, sample size, trigger mode, rate,
+    // number of samples, index of the trigger sample in them, the full
+    // timestamp of the first one and the samples the timer missed
+    [[nodiscard]] bool get(uint8_t* out, size_t& bytes) const;
+
+    // Bulk download of count samples starting at first, in recording order.
+    // Only once the capture is done.
+    [[nodiscard]] bool start_download(uint32_t first, uint32_t count);
+    [[nodiscard]] bool is_downloading() const { return download_remaining > 0; }
+    void cancel_download() { download_remaining = 0; }
+    // Copies the next download bytes, at most capacity
+    [[nodiscard]] size_t read_download(uint8_t* out, size_t capacity);
+
+    static bool timer_callback(repeating_timer_t* rt);
+
+ private:
+    EncoderCapture() = default;
+
+    static std::array<Sample, kCapacity> samples;
+
+    repeating_timer_t timer;
+    bool timer_running = false;
+
+    // Written by the timer callback, which may run on core1
+    volatile State state = State::IDLE;
+    volatile uint32_t head = 0;           // samples taken since armed
+    volatile uint32_t trigger_index = 0;  // absolute index of the trigger sample
+    volatile uint32_t missed = 0;
+    volatile bool manual_trigger = false;
+    uint64_t last_time_us = 0;
+
+    uint32_t rate_hz = 0;
+    uint32_t period_us = 0;
+    Trigger trigger = Trigger::IMMEDIATE;
+    uint8_t trigger_axis = 0;
+    int32_t threshold = 0;
+    int32_t armed_count = 0;
+    int32_t previous_count = 0;
+    uint32_t pre_samples = 0;
+
+    // Absolute index of the first sample in the result and how many there are
+    [[nodiscard]] uint32_t result_first() const;
+    [[nodiscard]] uint32_t result_count() const;
+
+    uint32_t download_offset = 0;  // bytes into the result
+    uint32_t download_remaining = 0;
+
+    bool triggered(int32_t count);
+    void record();
+};
+
+#endif
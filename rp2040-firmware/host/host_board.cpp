@@ -0,0 +1,180 @@
+#include "host_board.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "config_store.h"
+#include "encoder_benchmark.h"
+#include "hardware/gpio.h"
+#include "perf_counters.h"
+#include "position.h"
+#include "position_compare.h"
+#include "tusb.h"
+#include "usb_device.h"
+#include "ws2812_led.h"
+
+namespace {
+
+// Gray sequence of (B << 1) | A that the decoder counts upwards
+constexpr std::array<uint8_t, 4> kGrayUp = {0b00, 0b10, 0b11, 0b01};
+
+}  // namespace
+
+HostBoard& HostBoard::instance() {
+    static HostBoard board;
+    return board;
+}
+
+void HostBoard::boot() {
+    // Same order as main()
+    WS2812Led::instance().set_blue();
+
+    gpio_init(QuadratureEncoder::kLevelShifterEnablePin);
+    gpio_set_dir(QuadratureEncoder::kLevelShifterEnablePin, GPIO_OUT);
+    gpio_put(QuadratureEncoder::kLevelShifterEnablePin, 1);
+
+    USBDevice::instance();
+
+    Position& pos = Position::instance();
+
+    (void)ConfigStore::instance().load();
+
+    pos.enable_test_mode(false);
+
+    WS2812Led::instance().set_green();
+}
+
+void HostBoard::poll() {
+    PerfCounters::instance().loop_iteration();
+    USBDevice::instance().task();
+    QuadratureEncoder::instance().service();
+    PositionCompare::instance().task();
+    EncoderBenchmark::instance().task();
+    ConfigStore::instance().task();
+    Simulator::instance().spend(kPollCycles);
+}
+
+void HostBoard::run_us(uint64_t us) {
+    Simulator& sim = Simulator::instance();
+    uint64_t end = sim.time_us() + us;
+    while (sim.time_us() < end) {
+        poll();
+    }
+}
+
+void HostBoard::apply(size_t axis) {
+    Simulator& sim = Simulator::instance();
+    uint pin = QuadratureEncoder::kProfile[axis].pin;
+    uint8_t lines = kGrayUp[phase[axis] & 3];
+    sim.set_input(pin, lines & 1);
+    sim.set_input(pin + 1, (lines >> 1) & 1);
+}
+
+void HostBoard::step(size_t axis, int direction) {
+    phase[axis] = static_cast<uint8_t>((phase[axis] + (direction > 0 ? 1 : 3)) & 3);
+    apply(axis);
+}
+
+void HostBoard::glitch(size_t axis) {
+    phase[axis] = static_cast<uint8_t>((phase[axis] + 2) & 3);
+    apply(axis);
+}
+
+std::string HostBoard::string_descriptor(uint8_t index) const {
+    const uint16_t* desc = tud_descriptor_string_cb(index, 0x0409);
+    std::string s;
+    if (desc == nullptr) {
+        return s;
+    }
+    size_t chars = ((desc[0] & 0xFF) - 2) / 2;
+    for (size_t i = 0; i < chars; i++) {
+        s += static_cast<char>(desc[1 + i]);
+    }
+    return s;
+}
+
+void HostBoard::send(const std::vector<uint8_t>& data) {
+    Simulator::instance().usb().send(data);
+}
+
+bool HostBoard::request(const std::vector<uint8_t>& data, std::vector<uint8_t>& response, uint64_t timeout_us) {
+    Simulator& sim = Simulator::instance();
+    send(data);
+    uint64_t end = sim.time_us() + timeout_us;
+    while (sim.time_us() < end) {
+        poll();
+        if (sim.usb().receive(response)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+std::vector<uint8_t> HostBoard::make_frame(uint16_t request_id, const std::vector<uint8_t>& entries) {
+    uint16_t length = static_cast<uint16_t>(entries.size());
+    std::vector<uint8_t> frame(USBDevice::kFrameOverhead + length);
+    frame[0] = USBDevice::kFrameMagic;
+    frame[1] = USBDevice::kFrameVersion;
+    std::memcpy(&frame[4], &length, sizeof(length));
+    std::memcpy(&frame[6], &request_id, sizeof(request_id));
+    std::copy(entries.begin(), entries.end(), frame.begin() + USBDevice::kFrameHeaderSize);
+    uint16_t crc = USBDevice::frame_crc(frame.data(), USBDevice::kFrameHeaderSize + length);
+    std::memcpy(&frame[USBDevice::kFrameHeaderSize + length], &crc, sizeof(crc));
+    return frame;
+}
+
+bool HostBoard::parse_frame(const std::vector<uint8_t>& frame, Reply& reply) {
+    if (frame.size() < USBDevice::kFrameOverhead || frame[0] != USBDevice::kFrameMagic ||
+        frame[1] != USBDevice::kFrameVersion) {
+        return false;
+    }
+    uint16_t length = 0;
+    uint16_t crc = 0;
+    std::memcpy(&length, &frame[4], sizeof(length));
+    if (frame.size() != USBDevice::kFrameOverhead + length) {
+        return false;
+    }
+    std::memcpy(&crc, &frame[USBDevice::kFrameHeaderSize + length], sizeof(crc));
+    if (crc != USBDevice::frame_crc(frame.data(), USBDevice::kFrameHeaderSize + length)) {
+        return false;
+    }
+    reply.status = frame[2];
+    std::memcpy(&reply.request_id, &frame[6], sizeof(reply.request_id));
+    reply.entries.assign(frame.begin() + USBDevice::kFrameHeaderSize,
+                         frame.begin() + USBDevice::kFrameHeaderSize + length);
+    return true;
+}
+
+bool HostBoard::find_entry(const Reply& reply, uint8_t request, std::vector<uint8_t>& data) {
+    for (size_t offset = 0; offset + 2 <= reply.entries.size(); offset += 2 + reply.entries[offset + 1]) {
+        size_t length = reply.entries[offset + 1];
+        if (offset + 2 + length > reply.entries.size()) {
+            return false;
+        }
+        if (reply.entries[offset] == request) {
+            data.assign(reply.entries.begin() + offset + 2, reply.entries.begin() + offset + 2 + length);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool HostBoard::read_counts(std::array<int32_t, kNumEncoders>& counts) {
+    std::vector<uint8_t> response;
+    send({USBDevice::VENDOR_REQUEST_SET_FORMAT, static_cast<uint8_t>(Position::Format::COUNTS)});
+    if (!request({USBDevice::VENDOR_REQUEST_GET_POSITION}, response)) {
+        return false;
+    }
+
+    uint32_t sentinel = 0;
+    if (response.size() < Position::kCountsHeaderSize + Position::kCountsSampleSize) {
+        return false;
+    }
+    std::memcpy(&sentinel, response.data(), sizeof(sentinel));
+    if (sentinel != USBDevice::COUNTS_DATA_SENTINEL || response[5] != 1) {
+        return false;
+    }
+    std::memcpy(counts.data(), response.data() + Position::kCountsHeaderSize + sizeof(uint16_t),
+                sizeof(int32_t) * kNumEncoders);
+    return true;
+}
@@ -0,0 +1,66 @@
+#ifndef HOST_BOARD_H_
+#define HOST_BOARD_H_
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "quadrature_encoder.h"
+#include "simulator.h"
+
+// The firmware running on the simulator: boot() does what main() does before
+// its loop, poll() is one pass of that loop. Also drives quadrature signals
+// onto the encoder inputs and talks to the vendor interface like the host.
+class HostBoard {
+ public:
+    static constexpr size_t kNumEncoders = QuadratureEncoder::kNumEncoders;
+
+    // CPU cycles one pass of the main loop is assumed to take on top of
+    // what the SDK calls already charge
+    static constexpr uint32_t kPollCycles = 50;
+
+    static HostBoard& instance();
+
+    void boot();
+    void poll();
+    // Polls the firmware for a while
+    void run_us(uint64_t us);
+
+    // One quadrature edge on an axis, +1 or -1 as the firmware counts it
+    void step(size_t axis, int direction);
+    // Both lines of an axis at once, which the decoder treats as no motion
+    void glitch(size_t axis);
+
+    // Sends a request and polls until a response arrives or timeout_us passes
+    [[nodiscard]] bool request(const std::vector<uint8_t>& data, std::vector<uint8_t>& response,
+                               uint64_t timeout_us = 2000);
+    void send(const std::vector<uint8_t>& data);
+
+    // USB string descriptor as the host sees it, 3 is the serial number
+    [[nodiscard]] std::string string_descriptor(uint8_t index) const;
+
+    // Counts via GET_POSITION in the raw counts format
+    [[nodiscard]] bool read_counts(std::array<int32_t, kNumEncoders>& counts);
+
+    // Framed requests: entries are [request][length][arguments...]
+    struct Reply {
+        uint8_t status = 0;
+        uint16_t request_id = 0;
+        std::vector<uint8_t> entries;
+    };
+    [[nodiscard]] static std::vector<uint8_t> make_frame(uint16_t request_id, const std::vector<uint8_t>& entries);
+    // Checks magic, version and CRC of a reply frame
+    [[nodiscard]] static bool parse_frame(const std::vector<uint8_t>& frame, Reply& reply);
+    // Data of the first reply entry for request, false if there is none
+    [[nodiscard]] static bool find_entry(const Reply& reply, uint8_t request, std::vector<uint8_t>& data);
+
+ private:
+    HostBoard() = default;
+
+    std::array<uint8_t, kNumEncoders> phase{};
+    void apply(size_t axis);
+};
+
+#endif
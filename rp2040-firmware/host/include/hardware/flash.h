@@ -0,0 +1,23 @@
+#ifndef HOST_HARDWARE_FLASH_H_
+#define HOST_HARDWARE_FLASH_H_
+
+#include "pico/platform.h"
+
+#define FLASH_PAGE_SIZE (1u << 8)
+#define FLASH_SECTOR_SIZE (1u << 12)
+
+#ifndef PICO_FLASH_SIZE_BYTES
+#define PICO_FLASH_SIZE_BYTES (2 * 1024 * 1024)
+#endif
+
+// The XIP window maps the simulator flash, so firmware reads it through
+// XIP_BASE as it would on the board
+uintptr_t host_flash_base(void);
+#define XIP_BASE (host_flash_base())
+
+// Offsets from the start of flash. Like the real part, programming only
+// clears bits and erasing sets whole sectors. The stall is not modelled.
+void flash_range_erase(uint32_t flash_offs, size_t count);
+void flash_range_program(uint32_t flash_offs, const uint8_t* data, size_t count);
+
+#endif
@@ -0,0 +1,38 @@
+#ifndef HOST_HARDWARE_IRQ_H_
+#define HOST_HARDWARE_IRQ_H_
+
+#include "pico/platform.h"
+
+enum irq_num_rp2040 {
+    TIMER_IRQ_0 = 0,
+    TIMER_IRQ_1 = 1,
+    TIMER_IRQ_2 = 2,
+    TIMER_IRQ_3 = 3,
+    PWM_IRQ_WRAP = 4,
+    USBCTRL_IRQ = 5,
+    XIP_IRQ = 6,
+    PIO0_IRQ_0 = 7,
+    PIO0_IRQ_1 = 8,
+    PIO1_IRQ_0 = 9,
+    PIO1_IRQ_1 = 10,
+    DMA_IRQ_0 = 11,
+    DMA_IRQ_1 = 12,
+    IO_IRQ_BANK0 = 13,
+    IO_IRQ_QSPI = 14,
+    SIO_IRQ_PROC0 = 15,
+    SIO_IRQ_PROC1 = 16,
+    NUM_IRQS = 32
+};
+
+#define PICO_DEFAULT_IRQ_PRIORITY 0x80
+#define PICO_HIGHEST_IRQ_PRIORITY 0x00
+#define PICO_LOWEST_IRQ_PRIORITY 0xff
+
+typedef void (*irq_handler_t)(void);
+
+void irq_set_exclusive_handler(uint num, irq_handler_t handler);
+void irq_set_priority(uint num, uint8_t hardware_priority);
+void irq_set_enabled(uint num, bool enabled);
+bool irq_is_enabled(uint num);
+
+#endif
@@ -0,0 +1,6 @@
+#ifndef HOST_HARDWARE_PLL_H_
+#define HOST_HARDWARE_PLL_H_
+
+#include "pico/platform.h"
+
+#endif
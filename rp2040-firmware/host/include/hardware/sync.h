@@ -0,0 +1,27 @@
+#ifndef HOST_HARDWARE_SYNC_H_
+#define HOST_HARDWARE_SYNC_H_
+
+#include "pico/platform.h"
+
+// Everything runs on one host thread, ordering only matters to the compiler
+static inline void __compiler_memory_barrier(void) {
+    __asm__ volatile("" : : : "memory");
+}
+
+static inline void __dmb(void) {
+    __compiler_memory_barrier();
+}
+
+static inline void __dsb(void) {
+    __compiler_memory_barrier();
+}
+
+static inline void __sev(void) {}
+
+void __wfe(void);
+void __wfi(void);
+
+uint32_t save_and_disable_interrupts(void);
+void restore_interrupts(uint32_t status);
+
+#endif
@@ -0,0 +1,9 @@
+#ifndef HOST_HARDWARE_TIMER_H_
+#define HOST_HARDWARE_TIMER_H_
+
+#include "pico/platform.h"
+
+uint32_t time_us_32(void);
+uint64_t time_us_64(void);
+
+#endif
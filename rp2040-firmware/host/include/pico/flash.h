@@ -0,0 +1,14 @@
+#ifndef HOST_PICO_FLASH_H_
+#define HOST_PICO_FLASH_H_
+
+#include "pico/platform.h"
+
+#ifndef PICO_OK
+#define PICO_OK 0
+#endif
+
+// Only one core is emulated, so nothing needs locking out
+int flash_safe_execute(void (*func)(void*), void* param, uint32_t enter_exit_timeout_ms);
+bool flash_safe_execute_core_init(void);
+
+#endif
@@ -0,0 +1,16 @@
+#ifndef HOST_PICO_PLATFORM_H_
+#define HOST_PICO_PLATFORM_H_
+
+// Host stand-in for the Pico SDK, see host/README.md
+
+#include <cstddef>
+#include <cstdint>
+
+typedef unsigned int uint;
+
+#define __not_in_flash_func(func_name) func_name
+#define __time_critical_func(func_name) func_name
+
+void tight_loop_contents(void);
+
+#endif
@@ -0,0 +1,8 @@
+#ifndef HOST_PICO_STDLIB_H_
+#define HOST_PICO_STDLIB_H_
+
+#include "hardware/gpio.h"
+#include "pico/platform.h"
+#include "pico/time.h"
+
+#endif
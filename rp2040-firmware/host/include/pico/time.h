@@ -0,0 +1,43 @@
+#ifndef HOST_PICO_TIME_H_
+#define HOST_PICO_TIME_H_
+
+#include "hardware/timer.h"
+#include "pico/platform.h"
+
+typedef uint64_t absolute_time_t;
+
+typedef struct alarm_pool alarm_pool_t;
+
+struct repeating_timer;
+typedef bool (*repeating_timer_callback_t)(struct repeating_timer* rt);
+
+typedef struct repeating_timer {
+    int64_t delay_us;
+    alarm_pool_t* pool;
+    int32_t alarm_id;
+    repeating_timer_callback_t callback;
+    void* user_data;
+} repeating_timer_t;
+
+absolute_time_t get_absolute_time(void);
+uint32_t to_ms_since_boot(absolute_time_t t);
+uint64_t to_us_since_boot(absolute_time_t t);
+
+void sleep_us(uint64_t us);
+void sleep_ms(uint32_t ms);
+void busy_wait_us(uint64_t us);
+void busy_wait_us_32(uint32_t us);
+
+alarm_pool_t* alarm_pool_get_default(void);
+alarm_pool_t* alarm_pool_create(uint hardware_alarm_num, uint max_timers);
+alarm_pool_t* alarm_pool_create_with_unused_hardware_alarm(uint max_timers);
+
+bool alarm_pool_add_repeating_timer_us(alarm_pool_t* pool, int64_t delay_us, repeating_timer_callback_t callback,
+                                       void* user_data, repeating_timer_t* out);
+bool add_repeating_timer_us(int64_t delay_us, repeating_timer_callback_t callback, void* user_data,
+                            repeating_timer_t* out);
+bool add_repeating_timer_ms(int32_t delay_ms, repeating_timer_callback_t callback, void* user_data,
+                            repeating_timer_t* out);
+bool cancel_repeating_timer(repeating_timer_t* timer);
+
+#endif
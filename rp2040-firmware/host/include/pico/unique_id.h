@@ -0,0 +1,16 @@
+#ifndef HOST_PICO_UNIQUE_ID_H_
+#define HOST_PICO_UNIQUE_ID_H_
+
+#include "pico/platform.h"
+
+#define PICO_UNIQUE_BOARD_ID_SIZE_BYTES 8
+
+typedef struct {
+    uint8_t id[PICO_UNIQUE_BOARD_ID_SIZE_BYTES];
+} pico_unique_board_id_t;
+
+// Returns Simulator::board_id(), so several emulated boards can differ
+void pico_get_unique_board_id(pico_unique_board_id_t* id_out);
+void pico_get_unique_board_id_string(char* id_out, uint len);
+
+#endif
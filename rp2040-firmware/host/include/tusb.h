@@ -0,0 +1,87 @@
+#ifndef HOST_TUSB_H_
+#define HOST_TUSB_H_
+
+// Host stand-in for the parts of TinyUSB the firmware uses. The vendor
+// interface is backed by in-memory queues the host programs write to and
+// read from, see Simulator::usb().
+
+#include <cstddef>
+#include <cstdint>
+
+#define OPT_MCU_RP2040 1800
+#define OPT_OS_NONE 1
+#define OPT_MODE_DEVICE 0x0001
+#define OPT_MODE_DEFAULT_SPEED 0x0000
+
+#include "tusb_config.h"
+
+typedef struct __attribute__((packed)) {
+    uint8_t bLength;
+    uint8_t bDescriptorType;
+    uint16_t bcdUSB;
+    uint8_t bDeviceClass;
+    uint8_t bDeviceSubClass;
+    uint8_t bDeviceProtocol;
+    uint8_t bMaxPacketSize0;
+    uint16_t idVendor;
+    uint16_t idProduct;
+    uint16_t bcdDevice;
+    uint8_t iManufacturer;
+    uint8_t iProduct;
+    uint8_t iSerialNumber;
+    uint8_t bNumConfigurations;
+} tusb_desc_device_t;
+
+typedef struct __attribute__((packed)) {
+    uint8_t bmRequestType;
+    uint8_t bRequest;
+    uint16_t wValue;
+    uint16_t wIndex;
+    uint16_t wLength;
+} tusb_control_request_t;
+
+#define TUSB_DESC_DEVICE 0x01
+#define TUSB_DESC_CONFIGURATION 0x02
+#define TUSB_DESC_STRING 0x03
+#define TUSB_DESC_INTERFACE 0x04
+#define TUSB_DESC_ENDPOINT 0x05
+#define TUSB_DESC_CONFIG_ATT_REMOTE_WAKEUP 0x20
+#define TUSB_CLASS_VENDOR_SPECIFIC 0xFF
+#define TUSB_XFER_BULK 2
+
+#define TU_U16_LOW(u16) ((uint8_t)((u16) & 0x00ff))
+#define TU_U16_HIGH(u16) ((uint8_t)(((u16) >> 8) & 0x00ff))
+
+#define TUD_CONFIG_DESC_LEN (9)
+#define TUD_CONFIG_DESCRIPTOR(config_num, _itfcount, _stridx, _total_len, _attribute, _power_ma)                   \
+    9, TUSB_DESC_CONFIGURATION, TU_U16_LOW(_total_len), TU_U16_HIGH(_total_len), _itfcount, config_num, _stridx, \
+        (uint8_t)((1 << 7) | (_attribute)), (uint8_t)((_power_ma) / 2)
+
+#define TUD_VENDOR_DESC_LEN (9 + 7 + 7)
+#define TUD_VENDOR_DESCRIPTOR(_itfnum, _stridx, _epout, _epin, _epsize)                                            \
+    9, TUSB_DESC_INTERFACE, _itfnum, 0, 2, TUSB_CLASS_VENDOR_SPECIFIC, 0x00, 0x00, _stridx, 7, TUSB_DESC_ENDPOINT, \
+        _epout, TUSB_XFER_BULK, TU_U16_LOW(_epsize), TU_U16_HIGH(_epsize), 0, 7, TUSB_DESC_ENDPOINT, _epin,      \
+        TUSB_XFER_BULK, TU_U16_LOW(_epsize), TU_U16_HIGH(_epsize), 0
+
+bool tusb_init(void);
+void tud_task(void);
+bool tud_mounted(void);
+void tud_sof_cb_enable(bool en);
+
+bool tud_vendor_n_mounted(uint8_t itf);
+uint32_t tud_vendor_n_available(uint8_t itf);
+uint32_t tud_vendor_n_read(uint8_t itf, void* buffer, uint32_t bufsize);
+uint32_t tud_vendor_n_write(uint8_t itf, void const* buffer, uint32_t bufsize);
+uint32_t tud_vendor_n_write_available(uint8_t itf);
+uint32_t tud_vendor_n_write_flush(uint8_t itf);
+
+// Callbacks implemented by the firmware
+extern "C" {
+uint8_t const* tud_descriptor_device_cb(void);
+uint8_t const* tud_descriptor_configuration_cb(uint8_t index);
+uint16_t const* tud_descriptor_string_cb(uint8_t index, uint16_t langid);
+void tud_umount_cb(void);
+void tud_sof_cb(uint32_t frame_count);
+}
+
+#endif
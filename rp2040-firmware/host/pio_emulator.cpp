@@ -0,0 +1,520 @@
+#include "pio_emulator.h"
+
+namespace {
+
+constexpr uint32_t mask_bits(uint count) {
+    return count >= 32 ? 0xFFFFFFFFu : ((1u << count) - 1u);
+}
+
+constexpr uint32_t bit_reverse(uint32_t value) {
+    uint32_t result = 0;
+    for (int i = 0; i < 32; i++) {
+        result = (result << 1) | (value & 1);
+        value >>= 1;
+    }
+    return result;
+}
+
+constexpr uint bit_count_field(uint16_t instr) {
+    uint count = instr & 31;
+    return count == 0 ? 32 : count;
+}
+
+}  // namespace
+
+bool PioBlock::Fifo::push(uint32_t value) {
+    if (level >= depth) {
+        return false;
+    }
+    data[(head + level) % data.size()] = value;
+    level++;
+    return true;
+}
+
+uint32_t PioBlock::Fifo::pop() {
+    if (level == 0) {
+        return 0;
+    }
+    uint32_t value = data[head];
+    head = (head + 1) % data.size();
+    level--;
+    return value;
+}
+
+void PioBlock::reset() {
+    memory = {};
+    used_mask = 0;
+    state_machines = {};
+    enabled_mask = 0;
+    irq_flags = 0;
+    rx_stall_flags = 0;
+    irq_enable = {};
+    out_values = 0;
+    out_dirs = 0;
+}
+
+bool PioBlock::can_add(const pio_program_t* program, int& offset) const {
+    uint32_t program_mask = mask_bits(program->length);
+    if (program->origin >= 0) {
+        offset = program->origin;
+        return program->origin + program->length <= static_cast<int>(kInstructionCount) &&
+               !(used_mask & (program_mask << program->origin));
+    }
+    // Like the SDK, fill instruction memory from the top
+    for (int i = static_cast<int>(kInstructionCount) - program->length; i >= 0; i--) {
+        if (!(used_mask & (program_mask << i))) {
+            offset = i;
+            return true;
+        }
+    }
+    return false;
+}
+
+uint PioBlock::add(const pio_program_t* program) {
+    int offset = 0;
+    if (!can_add(program, offset)) {
+        return static_cast<uint>(-1);
+    }
+    for (uint i = 0; i < program->length; i++) {
+        uint16_t instr = program->instructions[i];
+        // JMP targets are relative to the program and relocated on load
+        if ((instr & 0xE000) == 0) {
+            instr = static_cast<uint16_t>(instr + offset);
+        }
+        memory[offset + i] = instr;
+    }
+    used_mask |= mask_bits(program->length) << offset;
+    return static_cast<uint>(offset);
+}
+
+void PioBlock::remove(const pio_program_t* program, uint offset) {
+    used_mask &= ~(mask_bits(program->length) << offset);
+}
+
+bool PioBlock::claim(uint sm) {
+    if (state_machines[sm].claimed) {
+        return false;
+    }
+    state_machines[sm].claimed = true;
+    return true;
+}
+
+void PioBlock::unclaim(uint sm) {
+    state_machines[sm].claimed = false;
+}
+
+void PioBlock::init(uint sm, uint initial_pc, const pio_sm_config& config) {
+    set_enabled(sm, false);
+
+    StateMachine& s = state_machines[sm];
+    s.config = config;
+    s.divisor = (static_cast<uint32_t>(config.clkdiv_int) << 8) | config.clkdiv_frac;
+    if (s.divisor < 256) {
+        s.divisor = 256;
+    }
+    s.rx.depth = config.fifo_join == PIO_FIFO_JOIN_RX ? 2 * kFifoDepth
+                 : config.fifo_join == PIO_FIFO_JOIN_TX ? 0
+                                                        : kFifoDepth;
+    s.tx.depth = config.fifo_join == PIO_FIFO_JOIN_TX ? 2 * kFifoDepth
+                 : config.fifo_join == PIO_FIFO_JOIN_RX ? 0
+                                                        : kFifoDepth;
+    clear_fifos(sm);
+    // The SDK clears the FIFO debug flags of the state machine here too
+    rx_stall_flags &= ~(1u << (PIO_FDEBUG_RXSTALL_LSB + sm));
+    restart(sm);
+    s.phase = 0;
+    s.pc = initial_pc;
+}
+
+void PioBlock::set_enabled(uint sm, bool enabled) {
+    state_machines[sm].enabled = enabled;
+    if (enabled) {
+        enabled_mask |= 1u << sm;
+    } else {
+        enabled_mask &= ~(1u << sm);
+    }
+}
+
+void PioBlock::restart(uint sm) {
+    StateMachine& s = state_machines[sm];
+    s.isr_count = 0;
+    s.osr_count = 32;
+    s.delay = 0;
+    s.has_exec = false;
+    s.irq_waiting = false;
+}
+
+void PioBlock::set_clkdiv(uint sm, uint16_t div_int, uint8_t div_frac) {
+    StateMachine& s = state_machines[sm];
+    s.config.clkdiv_int = div_int;
+    s.config.clkdiv_frac = div_frac;
+    s.divisor = (static_cast<uint32_t>(div_int) << 8) | div_frac;
+    if (s.divisor < 256) {
+        s.divisor = 256;
+    }
+}
+
+void PioBlock::exec(uint sm, uint16_t instr) {
+    StateMachine& s = state_machines[sm];
+    s.has_exec = false;
+    apply_sideset(sm, instr);
+    if (execute(sm, instr) == Result::Stalled) {
+        // Stays pending and is retried on the next clocks
+        s.has_exec = true;
+        s.exec_instr = instr;
+    }
+}
+
+void PioBlock::clear_fifos(uint sm) {
+    state_machines[sm].rx.clear();
+    state_machines[sm].tx.clear();
+}
+
+bool PioBlock::rx_full(uint sm) const {
+    const Fifo& fifo = state_machines[sm].rx;
+    return fifo.level >= fifo.depth;
+}
+
+bool PioBlock::tx_full(uint sm) const {
+    const Fifo& fifo = state_machines[sm].tx;
+    return fifo.level >= fifo.depth;
+}
+
+uint32_t PioBlock::rx_pop(uint sm) {
+    return state_machines[sm].rx.pop();
+}
+
+void PioBlock::tx_push(uint sm, uint32_t value) {
+    (void)state_machines[sm].tx.push(value);
+}
+
+void PioBlock::set_pins(uint sm, uint32_t values, uint32_t mask) {
+    (void)sm;
+    out_values = (out_values & ~mask) | (values & mask);
+}
+
+void PioBlock::set_pindirs(uint sm, uint32_t dirs, uint32_t mask) {
+    (void)sm;
+    out_dirs = (out_dirs & ~mask) | (dirs & mask);
+}
+
+void PioBlock::set_irq_source_enabled(uint irq_index, uint source, bool enabled) {
+    if (enabled) {
+        irq_enable[irq_index] |= 1u << source;
+    } else {
+        irq_enable[irq_index] &= ~(1u << source);
+    }
+}
+
+bool PioBlock::irq_line(uint irq_index) const {
+    uint32_t raw = static_cast<uint32_t>(irq_flags & 0x0F) << 8;
+    for (uint sm = 0; sm < kNumStateMachines; sm++) {
+        const StateMachine& s = state_machines[sm];
+        if (s.rx.level > 0) {
+            raw |= 1u << sm;
+        }
+        if (s.tx.level < s.tx.depth) {
+            raw |= 1u << (4 + sm);
+        }
+    }
+    return (raw & irq_enable[irq_index]) != 0;
+}
+
+void PioBlock::clock() {
+    for (uint sm = 0; sm < kNumStateMachines; sm++) {
+        if (!(enabled_mask & (1u << sm))) {
+            continue;
+        }
+        StateMachine& s = state_machines[sm];
+        s.phase += 256;
+        if (s.phase >= s.divisor) {
+            s.phase -= s.divisor;
+            step(sm);
+        }
+    }
+}
+
+void PioBlock::step(uint sm) {
+    StateMachine& s = state_machines[sm];
+    if (s.delay > 0) {
+        s.delay--;
+        return;
+    }
+
+    bool from_exec = s.has_exec;
+    uint16_t instr = from_exec ? s.exec_instr : memory[s.pc];
+    s.has_exec = false;
+
+    // Side-set takes effect even when the instruction stalls
+    apply_sideset(sm, instr);
+
+    Result result = execute(sm, instr);
+    if (result == Result::Stalled) {
+        if (from_exec) {
+            s.has_exec = true;
+        }
+        return;
+    }
+
+    s.instructions++;
+    if (result == Result::Done && !from_exec) {
+        s.pc = s.pc == s.config.wrap ? s.config.wrap_target : (s.pc + 1) % kInstructionCount;
+    }
+
+    uint delay_bits = 5 - s.config.sideset_bits;
+    s.delay = (instr >> 8) & mask_bits(delay_bits);
+}
+
+void PioBlock::apply_sideset(uint sm, uint16_t instr) {
+    const pio_sm_config& c = state_machines[sm].config;
+    if (c.sideset_bits == 0) {
+        return;
+    }
+    uint field = (instr >> 8) & 31;
+    if (c.sideset_opt && !(field & 0x10)) {
+        return;
+    }
+    uint value_bits = c.sideset_bits - (c.sideset_opt ? 1 : 0);
+    uint32_t value = (field >> (5 - c.sideset_bits)) & mask_bits(value_bits);
+    write_pins(c.sideset_base, value_bits, value, c.sideset_pindirs);
+}
+
+void PioBlock::write_pins(uint base, uint count, uint32_t value, bool dirs) {
+    for (uint i = 0; i < count; i++) {
+        uint32_t bit = 1u << ((base + i) % 32);
+        uint32_t& target = dirs ? out_dirs : out_values;
+        if ((value >> i) & 1) {
+            target |= bit;
+        } else {
+            target &= ~bit;
+        }
+    }
+}
+
+uint32_t PioBlock::input_pins(const StateMachine& s) const {
+    uint32_t pins = read_pins ? read_pins() : 0;
+    uint base = s.config.in_base % 32;
+    return base == 0 ? pins : (pins >> base) | (pins << (32 - base));
+}
+
+uint PioBlock::irq_index(uint sm, uint index) const {
+    if (index & 0x10) {
+        return (index & 0x04) | ((index + sm) & 0x03);
+    }
+    return index & 0x07;
+}
+
+PioBlock::Result PioBlock::execute(uint sm, uint16_t instr) {
+    StateMachine& s = state_machines[sm];
+    const pio_sm_config& c = s.config;
+    uint opcode = instr >> 13;
+    uint arg1 = (instr >> 5) & 7;
+    uint arg2 = instr & 31;
+
+    switch (opcode) {
+        case 0: {  // JMP
+            bool take = false;
+            switch (arg1) {
+                case 0: take = true; break;
+                case 1: take = s.x == 0; break;
+                case 2: take = s.x != 0; s.x--; break;
+                case 3: take = s.y == 0; break;
+                case 4: take = s.y != 0; s.y--; break;
+                case 5: take = s.x != s.y; break;
+                case 6: take = ((read_pins ? read_pins() : 0) >> c.jmp_pin) & 1; break;
+                case 7: take = s.osr_count < c.pull_threshold; break;
+            }
+            if (take) {
+                s.pc = arg2;
+                return Result::Jumped;
+            }
+            return Result::Done;
+        }
+
+        case 1: {  // WAIT
+            bool polarity = (instr >> 7) & 1;
+            uint source = (instr >> 5) & 3;
+            bool level = false;
+            if (source == 0) {
+                level = ((read_pins ? read_pins() : 0) >> arg2) & 1;
+            } else if (source == 1) {
+                level = input_pins(s) >> arg2 & 1;
+            } else {
+                uint flag = irq_index(sm, arg2);
+                level = irq_flag(flag);
+                if (level && polarity) {
+                    clear_irq_flag(flag);
+                    return Result::Done;
+                }
+            }
+            return level == polarity ? Result::Done : Result::Stalled;
+        }
+
+        case 2: {  // IN
+            uint count = bit_count_field(instr);
+            if (c.autopush && s.isr_count + count >= c.push_threshold && s.rx.level >= s.rx.depth) {
+                return Result::Stalled;
+            }
+            uint32_t value = 0;
+            switch (arg1) {
+                case 0: value = input_pins(s); break;
+                case 1: value = s.x; break;
+                case 2: value = s.y; break;
+                case 6: value = s.isr; break;
+                case 7: value = s.osr; break;
+                default: break;
+            }
+            value &= mask_bits(count);
+            if (count == 32) {
+                s.isr = value;
+            } else if (c.in_shift_right) {
+                s.isr = (s.isr >> count) | (value << (32 - count));
+            } else {
+                s.isr = (s.isr << count) | value;
+            }
+            s.isr_count = s.isr_count + count > 32 ? 32 : s.isr_count + count;
+            if (c.autopush && s.isr_count >= c.push_threshold) {
+                (void)s.rx.push(s.isr);
+                s.isr = 0;
+                s.isr_count = 0;
+            }
+            return Result::Done;
+        }
+
+        case 3: {  // OUT
+            uint count = bit_count_field(instr);
+            if (c.autopull && s.osr_count >= c.pull_threshold) {
+                if (s.tx.level == 0) {
+                    return Result::Stalled;
+                }
+                s.osr = s.tx.pop();
+                s.osr_count = 0;
+            }
+            uint32_t value;
+            if (count == 32) {
+                value = s.osr;
+                s.osr = 0;
+            } else if (c.out_shift_right) {
+                value = s.osr & mask_bits(count);
+                s.osr >>= count;
+            } else {
+                value = s.osr >> (32 - count);
+                s.osr <<= count;
+            }
+            s.osr_count = s.osr_count + count > 32 ? 32 : s.osr_count + count;
+            switch (arg1) {
+                case 0: write_pins(c.out_base, c.out_count < count ? c.out_count : count, value, false); break;
+                case 1: s.x = value; break;
+                case 2: s.y = value; break;
+                case 4: write_pins(c.out_base, c.out_count < count ? c.out_count : count, value, true); break;
+                case 5: s.pc = value & 31; return Result::Jumped;
+                case 6: s.isr = value; s.isr_count = count; break;
+                case 7: s.has_exec = true; s.exec_instr = static_cast<uint16_t>(value); break;
+                default: break;
+            }
+            return Result::Done;
+        }
+
+        case 4: {
+            bool conditional = (instr >> 6) & 1;
+            bool block = (instr >> 5) & 1;
+            if (instr & 0x80) {  // PULL
+                if (conditional && s.osr_count < c.pull_threshold) {
+                    return Result::Done;
+                }
+                if (s.tx.level == 0) {
+                    if (block) {
+                        return Result::Stalled;
+                    }
+                    s.osr = s.x;
+                } else {
+                    s.osr = s.tx.pop();
+                }
+                s.osr_count = 0;
+            } else {  // PUSH
+                if (conditional && s.isr_count < c.push_threshold) {
+                    return Result::Done;
+                }
+                if (s.rx.level >= s.rx.depth) {
+                    if (block) {
+                        return Result::Stalled;
+                    }
+                    // Non-blocking push into a full FIFO loses the value
+                    s.rx_overflows++;
+                    rx_stall_flags |= 1u << (PIO_FDEBUG_RXSTALL_LSB + sm);
+                } else {
+                    (void)s.rx.push(s.isr);
+                }
+                s.isr = 0;
+                s.isr_count = 0;
+            }
+            return Result::Done;
+        }
+
+        case 5: {  // MOV
+            uint32_t value = 0;
+            switch (instr & 7) {
+                case 0: value = input_pins(s); break;
+                case 1: value = s.x; break;
+                case 2: value = s.y; break;
+                case 3: value = 0; break;
+                case 5: value = 0; break;  // STATUS_SEL default never matches
+                case 6: value = s.isr; break;
+                case 7: value = s.osr; break;
+                default: break;
+            }
+            uint operation = (instr >> 3) & 3;
+            if (operation == 1) {
+                value = ~value;
+            } else if (operation == 2) {
+                value = bit_reverse(value);
+            }
+            switch (arg1) {
+                case 0: write_pins(c.out_base, c.out_count, value, false); break;
+                case 1: s.x = value; break;
+                case 2: s.y = value; break;
+                case 4: s.has_exec = true; s.exec_instr = static_cast<uint16_t>(value); break;
+                case 5: s.pc = value & 31; return Result::Jumped;
+                case 6: s.isr = value; s.isr_count = 0; break;
+                case 7: s.osr = value; s.osr_count = 0; break;
+                default: break;
+            }
+            return Result::Done;
+        }
+
+        case 6: {  // IRQ
+            uint flag = irq_index(sm, arg2);
+            bool clear = (instr >> 6) & 1;
+            bool wait = (instr >> 5) & 1;
+            if (clear) {
+                clear_irq_flag(flag);
+                return Result::Done;
+            }
+            if (s.irq_waiting) {
+                if (irq_flag(flag)) {
+                    return Result::Stalled;
+                }
+                s.irq_waiting = false;
+                return Result::Done;
+            }
+            irq_flags |= 1u << flag;
+            if (wait) {
+                s.irq_waiting = true;
+                return Result::Stalled;
+            }
+            return Result::Done;
+        }
+
+        case 7: {  // SET
+            switch (arg1) {
+                case 0: write_pins(c.set_base, c.set_count, arg2, false); break;
+                case 1: s.x = arg2; break;
+                case 2: s.y = arg2; break;
+                case 4: write_pins(c.set_base, c.set_count, arg2, true); break;
+                default: break;
+            }
+            return Result::Done;
+        }
+    }
+    return Result::Done;
+}
@@ -0,0 +1,147 @@
+#ifndef PIO_EMULATOR_H_
+#define PIO_EMULATOR_H_
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+#include "hardware/pio.h"
+
+// One PIO block: 32 instruction slots and four state machines executing the
+// assembled programs instruction by instruction. Timing follows the RP2040
+// datasheet: one instruction per (divided) clock, delay cycles after an
+// instruction completes, stalls on blocking FIFO access and WAIT.
+class PioBlock {
+ public:
+    static constexpr size_t kNumStateMachines = NUM_PIO_STATE_MACHINES;
+    static constexpr size_t kInstructionCount = PIO_INSTRUCTION_COUNT;
+    static constexpr size_t kFifoDepth = 4;
+
+    // Reads the pad levels of all GPIOs, bit n is GPIOn
+    using PinReader = uint32_t (*)();
+
+    explicit PioBlock(uint index) : index(index) {}
+
+    void reset();
+    void set_pin_reader(PinReader reader) { read_pins = reader; }
+
+    // Instruction memory
+    [[nodiscard]] bool can_add(const pio_program_t* program, int& offset) const;
+    uint add(const pio_program_t* program);
+    void remove(const pio_program_t* program, uint offset);
+
+    // State machines
+    bool claim(uint sm);
+    void unclaim(uint sm);
+    [[nodiscard]] bool is_claimed(uint sm) const { return state_machines[sm].claimed; }
+    void init(uint sm, uint initial_pc, const pio_sm_config& config);
+    void set_enabled(uint sm, bool enabled);
+    void restart(uint sm);
+    void set_clkdiv(uint sm, uint16_t div_int, uint8_t div_frac);
+    void exec(uint sm, uint16_t instr);
+    [[nodiscard]] uint get_pc(uint sm) const { return state_machines[sm].pc; }
+
+    // FIFOs as seen from the system side
+    void clear_fifos(uint sm);
+    [[nodiscard]] uint rx_level(uint sm) const { return state_machines[sm].rx.level; }
+    [[nodiscard]] uint tx_level(uint sm) const { return state_machines[sm].tx.level; }
+    [[nodiscard]] bool rx_full(uint sm) const;
+    [[nodiscard]] bool tx_full(uint sm) const;
+    uint32_t rx_pop(uint sm);
+    void tx_push(uint sm, uint32_t value);
+
+    // Pads driven by this block
+    void set_pins(uint sm, uint32_t values, uint32_t mask);
+    void set_pindirs(uint sm, uint32_t dirs, uint32_t mask);
+    [[nodiscard]] uint32_t pin_values() const { return out_values; }
+    [[nodiscard]] uint32_t pin_dirs() const { return out_dirs; }
+
+    // Interrupts
+    void set_irq_source_enabled(uint irq_index, uint source, bool enabled);
+    [[nodiscard]] bool irq_line(uint irq_index) const;
+    [[nodiscard]] bool irq_flag(uint flag) const { return (irq_flags >> flag) & 1; }
+    void clear_irq_flag(uint flag) { irq_flags &= ~(1u << flag); }
+    [[nodiscard]] uint32_t irq_flags_value() const { return irq_flags; }
+    void clear_irq_flags(uint32_t mask) { irq_flags &= ~mask; }
+
+    // FDEBUG, of which only RXSTALL: bit n is set by a push that found the
+    // RX FIFO of state machine n full, writing 1 clears it
+    [[nodiscard]] uint32_t fdebug() const { return rx_stall_flags; }
+    void clear_fdebug(uint32_t mask) { rx_stall_flags &= ~mask; }
+
+    // Pushes that found the RX FIFO full and were lost (FDEBUG.RXSTALL)
+    [[nodiscard]] uint64_t rx_overflows(uint sm) const { return state_machines[sm].rx_overflows; }
+    // Instructions executed, stalls and delay cycles excluded
+    [[nodiscard]] uint64_t instructions(uint sm) const { return state_machines[sm].instructions; }
+    [[nodiscard]] bool any_enabled() const { return enabled_mask != 0; }
+
+    // Advances every enabled state machine by one system clock
+    void clock();
+
+ private:
+    struct Fifo {
+        std::array<uint32_t, 2 * kFifoDepth> data{};
+        uint head = 0;
+        uint level = 0;
+        uint depth = kFifoDepth;
+
+        bool push(uint32_t value);
+        uint32_t pop();
+        void clear() { head = level = 0; }
+    };
+
+    struct StateMachine {
+        bool claimed = false;
+        bool enabled = false;
+        pio_sm_config config{};
+        uint32_t divisor = 256;  // 8.8 fixed point
+        uint32_t phase = 0;
+
+        uint pc = 0;
+        uint32_t x = 0;
+        uint32_t y = 0;
+        uint32_t isr = 0;
+        uint32_t osr = 0;
+        uint isr_count = 0;
+        uint osr_count = 32;
+        uint delay = 0;
+        bool has_exec = false;
+        uint16_t exec_instr = 0;
+        bool irq_waiting = false;
+
+        Fifo rx;
+        Fifo tx;
+
+        uint64_t rx_overflows = 0;
+        uint64_t instructions = 0;
+    };
+
+    enum class Result {
+        Done,
+        Jumped,
+        Stalled
+    };
+
+    uint index;
+    PinReader read_pins = nullptr;
+
+    std::array<uint16_t, kInstructionCount> memory{};
+    uint32_t used_mask = 0;
+    std::array<StateMachine, kNumStateMachines> state_machines{};
+    uint8_t enabled_mask = 0;
+    uint8_t irq_flags = 0;
+    uint32_t rx_stall_flags = 0;
+    std::array<uint32_t, 2> irq_enable{};
+
+    uint32_t out_values = 0;
+    uint32_t out_dirs = 0;
+
+    void step(uint sm);
+    Result execute(uint sm, uint16_t instr);
+    void apply_sideset(uint sm, uint16_t instr);
+    void write_pins(uint base, uint count, uint32_t value, bool dirs);
+    uint32_t input_pins(const StateMachine& s) const;
+    uint irq_index(uint sm, uint index) const;
+};
+
+#endif
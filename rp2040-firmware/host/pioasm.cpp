@@ -0,0 +1,481 @@
+// Minimal PIO assembler for the host build. It understands the subset of
+// pioasm syntax used by the programs in this repository and writes a header
+// shaped like the one pico_generate_pio_header() produces, including the
+// verbatim "% c-sdk" blocks.
+
+#include <cctype>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace {
+
+struct Instruction {
+    int line;
+    std::string text;
+    std::string side;
+    std::string delay;
+};
+
+struct Program {
+    std::string name;
+    int origin = -1;
+    int sideset_bits = 0;
+    bool sideset_opt = false;
+    bool sideset_pindirs = false;
+    int wrap_target = 0;
+    int wrap = -1;
+    std::map<std::string, int> labels;
+    std::vector<std::string> public_labels;
+    std::map<std::string, int> defines;
+    std::vector<std::string> public_defines;
+    std::vector<Instruction> instructions;
+    std::string c_sdk;
+};
+
+[[noreturn]] void fail(int line, const std::string& message) {
+    std::cerr << "pioasm: line " << line << ": " << message << "\n";
+    std::exit(1);
+}
+
+std::string trim(const std::string& s) {
+    size_t begin = s.find_first_not_of(" \t\r");
+    if (begin == std::string::npos) {
+        return "";
+    }
+    size_t end = s.find_last_not_of(" \t\r");
+    return s.substr(begin, end - begin + 1);
+}
+
+std::string strip_comment(const std::string& s) {
+    size_t pos = s.find(';');
+    size_t slashes = s.find("//");
+    if (slashes < pos) {
+        pos = slashes;
+    }
+    return pos == std::string::npos ? s : s.substr(0, pos);
+}
+
+std::vector<std::string> split(const std::string& s) {
+    std::vector<std::string> words;
+    std::string word;
+    for (char c : s) {
+        if (c == ' ' || c == '\t' || c == ',') {
+            if (!word.empty()) {
+                words.push_back(word);
+                word.clear();
+            }
+        } else {
+            word += c;
+        }
+    }
+    if (!word.empty()) {
+        words.push_back(word);
+    }
+    return words;
+}
+
+// Integer expressions with +, -, defines and labels
+int evaluate(const std::string& expr, const Program& program, int line) {
+    std::string s;
+    for (char c : expr) {
+        if (c != ' ' && c != '\t' && c != '(' && c != ')') {
+            s += c;
+        }
+    }
+    if (s.empty()) {
+        fail(line, "empty expression");
+    }
+
+    int result = 0;
+    int sign = 1;
+    size_t i = 0;
+    while (i < s.size()) {
+        if (s[i] == '+') {
+            sign = 1;
+            i++;
+            continue;
+        }
+        if (s[i] == '-') {
+            sign = -1;
+            i++;
+            continue;
+        }
+        size_t j = i;
+        while (j < s.size() && s[j] != '+' && s[j] != '-') {
+            j++;
+        }
+        std::string term = s.substr(i, j - i);
+        int value;
+        if (term.rfind("0b", 0) == 0) {
+            value = static_cast<int>(std::strtol(term.c_str() + 2, nullptr, 2));
+        } else if (std::isdigit(static_cast<unsigned char>(term[0]))) {
+            value = static_cast<int>(std::strtol(term.c_str(), nullptr, 0));
+        } else if (program.defines.count(term)) {
+            value = program.defines.at(term);
+        } else if (program.labels.count(term)) {
+            value = program.labels.at(term);
+        } else {
+            fail(line, "unknown symbol '" + term + "'");
+        }
+        result += sign * value;
+        sign = 1;
+        i = j;
+    }
+    return result;
+}
+
+int source_code(const std::string& s, bool for_mov, int line) {
+    if (s == "pins") return 0;
+    if (s == "x") return 1;
+    if (s == "y") return 2;
+    if (s == "null") return 3;
+    if (s == "status" && for_mov) return 5;
+    if (s == "isr") return 6;
+    if (s == "osr") return 7;
+    fail(line, "bad source '" + s + "'");
+}
+
+int destination_code(const std::string& s, int opcode, int line) {
+    if (s == "pins") return 0;
+    if (s == "x") return 1;
+    if (s == "y") return 2;
+    if (opcode == 3 && s == "null") return 3;
+    if ((opcode == 3 || opcode == 7) && s == "pindirs") return 4;
+    if (opcode == 5 && s == "exec") return 4;
+    if ((opcode == 3 || opcode == 5) && s == "pc") return 5;
+    if ((opcode == 3 || opcode == 5) && s == "isr") return 6;
+    if (opcode == 3 && s == "exec") return 7;
+    if (opcode == 5 && s == "osr") return 7;
+    fail(line, "bad destination '" + s + "'");
+}
+
+int bit_count(const std::string& s, const Program& program, int line) {
+    int n = evaluate(s, program, line);
+    if (n < 1 || n > 32) {
+        fail(line, "bit count out of range");
+    }
+    return n & 31;
+}
+
+uint16_t encode(const Instruction& instr, const Program& program) {
+    std::vector<std::string> w = split(instr.text);
+    const std::string& op = w[0];
+    int line = instr.line;
+    uint16_t code = 0;
+
+    if (op == "nop") {
+        code = 0xA000 | (2 << 5) | 2;  // mov y, y
+    } else if (op == "jmp") {
+        static const std::map<std::string, int> conditions = {
+            {"!x", 1}, {"x--", 2}, {"!y", 3}, {"y--", 4}, {"x!=y", 5}, {"pin", 6}, {"!osre", 7}};
+        int condition = 0;
+        std::string target;
+        if (w.size() == 3) {
+            if (!conditions.count(w[1])) {
+                fail(line, "bad jmp condition '" + w[1] + "'");
+            }
+            condition = conditions.at(w[1]);
+            target = w[2];
+        } else if (w.size() == 2) {
+            target = w[1];
+        } else {
+            fail(line, "bad jmp");
+        }
+        code = static_cast<uint16_t>((condition << 5) | (evaluate(target, program, line) & 31));
+    } else if (op == "wait") {
+        if (w.size() < 4) {
+            fail(line, "bad wait");
+        }
+        int polarity = evaluate(w[1], program, line) & 1;
+        static const std::map<std::string, int> sources = {{"gpio", 0}, {"pin", 1}, {"irq", 2}};
+        if (!sources.count(w[2])) {
+            fail(line, "bad wait source");
+        }
+        int index = evaluate(w[3], program, line);
+        if (w.size() > 4 && w[4] == "rel") {
+            index |= 0x10;
+        }
+        code = static_cast<uint16_t>(0x2000 | (polarity << 7) | (sources.at(w[2]) << 5) | (index & 31));
+    } else if (op == "in") {
+        code = static_cast<uint16_t>(0x4000 | (source_code(w.at(1), false, line) << 5) |
+                                     bit_count(w.at(2), program, line));
+    } else if (op == "out") {
+        code = static_cast<uint16_t>(0x6000 | (destination_code(w.at(1), 3, line) << 5) |
+                                     bit_count(w.at(2), program, line));
+    } else if (op == "push" || op == "pull") {
+        bool conditional = false;
+        bool block = true;
+        for (size_t i = 1; i < w.size(); i++) {
+            if (w[i] == "iffull" || w[i] == "ifempty") {
+                conditional = true;
+            } else if (w[i] == "noblock") {
+                block = false;
+            } else if (w[i] != "block") {
+                fail(line, "bad " + op + " argument '" + w[i] + "'");
+            }
+        }
+        code = static_cast<uint16_t>(0x8000 | (op == "pull" ? 0x80 : 0) | (conditional ? 0x40 : 0) |
+                                     (block ? 0x20 : 0));
+    } else if (op == "mov") {
+        if (w.size() != 3) {
+            fail(line, "bad mov");
+        }
+        std::string src = w[2];
+        int operation = 0;
+        if (src[0] == '~' || src[0] == '!') {
+            operation = 1;
+            src = src.substr(1);
+        } else if (src.rfind("::", 0) == 0) {
+            operation = 2;
+            src = src.substr(2);
+        }
+        code = static_cast<uint16_t>(0xA000 | (destination_code(w[1], 5, line) << 5) | (operation << 3) |
+                                     source_code(src, true, line));
+    } else if (op == "irq") {
+        bool clear = false;
+        bool wait = false;
+        size_t i = 1;
+        if (i < w.size() && (w[i] == "set" || w[i] == "nowait" || w[i] == "wait" || w[i] == "clear")) {
+            clear = w[i] == "clear";
+            wait = w[i] == "wait";
+            i++;
+        }
+        int index = evaluate(w.at(i), program, line);
+        if (i + 1 < w.size() && w[i + 1] == "rel") {
+            index |= 0x10;
+        }
+        code = static_cast<uint16_t>(0xC000 | (clear ? 0x40 : 0) | (wait ? 0x20 : 0) | (index & 31));
+    } else if (op == "set") {
+        int value = evaluate(w.at(2), program, line);
+        if (value < 0 || value > 31) {
+            fail(line, "set value out of range");
+        }
+        code = static_cast<uint16_t>(0xE000 | (destination_code(w.at(1), 7, line) << 5) | value);
+    } else {
+        fail(line, "unknown instruction '" + op + "'");
+    }
+
+    // Delay/side-set field: side-set bits (including the enable bit) on top
+    int delay_bits = 5 - program.sideset_bits;
+    int delay = instr.delay.empty() ? 0 : evaluate(instr.delay, program, line);
+    if (delay < 0 || delay >= (1 << delay_bits)) {
+        fail(line, "delay out of range");
+    }
+    int field = delay;
+    if (!instr.side.empty()) {
+        int side = evaluate(instr.side, program, line);
+        int value_bits = program.sideset_bits - (program.sideset_opt ? 1 : 0);
+        field |= (side & ((1 << value_bits) - 1)) << delay_bits;
+        if (program.sideset_opt) {
+            field |= 1 << 4;
+        }
+    } else if (program.sideset_bits > 0 && !program.sideset_opt) {
+        fail(line, "side-set required");
+    }
+    return static_cast<uint16_t>(code | (field << 8));
+}
+
+std::vector<Program> parse(std::istream& in) {
+    std::vector<Program> programs;
+    std::string raw;
+    int line = 0;
+    bool in_block = false;
+    bool c_sdk = false;
+
+    while (std::getline(in, raw)) {
+        line++;
+        if (in_block) {
+            if (trim(raw) == "%}") {
+                in_block = false;
+            } else if (c_sdk) {
+                programs.back().c_sdk += raw + "\n";
+            }
+            continue;
+        }
+
+        std::string text = trim(raw);
+        if (text.rfind("%", 0) == 0) {
+            in_block = true;
+            c_sdk = text.find("c-sdk") != std::string::npos;
+            if (c_sdk && programs.empty()) {
+                fail(line, "c-sdk block outside a program");
+            }
+            continue;
+        }
+
+        text = trim(strip_comment(raw));
+        if (text.empty()) {
+            continue;
+        }
+
+        if (text[0] == '.') {
+            std::vector<std::string> w = split(text);
+            if (w[0] == ".program") {
+                programs.emplace_back();
+                programs.back().name = w.at(1);
+                continue;
+            }
+            if (programs.empty()) {
+                fail(line, "directive outside a program");
+            }
+            Program& program = programs.back();
+            int pc = static_cast<int>(program.instructions.size());
+            if (w[0] == ".origin") {
+                program.origin = evaluate(w.at(1), program, line);
+            } else if (w[0] == ".side_set") {
+                program.sideset_bits = evaluate(w.at(1), program, line);
+                for (size_t i = 2; i < w.size(); i++) {
+                    program.sideset_opt |= w[i] == "opt";
+                    program.sideset_pindirs |= w[i] == "pindirs";
+                }
+                if (program.sideset_opt) {
+                    program.sideset_bits++;
+                }
+            } else if (w[0] == ".wrap_target") {
+                program.wrap_target = pc;
+            } else if (w[0] == ".wrap") {
+                program.wrap = pc - 1;
+            } else if (w[0] == ".define") {
+                bool is_public = w.at(1) == "public";
+                size_t i = is_public ? 2 : 1;
+                std::string value;
+                for (size_t j = i + 1; j < w.size(); j++) {
+                    value += w[j];
+                }
+                program.defines[w.at(i)] = evaluate(value, program, line);
+                if (is_public) {
+                    program.public_defines.push_back(w[i]);
+                }
+            } else if (w[0] != ".lang_opt") {
+                fail(line, "unsupported directive '" + w[0] + "'");
+            }
+            continue;
+        }
+
+        if (programs.empty()) {
+            fail(line, "instruction outside a program");
+        }
+        Program& program = programs.back();
+
+        size_t colon = text.find(':');
+        if (colon != std::string::npos && text.find("::") != colon) {
+            std::vector<std::string> w = split(text.substr(0, colon));
+            std::string label = w.back();
+            program.labels[label] = static_cast<int>(program.instructions.size());
+            if (w.size() > 1 && w[0] == "public") {
+                program.public_labels.push_back(label);
+            }
+            text = trim(text.substr(colon + 1));
+            if (text.empty()) {
+                continue;
+            }
+        }
+
+        Instruction instr{line, text, "", ""};
+        size_t bracket = instr.text.find('[');
+        if (bracket != std::string::npos) {
+            size_t close = instr.text.find(']', bracket);
+            if (close == std::string::npos) {
+                fail(line, "unterminated delay");
+            }
+            instr.delay = instr.text.substr(bracket + 1, close - bracket - 1);
+            instr.text = trim(instr.text.substr(0, bracket));
+        }
+        size_t side = instr.text.find(" side ");
+        if (side != std::string::npos) {
+            instr.side = trim(instr.text.substr(side + 6));
+            instr.text = trim(instr.text.substr(0, side));
+        }
+        program.instructions.push_back(instr);
+    }
+    return programs;
+}
+
+void emit(std::ostream& out, const Program& program) {
+    const std::string& n = program.name;
+    int length = static_cast<int>(program.instructions.size());
+    int wrap = program.wrap < 0 ? length - 1 : program.wrap;
+
+    out << "// " << std::string(n.size(), '-') << " //\n";
+    out << "// " << n << " //\n";
+    out << "// " << std::string(n.size(), '-') << " //\n\n";
+    out << "#define " << n << "_wrap_target " << program.wrap_target << "\n";
+    out << "#define " << n << "_wrap " << wrap << "\n";
+    for (const std::string& label : program.public_labels) {
+        out << "#define " << n << "_offset_" << label << " " << program.labels.at(label) << "u\n";
+    }
+    for (const std::string& define : program.public_defines) {
+        out << "#define " << n << "_" << define << " " << program.defines.at(define) << "\n";
+    }
+    out << "\nstatic const uint16_t " << n << "_program_instructions[] = {\n";
+    for (int i = 0; i < length; i++) {
+        char word[16];
+        std::snprintf(word, sizeof(word), "0x%04x", encode(program.instructions[i], program));
+        if (i == program.wrap_target) {
+            out << "            //     .wrap_target\n";
+        }
+        out << "    " << word << ", //  " << i << ": " << program.instructions[i].text << "\n";
+        if (i == wrap) {
+            out << "            //     .wrap\n";
+        }
+    }
+    out << "};\n\n";
+    out << "#if !PICO_NO_HARDWARE\n";
+    out << "static const struct pio_program " << n << "_program = {\n";
+    out << "    .instructions = " << n << "_program_instructions,\n";
+    out << "    .length = " << length << ",\n";
+    out << "    .origin = " << program.origin << ",\n";
+    out << "};\n\n";
+    out << "static inline pio_sm_config " << n << "_program_get_default_config(uint offset) {\n";
+    out << "    pio_sm_config c = pio_get_default_sm_config();\n";
+    out << "    sm_config_set_wrap(&c, offset + " << n << "_wrap_target, offset + " << n << "_wrap);\n";
+    if (program.sideset_bits > 0) {
+        out << "    sm_config_set_sideset(&c, " << program.sideset_bits << ", "
+            << (program.sideset_opt ? "true" : "false") << ", " << (program.sideset_pindirs ? "true" : "false")
+            << ");\n";
+    }
+    out << "    return c;\n";
+    out << "}\n";
+    if (!program.c_sdk.empty()) {
+        out << "\n" << program.c_sdk;
+    }
+    out << "#endif\n\n";
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    if (argc != 3) {
+        std::cerr << "usage: pioasm <input.pio> <output.pio.h>\n";
+        return 1;
+    }
+
+    std::ifstream in(argv[1]);
+    if (!in) {
+        std::cerr << "pioasm: cannot open " << argv[1] << "\n";
+        return 1;
+    }
+
+    std::vector<Program> programs = parse(in);
+
+    std::ostringstream out;
+    out << "// ------------------------------------------------- //\n";
+    out << "// This file is autogenerated by host pioasm; do not edit! //\n";
+    out << "// ------------------------------------------------- //\n\n";
+    out << "#pragma once\n\n";
+    out << "#if !PICO_NO_HARDWARE\n#include \"hardware/pio.h\"\n#endif\n\n";
+    for (const Program& program : programs) {
+        emit(out, program);
+    }
+
+    std::ofstream file(argv[2]);
+    file << out.str();
+    return file ? 0 : 1;
+}
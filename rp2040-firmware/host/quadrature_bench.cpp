@@ -0,0 +1,215 @@
+// Finds the highest edge rate the counting path handles without losing
+// counts, with the firmware running on the emulated RP2040. All axes move at
+// once, their edges staggered evenly over each period.
+//
+// usage: quadrature_bench [--device-benchmark]
+//
+// --device-benchmark also runs the on-device benchmark (RUN_BENCHMARK) on the
+// emulator through the vendor interface and prints its result.
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "encoder_benchmark.h"
+#include "host_board.h"
+#include "position.h"
+#include "quadrature_encoder.h"
+#include "usb_device.h"
+
+namespace {
+
+constexpr uint32_t kEdgesPerAxis = 20000;
+constexpr std::array<uint32_t, 16> kCyclesPerEdge = {2000, 1000, 500, 250, 200, 160, 125, 100, 80, 64, 50, 40, 32, 24, 20, 16};
+
+struct Run {
+    uint32_t cycles_per_edge;
+    bool exact;
+    int32_t worst_error;   // final count error over all axes
+    int32_t max_lag;       // largest difference between true and reported counts while moving
+    uint32_t rx_overflows;
+    uint64_t irqs;
+    double load;           // share of the CPU spent in interrupt handlers
+    double host_mcycles_per_s;
+};
+
+uint64_t rx_overflows() {
+    uint64_t total = 0;
+    for (uint block = 0; block < QuadratureEncoder::kNumPios; block++) {
+        for (uint sm = 0; sm < NUM_PIO_STATE_MACHINES; sm++) {
+            total += Simulator::instance().pio(block).rx_overflows(sm);
+        }
+    }
+    return total;
+}
+
+// Steps one axis every cycles_per_edge cycles until it has made
+// kEdgesPerAxis edges, independent of what the firmware is doing
+void schedule_edges(HostBoard& board, size_t axis, int direction, uint64_t first, uint32_t cycles_per_edge,
+                    std::array<int32_t, HostBoard::kNumEncoders>& expected, uint32_t remaining) {
+    Simulator::instance().schedule(first, [&board, &expected, axis, direction, first, cycles_per_edge, remaining]() {
+        board.step(axis, direction);
+        expected[axis] += direction;
+        if (remaining > 1) {
+            schedule_edges(board, axis, direction, first + cycles_per_edge, cycles_per_edge, expected, remaining - 1);
+        }
+    });
+}
+
+Run measure(HostBoard& board, uint32_t cycles_per_edge) {
+    Simulator& sim = Simulator::instance();
+    QuadratureEncoder& encoder = QuadratureEncoder::instance();
+
+    for (size_t axis = 0; axis < HostBoard::kNumEncoders; axis++) {
+        encoder.reset_count(axis);
+    }
+    board.run_us(50);
+
+    uint64_t overflows_before = rx_overflows();
+    uint64_t irq_cycles_before = sim.irq_cycles();
+    uint64_t irqs_before = sim.irq_count();
+    uint64_t start = sim.cycles();
+    auto host_start = std::chrono::steady_clock::now();
+
+    std::array<int32_t, HostBoard::kNumEncoders> expected{};
+    std::array<int32_t, HostBoard::kNumEncoders> counts{};
+    for (size_t axis = 0; axis < HostBoard::kNumEncoders; axis++) {
+        // Axes alternate direction so both halves of the jump table run
+        int direction = (axis & 1) ? -1 : 1;
+        uint64_t first = start + cycles_per_edge + axis * cycles_per_edge / HostBoard::kNumEncoders;
+        schedule_edges(board, axis, direction, first, cycles_per_edge, expected, kEdgesPerAxis);
+    }
+
+    int32_t max_lag = 0;
+    for (uint32_t n = 0; sim.events_pending(); n++) {
+        board.poll();
+        if ((n & 15) == 15) {
+            encoder.get_all_counts(counts);
+            for (size_t axis = 0; axis < HostBoard::kNumEncoders; axis++) {
+                max_lag = std::max(max_lag, std::abs(expected[axis] - counts[axis]));
+            }
+        }
+    }
+
+    uint64_t elapsed = sim.cycles() - start;
+    double host_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - host_start).count();
+
+    Run run{};
+    run.cycles_per_edge = cycles_per_edge;
+    run.rx_overflows = static_cast<uint32_t>(rx_overflows() - overflows_before);
+    run.irqs = sim.irq_count() - irqs_before;
+    run.load = static_cast<double>(sim.irq_cycles() - irq_cycles_before) / static_cast<double>(elapsed);
+    run.host_mcycles_per_s = static_cast<double>(elapsed) / host_seconds / 1e6;
+    run.max_lag = max_lag;
+
+    // Let everything settle before reading the final counts
+    board.run_us(50);
+    encoder.get_all_counts(counts);
+    run.exact = true;
+    for (size_t axis = 0; axis < HostBoard::kNumEncoders; axis++) {
+        int32_t error = std::abs(expected[axis] - counts[axis]);
+        run.worst_error = std::max(run.worst_error, error);
+        if (error != 0) {
+            run.exact = false;
+        }
+    }
+    return run;
+}
+
+void run_device_benchmark(HostBoard& board) {
+    std::printf("\non-device benchmark (RUN_BENCHMARK):\n");
+    board.send({USBDevice::VENDOR_REQUEST_RUN_BENCHMARK});
+
+    std::vector<uint8_t> response;
+    uint64_t duration_us = (EncoderBenchmark::kNumRates + 2) * EncoderBenchmark::kStepDurationUs;
+    for (uint64_t waited = 0; waited < 2 * duration_us; waited += 10000) {
+        board.run_us(10000);
+        if (!board.request({USBDevice::VENDOR_REQUEST_GET_BENCHMARK}, response)) {
+            continue;
+        }
+        uint32_t sentinel = 0;
+        std::memcpy(&sentinel, response.data(), sizeof(sentinel));
+        if (sentinel == USBDevice::BENCHMARK_DATA_SENTINEL && response.size() >= 12 && response[4] >= 2) {
+            break;
+        }
+        response.clear();
+    }
+    if (response.size() >= 12 && response[4] == 3) {
+        std::printf("  not available, all state machines count encoders\n");
+        return;
+    }
+    if (response.size() < 12 + 8 * EncoderBenchmark::kNumRates) {
+        std::printf("  no result\n");
+        return;
+    }
+
+    uint32_t max_rate = 0;
+    std::memcpy(&max_rate, response.data() + 8, sizeof(max_rate));
+    for (size_t i = 0; i < EncoderBenchmark::kNumRates; i++) {
+        const uint8_t* result = response.data() + 12 + i * 8;
+        uint32_t rate = 0;
+        uint16_t load = 0;
+        std::memcpy(&rate, result, sizeof(rate));
+        std::memcpy(&load, result + 4, sizeof(load));
+        std::printf("  %8u edges/s per axis  load %5.1f%%  %s\n", rate, load / 10.0, result[6] ? "exact" : "LOST");
+    }
+    std::printf("  max exact rate %u edges/s per axis\n", max_rate);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    bool device_benchmark = false;
+    for (int i = 1; i < argc; i++) {
+        if (std::strcmp(argv[i], "--device-benchmark") == 0) {
+            device_benchmark = true;
+        } else {
+            std::fprintf(stderr, "usage: %s [--device-benchmark]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    HostBoard& board = HostBoard::instance();
+    board.boot();
+    board.run_us(100);
+
+    std::printf("backend: %s, %u edges per axis, %zu axes\n",
+                QuadratureEncoder::kBackend == QuadratureEncoder::Backend::DMA ? "dma" : "irq", kEdgesPerAxis,
+                HostBoard::kNumEncoders);
+    std::printf("%8s %12s %8s %6s %8s %9s %8s %7s %9s\n", "cyc/edge", "edges/s/axis", "result", "error", "max lag",
+                "overflows", "irqs", "load", "emu Mc/s");
+
+    uint32_t max_exact_rate = 0;
+    uint32_t max_clean_rate = 0;
+    bool exact_so_far = true;
+    bool clean_so_far = true;
+    for (uint32_t cycles_per_edge : kCyclesPerEdge) {
+        Run run = measure(board, cycles_per_edge);
+        uint32_t rate = Simulator::kSysClockHz / cycles_per_edge;
+        std::printf("%8u %12u %8s %6d %8d %9u %8llu %6.1f%% %9.1f\n", cycles_per_edge, rate,
+                    run.exact ? "exact" : "LOST", run.worst_error, run.max_lag, run.rx_overflows,
+                    static_cast<unsigned long long>(run.irqs), run.load * 100.0, run.host_mcycles_per_s);
+
+        exact_so_far = exact_so_far && run.exact;
+        clean_so_far = clean_so_far && run.exact && run.rx_overflows == 0;
+        if (exact_so_far) {
+            max_exact_rate = rate;
+        }
+        if (clean_so_far) {
+            max_clean_rate = rate;
+        }
+    }
+
+    std::printf("\nmax exact rate            %u edges/s per axis\n", max_exact_rate);
+    std::printf("max rate without overruns %u edges/s per axis\n", max_clean_rate);
+
+    if (device_benchmark) {
+        run_device_benchmark(board);
+    }
+    return 0;
+}
@@ -0,0 +1,1019 @@
+// Counts synthetic A/B waveforms with the firmware running on the emulated
+// RP2040 and checks what it reports over the vendor interface.
+
+#include <array>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "config_store.h"
+#include "encoder_capture.h"
+#include "host_board.h"
+#include "perf_counters.h"
+#include "position.h"
+#include "position_compare.h"
+#include "probe_latch.h"
+#include "usb_device.h"
+
+namespace {
+
+using Counts = std::array<int32_t, HostBoard::kNumEncoders>;
+
+int failures = 0;
+
+void report(const std::string& name, bool ok, const std::string& detail = "") {
+    std::printf("%s %s%s%s\n", ok ? "PASS" : "FAIL", name.c_str(), detail.empty() ? "" : ": ", detail.c_str());
+    if (!ok) {
+        failures++;
+    }
+}
+
+std::string format_counts(const Counts& counts) {
+    std::string s;
+    for (int32_t count : counts) {
+        if (!s.empty()) {
+            s += ' ';
+        }
+        s += std::to_string(count);
+    }
+    return s;
+}
+
+// Counts with only one axis moved
+Counts single(size_t axis, int32_t count) {
+    Counts counts{};
+    counts[axis] = count;
+    return counts;
+}
+
+void reset_all(HostBoard& board) {
+    for (uint8_t i = 0; i < HostBoard::kNumEncoders; i++) {
+        board.send({USBDevice::VENDOR_REQUEST_RESET_POSITION, i});
+    }
+    board.run_us(100);
+}
+
+void check_counts(HostBoard& board, const std::string& name, const Counts& expected) {
+    Counts counts{};
+    if (!board.read_counts(counts)) {
+        report(name, false, "no position response");
+        return;
+    }
+    report(name, counts == expected, "expected " + format_counts(expected) + ", got " + format_counts(counts));
+}
+
+// Every axis moves a different distance, edges spaced by cycles_per_edge
+void scenario_moves(HostBoard& board, uint64_t cycles_per_edge) {
+    Simulator& sim = Simulator::instance();
+    reset_all(board);
+
+    Counts expected{};
+    const std::array<int, 8> targets = {1000, -750, 333, -5, 1, -999, 512, -64};
+    for (int n = 0; n < 1000; n++) {
+        for (size_t axis = 0; axis < HostBoard::kNumEncoders; axis++) {
+            if (n < std::abs(targets[axis])) {
+                int direction = targets[axis] > 0 ? 1 : -1;
+                board.step(axis, direction);
+                // As the axis profile of the build wires it
+                const AxisProfile& profile = QuadratureEncoder::kProfile[axis];
+                if (profile.type != AxisType::NONE) {
+                    expected[axis] += profile.inverted ? -direction : direction;
+                }
+            }
+        }
+        sim.advance(cycles_per_edge);
+    }
+    board.run_us(10);
+    check_counts(board, "moves at " + std::to_string(cycles_per_edge) + " cycles per edge", expected);
+}
+
+void scenario_reversal(HostBoard& board) {
+    Simulator& sim = Simulator::instance();
+    reset_all(board);
+
+    for (int n = 0; n < 400; n++) {
+        board.step(0, n < 300 ? 1 : -1);
+        sim.advance(500);
+    }
+    board.run_us(10);
+    check_counts(board, "direction reversal", single(0, 200));
+}
+
+// A line chattering on an edge must not accumulate counts
+void scenario_bounce(HostBoard& board) {
+    Simulator& sim = Simulator::instance();
+    reset_all(board);
+
+    for (int n = 0; n < 50; n++) {
+        board.step(1, 1);
+        sim.advance(200);
+        board.step(1, -1);
+        sim.advance(200);
+    }
+    board.step(1, 1);
+    board.run_us(10);
+    check_counts(board, "contact bounce", single(1, 1));
+}
+
+// Both lines changing between two samples is an illegal transition, the
+// jump table counts it as no motion
+void scenario_glitch(HostBoard& board) {
+    Simulator& sim = Simulator::instance();
+    reset_all(board);
+
+    for (int n = 0; n < 10; n++) {
+        board.step(2, 1);
+        sim.advance(500);
+    }
+    board.glitch(2);
+    sim.advance(500);
+    board.run_us(10);
+    check_counts(board, "illegal transition", single(2, 10));
+}
+
+void scenario_scale(HostBoard& board) {
+    Simulator& sim = Simulator::instance();
+    reset_all(board);
+
+    double scale = 0.0005;
+    std::vector<uint8_t> request = {USBDevice::VENDOR_REQUEST_SET_SCALE, 0};
+    request.resize(10);
+    std::memcpy(request.data() + 2, &scale, sizeof(scale));
+    board.send(request);
+
+    std::vector<uint8_t> response;
+    bool ok = board.request({USBDevice::VENDOR_REQUEST_GET_SCALE}, response) &&
+              response.size() == sizeof(uint32_t) + HostBoard::kNumEncoders * sizeof(double);
+    double reported = 0;
+    if (ok) {
+        std::memcpy(&reported, response.data() + 4, sizeof(reported));
+    }
+    report("set and get scale", ok && reported == scale);
+
+    for (int n = 0; n < 40; n++) {
+        board.step(0, 1);
+        sim.advance(500);
+    }
+    board.send({USBDevice::VENDOR_REQUEST_SET_FORMAT, static_cast<uint8_t>(Position::Format::SCALED)});
+    ok = board.request({USBDevice::VENDOR_REQUEST_GET_POSITION}, response) &&
+         response.size() == Position::kScaledPacketSize;
+    double position = 0;
+    if (ok) {
+        std::memcpy(&position, response.data() + 4, sizeof(position));
+    }
+    report("scaled position", ok && std::fabs(position - 40 * scale) < 1e-12, std::to_string(position));
+}
+
+void append_scale(std::vector<uint8_t>& out, uint8_t axis, double scale) {
+    out.push_back(axis);
+    const auto* bytes = reinterpret_cast<const uint8_t*>(&scale);
+    out.insert(out.end(), bytes, bytes + sizeof(scale));
+}
+
+// A bare SET_SCALE whose argument bytes arrive in a later packet
+void scenario_split_request(HostBoard& board) {
+    std::vector<uint8_t> request = {USBDevice::VENDOR_REQUEST_SET_SCALE};
+    append_scale(request, 1, 0.125);
+    board.send(std::vector<uint8_t>(request.begin(), request.begin() + 4));
+    board.run_us(100);
+    board.send(std::vector<uint8_t>(request.begin() + 4, request.end()));
+    board.run_us(100);
+    report("request split across packets", Position::instance().get_scale(1) == 0.125);
+    Position::instance().set_scale(1, 0.001);
+}
+
+// Several settings and reads in one framed request, answered by one reply
+void scenario_frames(HostBoard& board) {
+    Simulator& sim = Simulator::instance();
+    reset_all(board);
+    for (int n = 0; n < 25; n++) {
+        board.step(0, 1);
+        board.step(2, -1);
+        sim.advance(500);
+    }
+    board.run_us(10);
+
+    std::vector<uint8_t> entries = {USBDevice::VENDOR_REQUEST_SET_SCALE, 9};
+    append_scale(entries, 1, 0.25);
+    entries.insert(entries.end(), {USBDevice::VENDOR_REQUEST_RESET_POSITION, 1, 2,
+                                   USBDevice::VENDOR_REQUEST_SET_FORMAT, 1,
+                                   static_cast<uint8_t>(Position::Format::COUNTS),
+                                   USBDevice::VENDOR_REQUEST_GET_POSITION, 0,
+                                   USBDevice::VENDOR_REQUEST_GET_SCALE, 0});
+    std::vector<uint8_t> frame = HostBoard::make_frame(0x1234, entries);
+
+    // Two halves with the firmware polling in between
+    board.send(std::vector<uint8_t>(frame.begin(), frame.begin() + 13));
+    board.run_us(100);
+    std::vector<uint8_t> response;
+    bool early = sim.usb().receive(response);
+    bool ok = board.request(std::vector<uint8_t>(frame.begin() + 13, frame.end()), response);
+
+    HostBoard::Reply reply;
+    std::vector<uint8_t> position;
+    std::vector<uint8_t> scales;
+    ok = ok && !early && HostBoard::parse_frame(response, reply) && reply.request_id == 0x1234 &&
+         reply.status == static_cast<uint8_t>(USBDevice::FrameStatus::OK) &&
+         HostBoard::find_entry(reply, USBDevice::VENDOR_REQUEST_GET_POSITION, position) &&
+         HostBoard::find_entry(reply, USBDevice::VENDOR_REQUEST_GET_SCALE, scales) &&
+         position.size() == Position::kCountsHeaderSize + Position::kCountsSampleSize &&
+         scales.size() == sizeof(uint32_t) + HostBoard::kNumEncoders * sizeof(double);
+    Counts counts{};
+    double scale = 0;
+    if (ok) {
+        std::memcpy(counts.data(), position.data() + Position::kCountsHeaderSize + sizeof(uint16_t), sizeof(counts));
+        std::memcpy(&scale, scales.data() + sizeof(uint32_t) + sizeof(double), sizeof(scale));
+    }
+    report("framed batch", ok && counts == single(0, 25) && scale == 0.25,
+           "counts " + format_counts(counts) + ", scale " + std::to_string(scale));
+    Position::instance().set_scale(1, 0.001);
+
+    // A corrupted frame is rejected as a whole
+    frame = HostBoard::make_frame(7, {USBDevice::VENDOR_REQUEST_RESET_POSITION, 1, 0});
+    frame.back() ^= 0xFF;
+    ok = board.request(frame, response) && HostBoard::parse_frame(response, reply) &&
+         reply.status == static_cast<uint8_t>(USBDevice::FrameStatus::BAD_CRC);
+    Counts after{};
+    ok = ok && board.read_counts(after);
+    report("framed bad crc", ok && after == single(0, 25));
+
+    frame = HostBoard::make_frame(8, {0x7F, 0});
+    ok = board.request(frame, response) && HostBoard::parse_frame(response, reply) && reply.request_id == 8 &&
+         reply.status == static_cast<uint8_t>(USBDevice::FrameStatus::BAD_REQUEST);
+    report("framed unknown request", ok);
+}
+
+// Records axis 0 at 50 kHz around a rising trigger and downloads the buffer
+void scenario_capture(HostBoard& board) {
+    Simulator& sim = Simulator::instance();
+    reset_all(board);
+
+    const uint32_t rate = 50000;
+    const int32_t threshold = 100;
+    const uint32_t pre_samples = 500;
+    std::vector<uint8_t> start(15);
+    start[0] = USBDevice::VENDOR_REQUEST_START_CAPTURE;
+    std::memcpy(start.data() + 1, &rate, sizeof(rate));
+    start[5] = static_cast<uint8_t>(EncoderCapture::Trigger::RISING);
+    start[6] = 0;
+    std::memcpy(start.data() + 7, &threshold, sizeof(threshold));
+    std::memcpy(start.data() + 11, &pre_samples, sizeof(pre_samples));
+    board.send(start);
+
+    // Enough samples before the trigger to fill the pre-trigger part
+    board.run_us(15000);
+    for (int n = 0; n < 200; n++) {
+        board.step(0, 1);
+        board.run_us(50);
+    }
+
+    std::vector<uint8_t> status;
+    bool done = false;
+    for (int poll = 0; poll < 100 && !done; poll++) {
+        board.run_us(10000);
+        done = board.request({USBDevice::VENDOR_REQUEST_GET_CAPTURE}, status) && status.size() == 32 &&
+               status[4] == static_cast<uint8_t>(EncoderCapture::State::DONE);
+    }
+    uint32_t count = 0;
+    uint32_t trigger = 0;
+    uint32_t missed = 0;
+    if (done) {
+        std::memcpy(&count, status.data() + 12, sizeof(count));
+        std::memcpy(&trigger, status.data() + 16, sizeof(trigger));
+        std::memcpy(&missed, status.data() + 20, sizeof(missed));
+    }
+    report("capture done", done && count == EncoderCapture::kCapacity && trigger == pre_samples && missed == 0,
+           std::to_string(count) + " samples, trigger at " + std::to_string(trigger) + ", " +
+               std::to_string(missed) + " missed");
+    if (!done) {
+        return;
+    }
+
+    std::vector<uint8_t> read(9);
+    read[0] = USBDevice::VENDOR_REQUEST_READ_CAPTURE;
+    uint32_t first = 0;
+    std::memcpy(read.data() + 1, &first, sizeof(first));
+    std::memcpy(read.data() + 5, &count, sizeof(count));
+    board.send(read);
+
+    size_t total = count * sizeof(EncoderCapture::Sample);
+    std::vector<uint8_t> data;
+    std::vector<uint8_t> chunk;
+    for (int wait = 0; wait < 10000 && data.size() < total; wait++) {
+        board.run_us(10);
+        while (data.size() < total && sim.usb().receive(chunk, total - data.size())) {
+            data.insert(data.end(), chunk.begin(), chunk.end());
+        }
+    }
+
+    std::vector<EncoderCapture::Sample> samples(count);
+    bool ok = data.size() == total;
+    if (ok) {
+        std::memcpy(samples.data(), data.data(), total);
+    }
+    uint32_t irregular = 0;
+    for (size_t i = 1; ok && i < samples.size(); i++) {
+        uint32_t interval = samples[i].time_us - samples[i - 1].time_us;
+        if (interval != 1000000 / rate) {
+            irregular++;
+        }
+    }
+    ok = ok && samples[trigger].counts[0] >= threshold && samples[trigger - 1].counts[0] < threshold;
+    report("capture download", ok && irregular == 0,
+           std::to_string(data.size()) + " of " + std::to_string(total) + " bytes, " + std::to_string(irregular) +
+               " irregular intervals");
+
+    // Requests wait while the download is out and are answered after it
+    Counts counts{};
+    report("requests after capture download", board.read_counts(counts) && counts == single(0, 200));
+}
+
+// Reads the velocity trailer of a polled count frame
+bool read_velocities(HostBoard& board, std::array<float, HostBoard::kNumEncoders>& velocities) {
+    std::vector<uint8_t> response;
+    size_t expected = Position::kCountsHeaderSize + Position::kCountsSampleSize + Position::kVelocitySize;
+    if (!board.request({USBDevice::VENDOR_REQUEST_GET_POSITION}, response) || response.size() != expected ||
+        (response[7] & Position::kCountsFlagVelocity) == 0) {
+        return false;
+    }
+    std::memcpy(velocities.data(), response.data() + expected - Position::kVelocitySize, sizeof(velocities));
+    return true;
+}
+
+// Axis 0 fast, axis 1 slow enough for period measurement, axis 2 backwards
+void scenario_velocity(HostBoard& board) {
+    reset_all(board);
+    board.send({USBDevice::VENDOR_REQUEST_SET_FORMAT,
+                static_cast<uint8_t>(static_cast<uint8_t>(Position::Format::COUNTS) | Position::kVelocityFormatFlag)});
+
+    for (int n = 0; n < 1900; n++) {
+        if (n % 2 == 0) {
+            board.step(0, 1);
+        }
+        if (n % 400 == 0) {
+            board.step(1, 1);
+        }
+        if (n % 10 == 0) {
+            board.step(2, -1);
+        }
+        board.run_us(50);
+    }
+
+    std::array<float, HostBoard::kNumEncoders> velocities{};
+    bool ok = read_velocities(board, velocities);
+    auto near = [](float value, float expected) { return std::fabs(value - expected) <= std::fabs(expected) * 0.01f; };
+    char detail[96];
+    std::snprintf(detail, sizeof(detail), "%.1f %.2f %.1f counts/s", velocities[0], velocities[1], velocities[2]);
+    report("velocity while moving", ok && near(velocities[0], 10000) && near(velocities[1], 50) &&
+                                        near(velocities[2], -2000),
+           detail);
+
+    board.run_us(QuadratureEncoder::kVelocityTimeoutUs + 1000);
+    ok = read_velocities(board, velocities);
+    report("velocity after stopping", ok && velocities[0] == 0 && velocities[1] == 0 && velocities[2] == 0);
+
+    board.send({USBDevice::VENDOR_REQUEST_SET_FORMAT, static_cast<uint8_t>(Position::Format::SCALED)});
+    board.run_us(100);
+}
+
+// Streams raw counts while moving and checks the sample numbering and that
+// the final sample matches the final counts
+void scenario_stream(HostBoard& board, Position::Format format, bool velocity = false) {
+    Simulator& sim = Simulator::instance();
+    reset_all(board);
+
+    uint8_t format_flags = velocity ? Position::kVelocityFormatFlag : 0;
+    board.send({USBDevice::VENDOR_REQUEST_SET_FORMAT, static_cast<uint8_t>(static_cast<uint8_t>(format) | format_flags)});
+    uint16_t rate = 5000;
+    board.send({USBDevice::VENDOR_REQUEST_SET_STREAM, static_cast<uint8_t>(rate & 0xFF), static_cast<uint8_t>(rate >> 8)});
+
+    uint32_t samples = 0;
+    uint32_t gaps = 0;
+    uint32_t bad_lengths = 0;
+    uint32_t next_sequence = 0;
+    bool have_sequence = false;
+    Counts last{};
+    std::vector<uint8_t> packet;
+
+    auto drain = [&]() {
+        while (sim.usb().receive(packet)) {
+            uint32_t sentinel = 0;
+            std::memcpy(&sentinel, packet.data(), sizeof(sentinel));
+            if (sentinel != USBDevice::COUNTS_DATA_SENTINEL) {
+                continue;
+            }
+            uint8_t count = packet[5];
+            uint32_t sequence = 0;
+            std::memcpy(&sequence, packet.data() + 8, sizeof(sequence));
+            if (have_sequence && sequence != next_sequence) {
+                gaps++;
+            }
+            size_t offset = Position::kCountsHeaderSize;
+            for (uint8_t i = 0; i < count; i++) {
+                if (format == Position::Format::COUNTS_DELTA && i > 0) {
+                    std::array<int16_t, HostBoard::kNumEncoders> deltas;
+                    std::memcpy(deltas.data(), packet.data() + offset + 2, sizeof(deltas));
+                    for (size_t axis = 0; axis < HostBoard::kNumEncoders; axis++) {
+                        last[axis] += deltas[axis];
+                    }
+                    offset += Position::kDeltaSampleSize;
+                } else {
+                    std::memcpy(last.data(), packet.data() + offset + 2, sizeof(last));
+                    offset += Position::kCountsSampleSize;
+                }
+                samples++;
+            }
+            if ((packet[7] & Position::kCountsFlagVelocity) != 0) {
+                offset += Position::kVelocitySize;
+            }
+            if (offset != packet.size()) {
+                bad_lengths++;
+            }
+            next_sequence = sequence + count;
+            have_sequence = true;
+        }
+    };
+
+    for (int n = 0; n < 2000; n++) {
+        board.step(3, 1);
+        board.run_us(5);
+        drain();
+    }
+    board.run_us(1000);
+    drain();
+
+    board.send({USBDevice::VENDOR_REQUEST_SET_STREAM, 0, 0});
+    board.run_us(100);
+    drain();
+
+    std::string name = format == Position::Format::COUNTS ? "stream counts" : "stream delta counts";
+    if (velocity) {
+        name += " with velocity";
+    }
+    Counts expected = single(3, 2000);
+    report(name, samples > 40 && gaps == 0 && bad_lengths == 0 && last == expected,
+           std::to_string(samples) + " samples, " + std::to_string(gaps) + " gaps, " + std::to_string(bad_lengths) +
+               " bad lengths, last " + format_counts(last));
+}
+
+// With a keepalive only samples that changed stream, plus one per keepalive
+// period while everything stands still
+void scenario_report_on_change(HostBoard& board) {
+    Simulator& sim = Simulator::instance();
+    reset_all(board);
+    // Let the velocities of earlier moves settle
+    board.run_us(QuadratureEncoder::kVelocityTimeoutUs + 1000);
+
+    board.send({USBDevice::VENDOR_REQUEST_SET_FORMAT, static_cast<uint8_t>(Position::Format::COUNTS)});
+    uint16_t keepalive_ms = 50;
+    board.send({USBDevice::VENDOR_REQUEST_SET_KEEPALIVE, static_cast<uint8_t>(keepalive_ms), 0});
+    uint16_t rate = 1000;
+    board.send({USBDevice::VENDOR_REQUEST_SET_STREAM, static_cast<uint8_t>(rate & 0xFF), static_cast<uint8_t>(rate >> 8)});
+
+    uint32_t samples = 0;
+    uint32_t gaps = 0;
+    uint32_t next_sequence = 0;
+    bool have_sequence = false;
+    Counts last{};
+    std::vector<uint8_t> packet;
+    auto drain = [&]() {
+        while (sim.usb().receive(packet)) {
+            uint32_t sentinel = 0;
+            std::memcpy(&sentinel, packet.data(), sizeof(sentinel));
+            if (sentinel != USBDevice::COUNTS_DATA_SENTINEL) {
+                continue;
+            }
+            uint32_t sequence = 0;
+            std::memcpy(&sequence, packet.data() + 8, sizeof(sequence));
+            gaps += have_sequence && sequence != next_sequence;
+            size_t offset = Position::kCountsHeaderSize + (packet[5] - 1) * Position::kCountsSampleSize;
+            std::memcpy(last.data(), packet.data() + offset + 2, sizeof(last));
+            samples += packet[5];
+            next_sequence = sequence + packet[5];
+            have_sequence = true;
+        }
+    };
+
+    board.run_us(500000);
+    drain();
+    uint32_t idle_samples = samples;
+
+    samples = 0;
+    for (int n = 0; n < 100; n++) {
+        board.step(0, 1);
+        board.run_us(200);
+        drain();
+    }
+    uint32_t moving_samples = samples;
+    board.run_us(QuadratureEncoder::kVelocityTimeoutUs + 100000);
+    drain();
+
+    board.send({USBDevice::VENDOR_REQUEST_SET_STREAM, 0, 0});
+    board.send({USBDevice::VENDOR_REQUEST_SET_KEEPALIVE, 0, 0});
+    board.run_us(100);
+    drain();
+
+    // 500 ms idle at 1 kHz is 500 samples without the keepalive
+    report("report on change", idle_samples >= 9 && idle_samples <= 12 && moving_samples >= 15 && gaps == 0 &&
+                                   last == single(0, 100),
+           std::to_string(idle_samples) + " idle samples, " + std::to_string(moving_samples) + " moving, " +
+               std::to_string(gaps) + " gaps, last " + format_counts(last));
+}
+
+struct AxisStatus {
+    uint32_t illegal = 0;
+    uint32_t overruns = 0;
+    uint16_t clkdiv_int = 0;
+    uint8_t clkdiv_frac = 0;
+    uint8_t filter_samples = 0;
+};
+
+bool read_encoder_status(HostBoard& board, std::array<AxisStatus, HostBoard::kNumEncoders>& status) {
+    std::vector<uint8_t> response;
+    uint32_t sentinel = 0;
+    if (!board.request({USBDevice::VENDOR_REQUEST_GET_ENCODER_STATUS}, response) ||
+        response.size() != sizeof(sentinel) + HostBoard::kNumEncoders * 12) {
+        return false;
+    }
+    std::memcpy(&sentinel, response.data(), sizeof(sentinel));
+    for (size_t i = 0; i < HostBoard::kNumEncoders; i++) {
+        const uint8_t* axis = response.data() + sizeof(sentinel) + i * 12;
+        std::memcpy(&status[i].illegal, axis, sizeof(uint32_t));
+        std::memcpy(&status[i].overruns, axis + 4, sizeof(uint32_t));
+        std::memcpy(&status[i].clkdiv_int, axis + 8, sizeof(uint16_t));
+        status[i].clkdiv_frac = axis[10];
+        status[i].filter_samples = axis[11];
+    }
+    return sentinel == USBDevice::ENCODER_STATUS_SENTINEL;
+}
+
+// A state held for less than the glitch filter does not count: two quick
+// edges in a row become one illegal transition, where they would count two
+// without the filter. Changing the sampling keeps the count.
+void scenario_sampling(HostBoard& board) {
+    Simulator& sim = Simulator::instance();
+    reset_all(board);
+
+    std::array<AxisStatus, HostBoard::kNumEncoders> before{};
+    bool ok = read_encoder_status(board, before);
+
+    for (int n = 0; n < 5; n++) {
+        board.step(3, 1);
+        sim.advance(500);
+    }
+    // Eight samples of six clocks
+    board.send({USBDevice::VENDOR_REQUEST_SET_SAMPLING, 3, 1, 0, 0, 8});
+    board.run_us(10);
+    for (int n = 0; n < 20; n++) {
+        board.step(3, 1);
+        sim.advance(20);
+        board.step(3, -1);
+        sim.advance(500);
+    }
+    board.step(3, 1);
+    sim.advance(20);
+    board.step(3, 1);
+    sim.advance(500);
+    for (int n = 0; n < 10; n++) {
+        board.step(3, 1);
+        sim.advance(500);
+    }
+    board.glitch(2);
+    sim.advance(500);
+    board.run_us(10);
+    check_counts(board, "glitch filter", single(3, 15));
+
+    std::array<AxisStatus, HostBoard::kNumEncoders> after{};
+    ok = ok && read_encoder_status(board, after);
+    report("encoder status",
+           ok && after[2].illegal == before[2].illegal + 1 && after[3].illegal == before[3].illegal + 1 &&
+               after[3].overruns == 0 && after[3].clkdiv_int == 1 && after[3].filter_samples == 8,
+           "illegal " + std::to_string(before[2].illegal) + " -> " + std::to_string(after[2].illegal) +
+               ", filter " + std::to_string(after[3].filter_samples));
+
+    board.send({USBDevice::VENDOR_REQUEST_SET_SAMPLING, 3, 1, 0, 0, 1});
+    board.run_us(10);
+}
+
+
+// The counters see the interrupts of the steps, the main loop and the
+// replies to the requests reading them. Only the interrupt backend takes
+// encoder interrupts.
+void scenario_perf_counters(HostBoard& board) {
+    Simulator& sim = Simulator::instance();
+    board.send({USBDevice::VENDOR_REQUEST_RESET_PERF_COUNTERS});
+    board.run_us(10);
+    for (int n = 0; n < 10; n++) {
+        board.step(0, 1);
+        sim.advance(200);
+    }
+    board.run_us(1000);
+
+    std::array<std::array<uint32_t, PerfCounters::kNumBuckets>, PerfCounters::kNumHistograms> histograms{};
+    bool ok = true;
+    for (size_t h = 0; h < PerfCounters::kNumHistograms; h++) {
+        std::vector<uint8_t> response;
+        uint32_t sentinel = 0;
+        ok = ok && board.request({USBDevice::VENDOR_REQUEST_GET_PERF_HISTOGRAM, static_cast<uint8_t>(h)}, response) &&
+             response.size() == 8 + sizeof(histograms[h]);
+        if (ok) {
+            std::memcpy(&sentinel, response.data(), sizeof(sentinel));
+            std::memcpy(histograms[h].data(), response.data() + 8, sizeof(histograms[h]));
+            ok = sentinel == USBDevice::PERF_HISTOGRAM_SENTINEL && response[4] == h;
+        }
+    }
+
+    std::vector<uint8_t> response;
+    uint32_t sentinel = 0;
+    std::array<uint32_t, PerfCounters::kNumHistograms> counts{};
+    std::array<uint32_t, PerfCounters::kNumHistograms> max_us{};
+    ok = ok && board.request({USBDevice::VENDOR_REQUEST_GET_PERF_COUNTERS}, response) &&
+         response.size() == 8 + PerfCounters::kNumHistograms * 8 + HostBoard::kNumEncoders;
+    if (ok) {
+        std::memcpy(&sentinel, response.data(), sizeof(sentinel));
+        for (size_t h = 0; h < PerfCounters::kNumHistograms; h++) {
+            std::memcpy(&counts[h], response.data() + 8 + h * 8, sizeof(uint32_t));
+            std::memcpy(&max_us[h], response.data() + 12 + h * 8, sizeof(uint32_t));
+        }
+        ok = sentinel == USBDevice::PERF_COUNTERS_SENTINEL;
+    }
+    uint8_t fifo_max = ok ? response[8 + PerfCounters::kNumHistograms * 8] : 0;
+
+    auto sum = [](const std::array<uint32_t, PerfCounters::kNumBuckets>& buckets) {
+        uint32_t total = 0;
+        for (uint32_t value : buckets) {
+            total += value;
+        }
+        return total;
+    };
+    constexpr bool kInterrupts = QuadratureEncoder::kBackend == QuadratureEncoder::Backend::IRQ;
+    uint32_t irq = static_cast<uint32_t>(PerfCounters::Histogram::ENCODER_IRQ);
+    uint32_t loop = static_cast<uint32_t>(PerfCounters::Histogram::MAIN_LOOP);
+    uint32_t reply = static_cast<uint32_t>(PerfCounters::Histogram::USB_REPLY);
+    // The histogram replies were each written before they were timed
+    report("perf counters",
+           ok && (kInterrupts ? counts[irq] >= 10 && fifo_max >= 1 : counts[irq] == 0) &&
+               sum(histograms[irq]) == counts[irq] && counts[loop] > 0 && sum(histograms[loop]) <= counts[loop] &&
+               counts[reply] == PerfCounters::kNumHistograms && sum(histograms[reply]) == 2,
+           std::to_string(counts[irq]) + " interrupts max " + std::to_string(max_us[irq]) + " us, " +
+               std::to_string(counts[loop]) + " loops max " + std::to_string(max_us[loop]) + " us, " +
+               std::to_string(counts[reply]) + " replies max " + std::to_string(max_us[reply]) + " us");
+}
+
+
+// A falling probe edge latches the counts at that moment and is pushed to
+// the host. The contact bouncing within the holdoff, motion afterwards and
+// the rising edge when it opens add nothing.
+void scenario_probe(HostBoard& board) {
+    Simulator& sim = Simulator::instance();
+    reset_all(board);
+    sim.set_input(ProbeLatch::kProbePin, true);
+    board.send({USBDevice::VENDOR_REQUEST_SET_PROBE, ProbeLatch::kEdgeFalling, 0xE8, 0x03});
+    board.run_us(10);
+
+    for (int n = 0; n < 5; n++) {
+        board.step(1, -1);
+        sim.advance(500);
+    }
+    uint64_t edge_us = sim.time_us();
+    sim.set_input(ProbeLatch::kProbePin, false);
+    sim.advance_us(20);
+    sim.set_input(ProbeLatch::kProbePin, true);
+    sim.advance_us(20);
+    sim.set_input(ProbeLatch::kProbePin, false);
+    for (int n = 0; n < 3; n++) {
+        board.step(1, -1);
+        sim.advance(500);
+    }
+    board.run_us(2000);
+    sim.set_input(ProbeLatch::kProbePin, true);
+    board.run_us(200);
+
+    std::vector<std::vector<uint8_t>> latches;
+    std::vector<uint8_t> transfer;
+    while (sim.usb().receive(transfer)) {
+        latches.push_back(transfer);
+    }
+    board.send({USBDevice::VENDOR_REQUEST_SET_PROBE, 0, 0, 0});
+    board.run_us(10);
+
+    constexpr size_t kLatchSize = 24 + 4 * HostBoard::kNumEncoders;
+    if (latches.size() != 1 || latches[0].size() != kLatchSize) {
+        report("probe latch", false, std::to_string(latches.size()) + " transfers");
+        return;
+    }
+    const std::vector<uint8_t>& latch = latches[0];
+    uint32_t sentinel = 0;
+    uint32_t sequence = 0;
+    uint64_t timestamp_us = 0;
+    Counts counts{};
+    std::memcpy(&sentinel, latch.data(), sizeof(sentinel));
+    std::memcpy(&sequence, latch.data() + 8, sizeof(sequence));
+    std::memcpy(&timestamp_us, latch.data() + 16, sizeof(timestamp_us));
+    std::memcpy(counts.data(), latch.data() + 24, sizeof(counts));
+    report("probe latch",
+           sentinel == USBDevice::PROBE_DATA_SENTINEL && latch[5] == ProbeLatch::kEdgeFalling && latch[6] == 0 &&
+               sequence == 0 && timestamp_us - edge_us <= 1 && counts == single(1, -5),
+           "latched " + format_counts(counts) + " " + std::to_string(timestamp_us - edge_us) + " us after the edge");
+    check_counts(board, "probe leaves the counts", single(1, -8));
+}
+
+struct CompareStatus {
+    uint8_t mode = 0;
+    uint16_t targets = 0;
+    uint32_t index = 0;
+    uint32_t hits = 0;
+    int32_t last_count = 0;
+};
+
+bool read_compare(HostBoard& board, size_t channel, CompareStatus& status) {
+    std::vector<uint8_t> response;
+    uint32_t sentinel = 0;
+    if (!board.request({USBDevice::VENDOR_REQUEST_GET_COMPARE}, response) ||
+        response.size() != 8 + 24 * PositionCompare::kNumChannels) {
+        return false;
+    }
+    const uint8_t* entry = response.data() + 8 + 24 * channel;
+    std::memcpy(&sentinel, response.data(), sizeof(sentinel));
+    status.mode = entry[0];
+    std::memcpy(&status.targets, entry + 2, sizeof(status.targets));
+    std::memcpy(&status.index, entry + 4, sizeof(status.index));
+    std::memcpy(&status.hits, entry + 8, sizeof(status.hits));
+    std::memcpy(&status.last_count, entry + 12, sizeof(status.last_count));
+    return sentinel == USBDevice::COMPARE_STATUS_SENTINEL && response[4] == PositionCompare::kNumChannels;
+}
+
+std::vector<uint8_t> compare_request(uint8_t channel, uint8_t axis, PositionCompare::Mode mode, uint16_t pulse_us,
+                                     int32_t first, int32_t spacing, uint32_t count) {
+    std::vector<uint8_t> request = {USBDevice::VENDOR_REQUEST_SET_COMPARE, channel, axis, static_cast<uint8_t>(mode), 0,
+                                    static_cast<uint8_t>(pulse_us & 0xFF), static_cast<uint8_t>(pulse_us >> 8)};
+    request.resize(19);
+    std::memcpy(request.data() + 7, &first, sizeof(first));
+    std::memcpy(request.data() + 11, &spacing, sizeof(spacing));
+    std::memcpy(request.data() + 15, &count, sizeof(count));
+    return request;
+}
+
+// A periodic channel toggles its output on each target, from the encoder
+// interrupt within microseconds of the edge, and pushes every hit. A list
+// channel pulses its output, ended by the main loop.
+void scenario_compare(HostBoard& board) {
+    constexpr bool kInterrupts = QuadratureEncoder::kBackend == QuadratureEncoder::Backend::IRQ;
+    Simulator& sim = Simulator::instance();
+    reset_all(board);
+    std::vector<uint8_t> transfer;
+    while (sim.usb().receive(transfer)) {
+    }
+
+    const uint toggle_pin = PositionCompare::kOutputPins[0];
+    board.send(compare_request(0, 0, PositionCompare::Mode::PERIODIC, 0, 5, 10, 3));
+    board.run_us(10);
+
+    int toggles = 0;
+    uint64_t worst_us = 0;
+    bool level = sim.pad(toggle_pin);
+    for (int n = 0; n < 40; n++) {
+        board.step(0, 1);
+        uint64_t edge_us = sim.time_us();
+        for (int k = 0; k < 80 && sim.pad(toggle_pin) == level; k++) {
+            sim.advance(25);
+        }
+        if (!kInterrupts && sim.pad(toggle_pin) == level) {
+            // The service loop takes the counts
+            board.run_us(20);
+        }
+        if (sim.pad(toggle_pin) != level) {
+            toggles++;
+            worst_us = std::max(worst_us, sim.time_us() - edge_us);
+            level = !level;
+        }
+        sim.advance(2000);
+    }
+    board.run_us(200);
+
+    std::vector<std::vector<uint8_t>> hits;
+    while (sim.usb().receive(transfer)) {
+        hits.push_back(transfer);
+    }
+    bool pushed = hits.size() == 3;
+    for (size_t i = 0; pushed && i < hits.size(); i++) {
+        uint32_t sentinel = 0;
+        uint32_t index = 0;
+        int32_t count = 0;
+        std::memcpy(&sentinel, hits[i].data(), sizeof(sentinel));
+        std::memcpy(&index, hits[i].data() + 8, sizeof(index));
+        std::memcpy(&count, hits[i].data() + 20, sizeof(count));
+        pushed = hits[i].size() == 32 && sentinel == USBDevice::COMPARE_HIT_SENTINEL && hits[i][4] == 0 &&
+                 hits[i][7] == 1 && index == i && count == static_cast<int32_t>(5 + 10 * i);
+    }
+    CompareStatus status;
+    bool ok = read_compare(board, 0, status) && status.hits == 3 && status.index == 3 && status.last_count == 25;
+    report("compare periodic", ok && pushed && toggles == 3 && (!kInterrupts || worst_us <= 5),
+           std::to_string(toggles) + " toggles, " + std::to_string(hits.size()) + " pushed, " +
+               std::to_string(status.hits) + " hits, output at most " + std::to_string(worst_us) +
+               " us after the edge");
+
+    const uint pulse_pin = PositionCompare::kOutputPins[1];
+    board.send(compare_request(1, 1, PositionCompare::Mode::OFF, 0, 0, 0, 0));
+    std::vector<uint8_t> add = {USBDevice::VENDOR_REQUEST_ADD_COMPARE_TARGETS, 1, 3};
+    add.resize(2 + 1 + PositionCompare::kTargetsPerRequest * sizeof(int32_t));
+    const std::array<int32_t, 3> targets = {-3, -7, -8};
+    std::memcpy(add.data() + 3, targets.data(), sizeof(targets));
+    board.send(add);
+    board.send(compare_request(1, 1, PositionCompare::Mode::LIST, 100, 0, 0, 0));
+    board.run_us(10);
+
+    bool high_after_hit = false;
+    for (int n = 0; n < 10; n++) {
+        board.step(1, -1);
+        board.run_us(20);
+        high_after_hit |= n == 2 && sim.pad(pulse_pin);
+    }
+    board.run_us(200);
+    while (sim.usb().receive(transfer)) {
+    }
+    ok = read_compare(board, 1, status) && status.mode == static_cast<uint8_t>(PositionCompare::Mode::LIST) &&
+         status.targets == 3 && status.index == 3 && status.hits == 3 && status.last_count == -8;
+    report("compare list", ok && high_after_hit && !sim.pad(pulse_pin),
+           std::to_string(status.hits) + " hits, last at " + std::to_string(status.last_count));
+
+    // Armed a million targets behind the count, those are skipped: moving
+    // back and forth fires nothing until the count reaches the next one
+    // ahead. The same settings sent again leave the channel running.
+    const std::vector<uint8_t> behind = compare_request(0, 0, PositionCompare::Mode::PERIODIC, 0, -1000000, 1, 0);
+    board.send(behind);
+    board.run_us(10);
+    CompareStatus armed;
+    bool skipped = read_compare(board, 0, armed) && armed.hits == 0 && armed.index == 1000041;
+    level = sim.pad(toggle_pin);
+    bool quiet = true;
+    for (int step : {-1, 1}) {
+        board.step(0, step);
+        board.run_us(50);
+        quiet = quiet && sim.pad(toggle_pin) == level;
+    }
+    board.step(0, 1);
+    uint64_t edge_us = sim.time_us();
+    for (int k = 0; k < 80 && sim.pad(toggle_pin) == level; k++) {
+        sim.advance(25);
+    }
+    if (!kInterrupts && sim.pad(toggle_pin) == level) {
+        board.run_us(20);
+    }
+    uint64_t hit_us = sim.time_us() - edge_us;
+    bool toggled = sim.pad(toggle_pin) != level;
+    board.send(behind);
+    board.step(0, -1);
+    board.run_us(200);
+    size_t pushed_behind = 0;
+    while (sim.usb().receive(transfer)) {
+        pushed_behind++;
+    }
+    ok = read_compare(board, 0, status) && status.mode == static_cast<uint8_t>(PositionCompare::Mode::PERIODIC) &&
+         status.hits == 1 && status.index == 1000042 && status.last_count == 41;
+    report("compare armed behind", skipped && quiet && ok && toggled && pushed_behind == 1 && (!kInterrupts || hit_us <= 5),
+           std::to_string(armed.index) + " skipped, " + std::to_string(status.hits) + " hits, output " +
+               std::to_string(hit_us) + " us after the edge");
+
+    board.send(compare_request(0, 0, PositionCompare::Mode::OFF, 0, 0, 0, 0));
+    board.send(compare_request(1, 0, PositionCompare::Mode::OFF, 0, 0, 0, 0));
+    board.run_us(10);
+    check_counts(board, "compare leaves the counts", [] {
+        Counts counts = single(0, 40);
+        counts[1] = -10;
+        return counts;
+    }());
+}
+
+struct Handshake {
+    uint8_t ready = 0;
+    uint8_t from_flash = 0;
+    uint32_t hash = 0;
+    uint32_t saves = 0;
+};
+
+bool read_handshake(HostBoard& board, Handshake& handshake) {
+    std::vector<uint8_t> response;
+    uint32_t sentinel = 0;
+    if (!board.request({USBDevice::VENDOR_REQUEST_HANDSHAKE}, response) || response.size() != 16) {
+        return false;
+    }
+    std::memcpy(&sentinel, response.data(), sizeof(sentinel));
+    handshake.ready = response[4];
+    handshake.from_flash = response[6];
+    std::memcpy(&handshake.hash, response.data() + 8, sizeof(handshake.hash));
+    std::memcpy(&handshake.saves, response.data() + 12, sizeof(handshake.saves));
+    return sentinel == USBDevice::HANDSHAKE_SENTINEL && response[5] == HostBoard::kNumEncoders;
+}
+
+// A scale is saved once it stopped changing and the handshake reports the
+// hash of the settings. Loading the store again, as a reboot does, puts the
+// saved scale back.
+void scenario_stored_settings(HostBoard& board) {
+    Position& pos = Position::instance();
+    double scale = pos.get_scale(2);
+    std::vector<uint8_t> request = {USBDevice::VENDOR_REQUEST_SET_SCALE};
+    append_scale(request, 2, 0.0025);
+    board.send(request);
+    board.run_us(ConfigStore::kSaveDelayUs + 1000);
+
+    Handshake saved;
+    bool ok = read_handshake(board, saved);
+    report("handshake", ok && saved.ready == 1 && saved.saves > 0 && saved.hash == ConfigStore::settings_hash(),
+           std::to_string(saved.saves) + " saves");
+
+    pos.set_scale(2, 1.0);
+    ok = ConfigStore::instance().load();
+    Handshake loaded;
+    ok = ok && read_handshake(board, loaded);
+    report("stored settings restored",
+           ok && pos.get_scale(2) == 0.0025 && loaded.from_flash == 1 && loaded.hash == saved.hash);
+
+    request = {USBDevice::VENDOR_REQUEST_SET_SCALE};
+    append_scale(request, 2, scale);
+    board.send(request);
+    board.run_us(100);
+}
+
+struct Clock {
+    uint32_t frames = 0;
+    uint64_t sof_us = 0;
+    uint64_t now_us = 0;
+};
+
+bool read_clock(HostBoard& board, Clock& clock) {
+    std::vector<uint8_t> response;
+    uint32_t sentinel = 0;
+    if (!board.request({USBDevice::VENDOR_REQUEST_GET_CLOCK}, response) || response.size() != 24) {
+        return false;
+    }
+    std::memcpy(&sentinel, response.data(), sizeof(sentinel));
+    std::memcpy(&clock.frames, response.data() + 4, sizeof(clock.frames));
+    std::memcpy(&clock.sof_us, response.data() + 8, sizeof(clock.sof_us));
+    std::memcpy(&clock.now_us, response.data() + 16, sizeof(clock.now_us));
+    return sentinel == USBDevice::CLOCK_DATA_SENTINEL && clock.sof_us != 0 && clock.sof_us <= clock.now_us;
+}
+
+// Frames are counted on across the 11 bit frame number wrap, and their
+// times show a bus clock that runs 150 ppm fast against the device
+void scenario_clock(HostBoard& board) {
+    constexpr int32_t kBusPpm = 150;
+    Simulator& sim = Simulator::instance();
+    sim.usb().set_bus_ppm(kBusPpm);
+    board.run_us(2000);
+
+    Clock first;
+    Clock last;
+    bool ok = read_clock(board, first);
+    board.run_us(2100000);
+    ok = ok && read_clock(board, last);
+    sim.usb().set_bus_ppm(0);
+
+    uint32_t frames = last.frames - first.frames;
+    double ppm = (static_cast<double>(last.sof_us - first.sof_us) / (frames * 1000.0) - 1.0) * 1e6;
+    report("start of frame clock", ok && frames > 2048 && std::abs(ppm + kBusPpm) < 5.0,
+           std::to_string(frames) + " frames, device " + std::to_string(ppm) + " ppm");
+}
+
+}  // namespace
+
+void scenario_serial(HostBoard& board) {
+    char expected[17];
+    std::snprintf(expected, sizeof(expected), "%016llX",
+                  static_cast<unsigned long long>(Simulator::instance().board_id()));
+    std::string serial = board.string_descriptor(3);
+    report("serial number is the unique id", serial == expected, serial);
+}
+
+int main() {
+    HostBoard& board = HostBoard::instance();
+    board.boot();
+    board.run_us(100);
+
+    scenario_serial(board);
+    scenario_moves(board, 2000);
+    scenario_moves(board, 250);
+    scenario_reversal(board);
+    scenario_bounce(board);
+    scenario_glitch(board);
+    scenario_scale(board);
+    scenario_split_request(board);
+    scenario_frames(board);
+    scenario_capture(board);
+    scenario_stream(board, Position::Format::COUNTS);
+    scenario_stream(board, Position::Format::COUNTS_DELTA);
+    scenario_stream(board, Position::Format::COUNTS_DELTA, true);
+    scenario_velocity(board);
+    scenario_report_on_change(board);
+    scenario_sampling(board);
+    scenario_perf_counters(board);
+    scenario_probe(board);
+    scenario_compare(board);
+    scenario_stored_settings(board);
+    scenario_clock(board);
+
+    std::printf("%s\n", failures == 0 ? "all scenarios passed" : "some scenarios failed");
+    return failures == 0 ? 0 : 1;
+}
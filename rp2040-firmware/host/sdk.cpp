@@ -0,0 +1,709 @@
+// Pico SDK functions used by the firmware, implemented on the simulator
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+
+#include "hardware/clocks.h"
+#include "hardware/dma.h"
+#include "hardware/flash.h"
+#include "hardware/gpio.h"
+#include "hardware/irq.h"
+#include "hardware/pio.h"
+#include "hardware/sync.h"
+#include "hardware/timer.h"
+#include "pico/flash.h"
+#include "pico/multicore.h"
+#include "pico/time.h"
+#include "pico/unique_id.h"
+#include "simulator.h"
+
+pio_hw_t host_pio_hw[NUM_PIOS] = {
+    {{{0, 0}, {0, 1}, {0, 2}, {0, 3}}, {{0, 0}, {0, 1}, {0, 2}, {0, 3}}, {0}, {0}},
+    {{{1, 0}, {1, 1}, {1, 2}, {1, 3}}, {{1, 0}, {1, 1}, {1, 2}, {1, 3}}, {1}, {1}},
+};
+
+namespace {
+
+Simulator& sim() {
+    return Simulator::instance();
+}
+
+PioBlock& block(PIO pio) {
+    return sim().pio(pio_get_index(pio));
+}
+
+void io_access() {
+    sim().charge(sim().cpu().io_access_cycles);
+}
+
+[[noreturn]] void unsupported(const char* what) {
+    std::fprintf(stderr, "simulator: %s is not emulated\n", what);
+    std::abort();
+}
+
+// Blocking SDK calls let simulated time pass; inside a handler that would
+// hang the real device too
+void wait_in_foreground(const char* what) {
+    if (sim().in_interrupt()) {
+        std::fprintf(stderr, "simulator: %s would block inside an interrupt handler\n", what);
+        std::abort();
+    }
+    sim().spend(1);
+}
+
+}  // namespace
+
+pio_fifo_reg::operator uint32_t() const {
+    io_access();
+    return sim().pio(pio_index).rx_pop(sm);
+}
+
+pio_fifo_reg& pio_fifo_reg::operator=(uint32_t value) {
+    io_access();
+    sim().pio(pio_index).tx_push(sm, value);
+    return *this;
+}
+
+pio_fdebug_reg::operator uint32_t() const {
+    io_access();
+    return sim().pio(pio_index).fdebug();
+}
+
+pio_fdebug_reg& pio_fdebug_reg::operator=(uint32_t value) {
+    io_access();
+    sim().pio(pio_index).clear_fdebug(value);
+    return *this;
+}
+
+pio_irq_reg::operator uint32_t() const {
+    io_access();
+    return sim().pio(pio_index).irq_flags_value();
+}
+
+pio_irq_reg& pio_irq_reg::operator=(uint32_t value) {
+    io_access();
+    sim().pio(pio_index).clear_irq_flags(value);
+    return *this;
+}
+
+void tight_loop_contents(void) {
+    sim().spend(1);
+}
+
+// Clocks and time
+
+uint32_t clock_get_hz(enum clock_index clk_index) {
+    return clk_index == clk_usb ? 48000000 : Simulator::kSysClockHz;
+}
+
+uint64_t time_us_64(void) {
+    io_access();
+    return sim().time_us();
+}
+
+uint32_t time_us_32(void) {
+    return static_cast<uint32_t>(time_us_64());
+}
+
+absolute_time_t get_absolute_time(void) {
+    return time_us_64();
+}
+
+uint32_t to_ms_since_boot(absolute_time_t t) {
+    return static_cast<uint32_t>(t / 1000);
+}
+
+uint64_t to_us_since_boot(absolute_time_t t) {
+    return t;
+}
+
+void busy_wait_us(uint64_t us) {
+    uint64_t end = sim().time_us() + us;
+    while (sim().time_us() < end) {
+        wait_in_foreground("busy_wait_us");
+    }
+}
+
+void busy_wait_us_32(uint32_t us) {
+    busy_wait_us(us);
+}
+
+void sleep_us(uint64_t us) {
+    busy_wait_us(us);
+}
+
+void sleep_ms(uint32_t ms) {
+    busy_wait_us(static_cast<uint64_t>(ms) * 1000);
+}
+
+alarm_pool_t* alarm_pool_get_default(void) {
+    return sim().default_pool();
+}
+
+alarm_pool_t* alarm_pool_create(uint hardware_alarm_num, uint max_timers) {
+    (void)max_timers;
+    return sim().create_pool(static_cast<int>(hardware_alarm_num));
+}
+
+alarm_pool_t* alarm_pool_create_with_unused_hardware_alarm(uint max_timers) {
+    (void)max_timers;
+    return sim().create_pool(-1);
+}
+
+bool alarm_pool_add_repeating_timer_us(alarm_pool_t* pool, int64_t delay_us, repeating_timer_callback_t callback,
+                                       void* user_data, repeating_timer_t* out) {
+    return sim().add_repeating_timer(pool, delay_us, callback, user_data, out);
+}
+
+bool add_repeating_timer_us(int64_t delay_us, repeating_timer_callback_t callback, void* user_data,
+                            repeating_timer_t* out) {
+    return sim().add_repeating_timer(sim().default_pool(), delay_us, callback, user_data, out);
+}
+
+bool add_repeating_timer_ms(int32_t delay_ms, repeating_timer_callback_t callback, void* user_data,
+                            repeating_timer_t* out) {
+    return add_repeating_timer_us(static_cast<int64_t>(delay_ms) * 1000, callback, user_data, out);
+}
+
+bool cancel_repeating_timer(repeating_timer_t* timer) {
+    return sim().cancel_repeating_timer(timer);
+}
+
+// Sync and multicore
+
+void __wfe(void) {
+    sim().spend(1);
+}
+
+void __wfi(void) {
+    sim().spend(1);
+}
+
+uint32_t save_and_disable_interrupts(void) {
+    return 0;
+}
+
+void restore_interrupts(uint32_t status) {
+    (void)status;
+}
+
+void multicore_launch_core1(void (*entry)(void)) {
+    (void)entry;
+    unsupported("core1");
+}
+
+void multicore_fifo_push_blocking(uint32_t data) {
+    (void)data;
+    unsupported("the multicore FIFO");
+}
+
+uint32_t multicore_fifo_pop_blocking(void) {
+    unsupported("the multicore FIFO");
+}
+
+// Flash
+
+uintptr_t host_flash_base(void) {
+    return reinterpret_cast<uintptr_t>(sim().flash());
+}
+
+void flash_range_erase(uint32_t flash_offs, size_t count) {
+    sim().flash_erase(flash_offs, count);
+}
+
+void flash_range_program(uint32_t flash_offs, const uint8_t* data, size_t count) {
+    sim().flash_program(flash_offs, data, count);
+}
+
+int flash_safe_execute(void (*func)(void*), void* param, uint32_t enter_exit_timeout_ms) {
+    (void)enter_exit_timeout_ms;
+    func(param);
+    return PICO_OK;
+}
+
+bool flash_safe_execute_core_init(void) {
+    return true;
+}
+
+// Unique ID
+
+void pico_get_unique_board_id(pico_unique_board_id_t* id_out) {
+    uint64_t id = Simulator::instance().board_id();
+    for (int i = 0; i < PICO_UNIQUE_BOARD_ID_SIZE_BYTES; i++) {
+        id_out->id[i] = static_cast<uint8_t>(id >> (8 * (PICO_UNIQUE_BOARD_ID_SIZE_BYTES - 1 - i)));
+    }
+}
+
+void pico_get_unique_board_id_string(char* id_out, uint len) {
+    pico_unique_board_id_t id;
+    pico_get_unique_board_id(&id);
+    uint n = 0;
+    for (int i = 0; i < PICO_UNIQUE_BOARD_ID_SIZE_BYTES && n + 2 < len; i++) {
+        n += std::snprintf(id_out + n, len - n, "%02X", id.id[i]);
+    }
+    if (len > 0) {
+        id_out[std::min(n, len - 1)] = '\0';
+    }
+}
+
+// GPIO
+
+void gpio_init(uint gpio) {
+    sim().gpio_init(gpio);
+}
+
+void gpio_set_function(uint gpio, enum gpio_function fn) {
+    sim().gpio_set_function(gpio, fn);
+}
+
+void gpio_set_dir(uint gpio, bool out) {
+    sim().gpio_set_dir(gpio, out);
+}
+
+void gpio_put(uint gpio, bool value) {
+    io_access();
+    sim().gpio_put(gpio, value);
+}
+
+bool gpio_get(uint gpio) {
+    io_access();
+    return sim().pad(gpio);
+}
+
+void gpio_set_pulls(uint gpio, bool up, bool down) {
+    (void)gpio;
+    (void)up;
+    (void)down;
+}
+
+void gpio_pull_up(uint gpio) {
+    gpio_set_pulls(gpio, true, false);
+}
+
+void gpio_pull_down(uint gpio) {
+    gpio_set_pulls(gpio, false, true);
+}
+
+void gpio_disable_pulls(uint gpio) {
+    gpio_set_pulls(gpio, false, false);
+}
+
+void gpio_set_irq_enabled(uint gpio, uint32_t event_mask, bool enabled) {
+    io_access();
+    sim().gpio_set_irq_enabled(gpio, event_mask, enabled);
+}
+
+uint32_t gpio_get_irq_event_mask(uint gpio) {
+    io_access();
+    return sim().gpio_irq_events(gpio);
+}
+
+void gpio_acknowledge_irq(uint gpio, uint32_t event_mask) {
+    io_access();
+    sim().gpio_acknowledge_irq(gpio, event_mask);
+}
+
+// IRQ
+
+void irq_set_exclusive_handler(uint num, irq_handler_t handler) {
+    sim().irq_set_handler(num, handler);
+}
+
+void irq_set_priority(uint num, uint8_t hardware_priority) {
+    sim().irq_set_priority(num, hardware_priority);
+}
+
+void irq_set_enabled(uint num, bool enabled) {
+    sim().irq_set_enabled(num, enabled);
+}
+
+bool irq_is_enabled(uint num) {
+    return sim().irq_is_enabled(num);
+}
+
+// DMA
+
+int dma_claim_unused_channel(bool required) {
+    return sim().dma_claim(required);
+}
+
+void dma_channel_unclaim(uint channel) {
+    sim().dma_unclaim(channel);
+}
+
+dma_channel_config dma_channel_get_default_config(uint channel) {
+    dma_channel_config c{};
+    c.size = DMA_SIZE_32;
+    c.read_increment = true;
+    c.write_increment = false;
+    c.dreq = DREQ_FORCE;
+    c.chain_to = channel;
+    c.high_priority = false;
+    c.enable = true;
+    return c;
+}
+
+void channel_config_set_transfer_data_size(dma_channel_config* c, enum dma_channel_transfer_size size) {
+    c->size = size;
+}
+
+void channel_config_set_read_increment(dma_channel_config* c, bool incr) {
+    c->read_increment = incr;
+}
+
+void channel_config_set_write_increment(dma_channel_config* c, bool incr) {
+    c->write_increment = incr;
+}
+
+void channel_config_set_dreq(dma_channel_config* c, uint dreq) {
+    c->dreq = dreq;
+}
+
+void channel_config_set_chain_to(dma_channel_config* c, uint chain_to) {
+    c->chain_to = chain_to;
+}
+
+void channel_config_set_high_priority(dma_channel_config* c, bool high_priority) {
+    c->high_priority = high_priority;
+}
+
+void dma_channel_configure(uint channel, const dma_channel_config* config, volatile void* write_addr,
+                           const volatile void* read_addr, uint transfer_count, bool trigger) {
+    sim().dma_configure(channel, *config, write_addr, read_addr, transfer_count, trigger);
+}
+
+void dma_channel_set_trans_count(uint channel, uint32_t trans_count, bool trigger) {
+    io_access();
+    sim().dma_set_count(channel, trans_count, trigger);
+}
+
+void dma_channel_start(uint channel) {
+    sim().dma_start(channel);
+}
+
+void dma_channel_abort(uint channel) {
+    sim().dma_abort(channel);
+}
+
+bool dma_channel_is_busy(uint channel) {
+    io_access();
+    return sim().dma_busy(channel);
+}
+
+// PIO
+
+uint pio_get_index(PIO pio) {
+    return pio == pio1 ? 1 : 0;
+}
+
+uint pio_get_dreq(PIO pio, uint sm, bool is_tx) {
+    return pio_get_index(pio) * 8 + (is_tx ? 0 : 4) + sm;
+}
+
+bool pio_can_add_program(PIO pio, const pio_program_t* program) {
+    int offset = 0;
+    return block(pio).can_add(program, offset);
+}
+
+uint pio_add_program(PIO pio, const pio_program_t* program) {
+    uint offset = block(pio).add(program);
+    if (offset == static_cast<uint>(-1)) {
+        std::fprintf(stderr, "simulator: no program space on pio%u\n", pio_get_index(pio));
+        std::abort();
+    }
+    return offset;
+}
+
+void pio_remove_program(PIO pio, const pio_program_t* program, uint loaded_offset) {
+    block(pio).remove(program, loaded_offset);
+}
+
+void pio_sm_claim(PIO pio, uint sm) {
+    if (!block(pio).claim(sm)) {
+        std::fprintf(stderr, "simulator: pio%u sm%u already claimed\n", pio_get_index(pio), sm);
+        std::abort();
+    }
+}
+
+int pio_claim_unused_sm(PIO pio, bool required) {
+    for (uint sm = 0; sm < NUM_PIO_STATE_MACHINES; sm++) {
+        if (block(pio).claim(sm)) {
+            return static_cast<int>(sm);
+        }
+    }
+    if (required) {
+        std::fprintf(stderr, "simulator: no free state machine on pio%u\n", pio_get_index(pio));
+        std::abort();
+    }
+    return -1;
+}
+
+void pio_sm_unclaim(PIO pio, uint sm) {
+    block(pio).unclaim(sm);
+}
+
+void pio_gpio_init(PIO pio, uint pin) {
+    sim().gpio_set_function(pin, pio == pio1 ? GPIO_FUNC_PIO1 : GPIO_FUNC_PIO0);
+}
+
+pio_sm_config pio_get_default_sm_config(void) {
+    pio_sm_config c{};
+    c.clkdiv_int = 1;
+    c.clkdiv_frac = 0;
+    c.wrap_target = 0;
+    c.wrap = 31;
+    c.in_shift_right = true;
+    c.push_threshold = 32;
+    c.out_shift_right = true;
+    c.pull_threshold = 32;
+    c.out_count = 32;
+    c.fifo_join = PIO_FIFO_JOIN_NONE;
+    return c;
+}
+
+void sm_config_set_in_pins(pio_sm_config* c, uint in_base) {
+    c->in_base = in_base;
+}
+
+void sm_config_set_out_pins(pio_sm_config* c, uint out_base, uint out_count) {
+    c->out_base = out_base;
+    c->out_count = out_count;
+}
+
+void sm_config_set_set_pins(pio_sm_config* c, uint set_base, uint set_count) {
+    c->set_base = set_base;
+    c->set_count = set_count;
+}
+
+void sm_config_set_sideset_pins(pio_sm_config* c, uint sideset_base) {
+    c->sideset_base = sideset_base;
+}
+
+void sm_config_set_sideset(pio_sm_config* c, uint bit_count, bool optional, bool pindirs) {
+    c->sideset_bits = bit_count;
+    c->sideset_opt = optional;
+    c->sideset_pindirs = pindirs;
+}
+
+void sm_config_set_jmp_pin(pio_sm_config* c, uint pin) {
+    c->jmp_pin = pin;
+}
+
+void sm_config_set_in_shift(pio_sm_config* c, bool shift_right, bool autopush, uint push_threshold) {
+    c->in_shift_right = shift_right;
+    c->autopush = autopush;
+    c->push_threshold = push_threshold == 0 ? 32 : push_threshold;
+}
+
+void sm_config_set_out_shift(pio_sm_config* c, bool shift_right, bool autopull, uint pull_threshold) {
+    c->out_shift_right = shift_right;
+    c->autopull = autopull;
+    c->pull_threshold = pull_threshold == 0 ? 32 : pull_threshold;
+}
+
+void sm_config_set_fifo_join(pio_sm_config* c, enum pio_fifo_join join) {
+    c->fifo_join = join;
+}
+
+void sm_config_set_clkdiv_int_frac(pio_sm_config* c, uint16_t div_int, uint8_t div_frac) {
+    c->clkdiv_int = div_int;
+    c->clkdiv_frac = div_frac;
+}
+
+void sm_config_set_clkdiv(pio_sm_config* c, float div) {
+    uint16_t div_int = static_cast<uint16_t>(div);
+    uint8_t div_frac = div_int == 0 ? 0 : static_cast<uint8_t>((div - div_int) * 256);
+    sm_config_set_clkdiv_int_frac(c, div_int, div_frac);
+}
+
+void sm_config_set_wrap(pio_sm_config* c, uint wrap_target, uint wrap) {
+    c->wrap_target = wrap_target;
+    c->wrap = wrap;
+}
+
+void pio_sm_init(PIO pio, uint sm, uint initial_pc, const pio_sm_config* config) {
+    block(pio).init(sm, initial_pc, *config);
+}
+
+void pio_sm_set_enabled(PIO pio, uint sm, bool enabled) {
+    io_access();
+    block(pio).set_enabled(sm, enabled);
+}
+
+void pio_enable_sm_mask_in_sync(PIO pio, uint32_t mask) {
+    io_access();
+    for (uint sm = 0; sm < NUM_PIO_STATE_MACHINES; sm++) {
+        if (mask & (1u << sm)) {
+            block(pio).set_enabled(sm, true);
+        }
+    }
+}
+
+void pio_sm_restart(PIO pio, uint sm) {
+    block(pio).restart(sm);
+}
+
+void pio_sm_exec(PIO pio, uint sm, uint instr) {
+    io_access();
+    block(pio).exec(sm, static_cast<uint16_t>(instr));
+}
+
+uint pio_sm_get_pc(PIO pio, uint sm) {
+    return block(pio).get_pc(sm);
+}
+
+void pio_sm_set_clkdiv_int_frac(PIO pio, uint sm, uint16_t div_int, uint8_t div_frac) {
+    block(pio).set_clkdiv(sm, div_int, div_frac);
+}
+
+void pio_sm_set_clkdiv(PIO pio, uint sm, float div) {
+    pio_sm_config c{};
+    sm_config_set_clkdiv(&c, div);
+    pio_sm_set_clkdiv_int_frac(pio, sm, c.clkdiv_int, c.clkdiv_frac);
+}
+
+void pio_sm_clkdiv_restart(PIO pio, uint sm) {
+    (void)pio;
+    (void)sm;
+}
+
+void pio_sm_set_consecutive_pindirs(PIO pio, uint sm, uint pin_base, uint pin_count, bool is_out) {
+    uint32_t mask = 0;
+    for (uint i = 0; i < pin_count; i++) {
+        mask |= 1u << ((pin_base + i) % 32);
+    }
+    block(pio).set_pindirs(sm, is_out ? mask : 0, mask);
+}
+
+void pio_sm_set_pins_with_mask(PIO pio, uint sm, uint32_t pin_values, uint32_t pin_mask) {
+    block(pio).set_pins(sm, pin_values, pin_mask);
+}
+
+void pio_sm_set_pindirs_with_mask(PIO pio, uint sm, uint32_t pin_dirs, uint32_t pin_mask) {
+    block(pio).set_pindirs(sm, pin_dirs, pin_mask);
+}
+
+void pio_sm_clear_fifos(PIO pio, uint sm) {
+    block(pio).clear_fifos(sm);
+}
+
+bool pio_sm_is_rx_fifo_empty(PIO pio, uint sm) {
+    io_access();
+    return block(pio).rx_level(sm) == 0;
+}
+
+bool pio_sm_is_rx_fifo_full(PIO pio, uint sm) {
+    io_access();
+    return block(pio).rx_full(sm);
+}
+
+uint pio_sm_get_rx_fifo_level(PIO pio, uint sm) {
+    io_access();
+    return block(pio).rx_level(sm);
+}
+
+bool pio_sm_is_tx_fifo_empty(PIO pio, uint sm) {
+    io_access();
+    return block(pio).tx_level(sm) == 0;
+}
+
+bool pio_sm_is_tx_fifo_full(PIO pio, uint sm) {
+    io_access();
+    return block(pio).tx_full(sm);
+}
+
+uint pio_sm_get_tx_fifo_level(PIO pio, uint sm) {
+    io_access();
+    return block(pio).tx_level(sm);
+}
+
+void pio_sm_put(PIO pio, uint sm, uint32_t data) {
+    pio->txf[sm] = data;
+}
+
+void pio_sm_put_blocking(PIO pio, uint sm, uint32_t data) {
+    while (block(pio).tx_full(sm) && sim().is_pio_clocked()) {
+        wait_in_foreground("pio_sm_put_blocking");
+    }
+    pio_sm_put(pio, sm, data);
+}
+
+uint32_t pio_sm_get(PIO pio, uint sm) {
+    return pio->rxf[sm];
+}
+
+uint32_t pio_sm_get_blocking(PIO pio, uint sm) {
+    while (block(pio).rx_level(sm) == 0) {
+        wait_in_foreground("pio_sm_get_blocking");
+    }
+    return pio_sm_get(pio, sm);
+}
+
+void pio_set_irqn_source_enabled(PIO pio, uint irq_index, enum pio_interrupt_source source, bool enabled) {
+    block(pio).set_irq_source_enabled(irq_index, source, enabled);
+}
+
+void pio_set_irq0_source_enabled(PIO pio, enum pio_interrupt_source source, bool enabled) {
+    pio_set_irqn_source_enabled(pio, 0, source, enabled);
+}
+
+void pio_set_irq1_source_enabled(PIO pio, enum pio_interrupt_source source, bool enabled) {
+    pio_set_irqn_source_enabled(pio, 1, source, enabled);
+}
+
+bool pio_interrupt_get(PIO pio, uint pio_interrupt_num) {
+    io_access();
+    return block(pio).irq_flag(pio_interrupt_num);
+}
+
+void pio_interrupt_clear(PIO pio, uint pio_interrupt_num) {
+    io_access();
+    block(pio).clear_irq_flag(pio_interrupt_num);
+}
+
+// Instruction encoding, as in hardware/pio_instructions.h
+
+namespace {
+
+uint encode(uint opcode, uint arg1, uint arg2) {
+    return (opcode << 13) | ((arg1 & 7) << 5) | (arg2 & 31);
+}
+
+}  // namespace
+
+uint pio_encode_jmp(uint addr) {
+    return encode(0, 0, addr);
+}
+
+uint pio_encode_in(enum pio_src_dest src, uint count) {
+    return encode(2, src, count & 31);
+}
+
+uint pio_encode_out(enum pio_src_dest dest, uint count) {
+    return encode(3, dest, count & 31);
+}
+
+uint pio_encode_push(bool if_full, bool block) {
+    return encode(4, 0, 0) | (if_full ? 0x40 : 0) | (block ? 0x20 : 0);
+}
+
+uint pio_encode_pull(bool if_empty, bool block) {
+    return encode(4, 0, 0) | 0x80 | (if_empty ? 0x40 : 0) | (block ? 0x20 : 0);
+}
+
+uint pio_encode_mov(enum pio_src_dest dest, enum pio_src_dest src) {
+    return encode(5, dest, src & 7);
+}
+
+uint pio_encode_mov_not(enum pio_src_dest dest, enum pio_src_dest src) {
+    return encode(5, dest, (1u << 3) | (src & 7));
+}
+
+uint pio_encode_set(enum pio_src_dest dest, uint value) {
+    return encode(7, dest, value);
+}
+
+uint pio_encode_nop(void) {
+    return pio_encode_mov(pio_y, pio_y);
+}
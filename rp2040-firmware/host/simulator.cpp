@@ -0,0 +1,629 @@
+#include "simulator.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "tusb.h"
+
+struct alarm_pool {
+    uint hardware_alarm;
+};
+
+namespace {
+
+// The SDK's default alarm pool uses the last hardware alarm
+constexpr uint kDefaultHardwareAlarm = 3;
+constexpr uint kNumHardwareAlarms = 4;
+
+}  // namespace
+
+Simulator& Simulator::instance() {
+    static Simulator simulator;
+    return simulator;
+}
+
+Simulator::Simulator() : pio_blocks{PioBlock(0), PioBlock(1)} {
+    reset();
+}
+
+void Simulator::reset() {
+    now = 0;
+    busy_until = 0;
+    entering_irq = -1;
+    in_handler = false;
+    handler_cycles = 0;
+    irq_busy_cycles = 0;
+    irqs_taken = 0;
+
+    func_sio = func_pio0 = func_pio1 = 0;
+    sio_oe = sio_out = 0;
+    input_levels = 0;
+    gpio_irq_enabled_events = {};
+    gpio_edge_events = {};
+    gpio_irq_pins = 0;
+
+    for (PioBlock& block : pio_blocks) {
+        block.reset();
+        block.set_pin_reader(read_pads);
+    }
+    pio_clocked = true;
+
+    irq_handlers = {};
+    irq_priorities.fill(PICO_DEFAULT_IRQ_PRIORITY);
+    irq_enabled = 0;
+    timer_irq_pending = 0;
+
+    dma_channels = {};
+    dma_active = false;
+
+    for (alarm_pool_t* pool : pools) {
+        delete pool;
+    }
+    pools.clear();
+    timers.clear();
+    events.clear();
+    next_timer_us = UINT64_MAX;
+
+    usb_pipe = UsbPipe();
+}
+
+uint32_t Simulator::read_pads() {
+    return instance().pads();
+}
+
+uint32_t Simulator::pads() const {
+    uint32_t pio0_drive = func_pio0 & pio_blocks[0].pin_dirs();
+    uint32_t pio1_drive = func_pio1 & pio_blocks[1].pin_dirs();
+    uint32_t sio_drive = func_sio & sio_oe;
+    uint32_t driven = pio0_drive | pio1_drive | sio_drive;
+    return (input_levels & ~driven) | (pio_blocks[0].pin_values() & pio0_drive) |
+           (pio_blocks[1].pin_values() & pio1_drive) | (sio_out & sio_drive);
+}
+
+void Simulator::set_input(uint pin, bool level) {
+    bool was = pad(pin);
+    if (level) {
+        input_levels |= 1u << pin;
+    } else {
+        input_levels &= ~(1u << pin);
+    }
+    if (pad(pin) != was) {
+        gpio_edge_events[pin] |= pad(pin) ? GPIO_IRQ_EDGE_RISE : GPIO_IRQ_EDGE_FALL;
+    }
+}
+
+void Simulator::gpio_set_irq_enabled(uint pin, uint32_t events, bool enabled) {
+    // Like the SDK, enabling clears edges that latched before
+    gpio_edge_events[pin] &= ~events;
+    if (enabled) {
+        gpio_irq_enabled_events[pin] |= events;
+    } else {
+        gpio_irq_enabled_events[pin] &= ~events;
+    }
+    if (gpio_irq_enabled_events[pin] != 0) {
+        gpio_irq_pins |= 1u << pin;
+    } else {
+        gpio_irq_pins &= ~(1u << pin);
+    }
+}
+
+uint32_t Simulator::gpio_irq_events(uint pin) const {
+    uint32_t level = pad(pin) ? GPIO_IRQ_LEVEL_HIGH : GPIO_IRQ_LEVEL_LOW;
+    return (gpio_edge_events[pin] | level) & gpio_irq_enabled_events[pin];
+}
+
+void Simulator::gpio_acknowledge_irq(uint pin, uint32_t events) {
+    gpio_edge_events[pin] &= ~events;
+}
+
+void Simulator::gpio_init(uint pin) {
+    gpio_set_dir(pin, false);
+    gpio_put(pin, false);
+    gpio_set_function(pin, GPIO_FUNC_SIO);
+}
+
+void Simulator::gpio_set_function(uint pin, gpio_function function) {
+    uint32_t bit = 1u << pin;
+    func_sio &= ~bit;
+    func_pio0 &= ~bit;
+    func_pio1 &= ~bit;
+    if (function == GPIO_FUNC_SIO) {
+        func_sio |= bit;
+    } else if (function == GPIO_FUNC_PIO0) {
+        func_pio0 |= bit;
+    } else if (function == GPIO_FUNC_PIO1) {
+        func_pio1 |= bit;
+    }
+}
+
+void Simulator::gpio_set_dir(uint pin, bool out) {
+    if (out) {
+        sio_oe |= 1u << pin;
+    } else {
+        sio_oe &= ~(1u << pin);
+    }
+}
+
+void Simulator::gpio_put(uint pin, bool value) {
+    if (value) {
+        sio_out |= 1u << pin;
+    } else {
+        sio_out &= ~(1u << pin);
+    }
+}
+
+void Simulator::advance(uint64_t count) {
+    uint64_t end = now + count;
+    while (now < end) {
+        skip_idle(end);
+        tick();
+    }
+}
+
+void Simulator::spend(uint64_t count) {
+    if (in_handler) {
+        handler_cycles += count;
+        return;
+    }
+    while (count > 0) {
+        uint64_t before = now;
+        skip_idle(now + count);
+        count -= now - before;
+        tick();
+        if (now >= busy_until && entering_irq < 0) {
+            count--;
+        }
+    }
+}
+
+// Moves the clock to just before the next cycle that can change anything,
+// at most to end - 1, so that the following tick() handles it
+void Simulator::skip_idle(uint64_t end) {
+    if (now < busy_until || entering_irq >= 0 || pending_irqs() != 0) {
+        return;
+    }
+    for (const PioBlock& block : pio_blocks) {
+        if (pio_clocked && block.any_enabled()) {
+            return;
+        }
+    }
+    for (const DmaChannel& ch : dma_channels) {
+        if (ch.busy && dma_ready(ch.config.dreq)) {
+            return;
+        }
+    }
+    uint64_t wake = end;
+    if (!events.empty()) {
+        wake = std::min(wake, events.begin()->first);
+    }
+    if (next_timer_us != UINT64_MAX) {
+        wake = std::min(wake, next_timer_us * kCyclesPerUs);
+    }
+    if (wake > now + 1) {
+        now = wake - 1;
+    }
+}
+
+void Simulator::charge(uint32_t count) {
+    spend(count);
+}
+
+void Simulator::tick() {
+    now++;
+    for (PioBlock& block : pio_blocks) {
+        if (pio_clocked && block.any_enabled()) {
+            block.clock();
+        }
+    }
+    if (dma_active) {
+        run_dma();
+    }
+    if (!events.empty() && events.begin()->first <= now) {
+        run_events();
+    }
+    if (now / kCyclesPerUs >= next_timer_us) {
+        run_timers();
+    }
+    dispatch_irqs();
+}
+
+void Simulator::run_events() {
+    // An event may schedule the next one, possibly for this very cycle
+    while (!events.empty() && events.begin()->first <= now) {
+        Event event = std::move(events.begin()->second);
+        events.erase(events.begin());
+        event();
+    }
+}
+
+void Simulator::irq_set_enabled(uint num, bool enabled) {
+    if (enabled) {
+        irq_enabled |= 1u << num;
+    } else {
+        irq_enabled &= ~(1u << num);
+    }
+}
+
+uint32_t Simulator::pending_irqs() const {
+    uint32_t pending = 0;
+    for (uint b = 0; b < NUM_PIOS; b++) {
+        for (uint i = 0; i < 2; i++) {
+            if (pio_blocks[b].irq_line(i)) {
+                pending |= 1u << (PIO0_IRQ_0 + 2 * b + i);
+            }
+        }
+    }
+    for (uint pin = 0; gpio_irq_pins >> pin; pin++) {
+        if ((gpio_irq_pins >> pin) & 1 && gpio_irq_events(pin) != 0) {
+            pending |= 1u << IO_IRQ_BANK0;
+            break;
+        }
+    }
+    // The alarm pools enable their own interrupts
+    return (pending & irq_enabled) | timer_irq_pending;
+}
+
+void Simulator::dispatch_irqs() {
+    if (now < busy_until) {
+        return;
+    }
+
+    if (entering_irq >= 0) {
+        // Exception entry is done, run the handler body
+        uint num = static_cast<uint>(entering_irq);
+        entering_irq = -1;
+        run_handler(num);
+        return;
+    }
+
+    uint32_t pending = pending_irqs();
+    if (pending == 0) {
+        return;
+    }
+
+    uint best = 0;
+    uint best_priority = 0x100;
+    for (uint num = 0; num < NUM_IRQS; num++) {
+        if ((pending >> num) & 1 && irq_priorities[num] < best_priority) {
+            best = num;
+            best_priority = irq_priorities[num];
+        }
+    }
+
+    entering_irq = static_cast<int>(best);
+    busy_until = now + cpu_model.irq_entry_cycles;
+    irq_busy_cycles += cpu_model.irq_entry_cycles;
+    irqs_taken++;
+}
+
+void Simulator::run_handler(uint num) {
+    in_handler = true;
+    handler_cycles = 0;
+
+    if (num < kNumHardwareAlarms && (timer_irq_pending >> num) & 1) {
+        timer_irq_pending &= ~(1u << num);
+        uint64_t now_us = time_us();
+        // Callbacks may add or cancel timers, work on a copy
+        std::vector<Timer> due;
+        for (const Timer& t : timers) {
+            if (t.timer->pool->hardware_alarm == num && t.due_us <= now_us) {
+                due.push_back(t);
+            }
+        }
+        for (const Timer& t : due) {
+            auto it = std::find_if(timers.begin(), timers.end(),
+                                   [&](const Timer& other) { return other.timer == t.timer; });
+            if (it == timers.end()) {
+                continue;
+            }
+            repeating_timer_t* rt = t.timer;
+            bool again = rt->callback(rt);
+            it = std::find_if(timers.begin(), timers.end(),
+                              [&](const Timer& other) { return other.timer == rt; });
+            if (it == timers.end()) {
+                continue;
+            }
+            if (!again) {
+                timers.erase(it);
+                continue;
+            }
+            // Negative delays are measured from the previous target
+            if (rt->delay_us < 0) {
+                it->due_us = t.due_us + static_cast<uint64_t>(-rt->delay_us);
+            } else {
+                it->due_us = now_us + static_cast<uint64_t>(rt->delay_us);
+            }
+        }
+        update_next_timer();
+    } else if (irq_handlers[num] != nullptr) {
+        irq_handlers[num]();
+    }
+
+    in_handler = false;
+    uint64_t cost = cpu_model.irq_body_cycles + handler_cycles + cpu_model.irq_exit_cycles;
+    busy_until = now + cost;
+    irq_busy_cycles += cost;
+}
+
+int Simulator::dma_claim(bool required) {
+    for (uint channel = 0; channel < NUM_DMA_CHANNELS; channel++) {
+        if (!dma_channels[channel].claimed) {
+            dma_channels[channel].claimed = true;
+            return static_cast<int>(channel);
+        }
+    }
+    if (required) {
+        std::fprintf(stderr, "simulator: no free DMA channel\n");
+        std::abort();
+    }
+    return -1;
+}
+
+void Simulator::dma_configure(uint channel, const dma_channel_config& config, volatile void* write_addr,
+                              const volatile void* read_addr, uint32_t count, bool trigger) {
+    DmaChannel& ch = dma_channels[channel];
+    ch.config = config;
+    ch.write_addr = reinterpret_cast<uintptr_t>(write_addr);
+    ch.read_addr = reinterpret_cast<uintptr_t>(read_addr);
+    ch.count = count;
+    if (trigger) {
+        dma_start(channel);
+    }
+    dma_active = true;
+}
+
+void Simulator::dma_set_count(uint channel, uint32_t count, bool trigger) {
+    dma_channels[channel].count = count;
+    if (trigger) {
+        dma_start(channel);
+    }
+    dma_active = true;
+}
+
+void Simulator::dma_start(uint channel) {
+    DmaChannel& ch = dma_channels[channel];
+    ch.remaining = ch.count;
+    ch.busy = ch.count > 0;
+    dma_active = dma_active || ch.busy;
+}
+
+bool Simulator::dma_ready(uint dreq) const {
+    if (dreq == DREQ_FORCE) {
+        return true;
+    }
+    uint block = dreq / 8;
+    uint sm = dreq % 4;
+    if (block >= NUM_PIOS) {
+        return false;
+    }
+    bool is_rx = (dreq % 8) >= 4;
+    const PioBlock& pio = pio_blocks[block];
+    return is_rx ? pio.rx_level(sm) > 0 : !pio.tx_full(sm);
+}
+
+uint32_t Simulator::dma_read(uintptr_t addr, dma_channel_transfer_size size) {
+    for (uint b = 0; b < NUM_PIOS; b++) {
+        for (uint sm = 0; sm < NUM_PIO_STATE_MACHINES; sm++) {
+            if (addr == reinterpret_cast<uintptr_t>(&host_pio_hw[b].rxf[sm])) {
+                return pio_blocks[b].rx_pop(sm);
+            }
+        }
+    }
+    uint32_t value = 0;
+    std::memcpy(&value, reinterpret_cast<const void*>(addr), 1u << size);
+    return value;
+}
+
+void Simulator::dma_write(uintptr_t addr, uint32_t value, dma_channel_transfer_size size) {
+    for (uint b = 0; b < NUM_PIOS; b++) {
+        for (uint sm = 0; sm < NUM_PIO_STATE_MACHINES; sm++) {
+            if (addr == reinterpret_cast<uintptr_t>(&host_pio_hw[b].txf[sm])) {
+                pio_blocks[b].tx_push(sm, value);
+                return;
+            }
+        }
+    }
+    std::memcpy(reinterpret_cast<void*>(addr), &value, 1u << size);
+}
+
+void Simulator::run_dma() {
+    bool any_busy = false;
+    // One transfer per cycle across all channels, like the single bus master
+    for (DmaChannel& ch : dma_channels) {
+        if (!ch.busy) {
+            continue;
+        }
+        any_busy = true;
+        if (!dma_ready(ch.config.dreq)) {
+            continue;
+        }
+        uint32_t value = dma_read(ch.read_addr, ch.config.size);
+        dma_write(ch.write_addr, value, ch.config.size);
+        uint32_t step = 1u << ch.config.size;
+        if (ch.config.read_increment) {
+            ch.read_addr += step;
+        }
+        if (ch.config.write_increment) {
+            ch.write_addr += step;
+        }
+        if (--ch.remaining == 0) {
+            ch.busy = false;
+        }
+        break;
+    }
+    dma_active = any_busy;
+}
+
+alarm_pool_t* Simulator::default_pool() {
+    for (alarm_pool_t* pool : pools) {
+        if (pool->hardware_alarm == kDefaultHardwareAlarm) {
+            return pool;
+        }
+    }
+    return create_pool(kDefaultHardwareAlarm);
+}
+
+alarm_pool_t* Simulator::create_pool(int hardware_alarm) {
+    if (hardware_alarm < 0) {
+        uint32_t used = 1u << kDefaultHardwareAlarm;
+        for (alarm_pool_t* pool : pools) {
+            used |= 1u << pool->hardware_alarm;
+        }
+        for (uint alarm = 0; alarm < kNumHardwareAlarms; alarm++) {
+            if (!((used >> alarm) & 1)) {
+                hardware_alarm = static_cast<int>(alarm);
+                break;
+            }
+        }
+        if (hardware_alarm < 0) {
+            std::fprintf(stderr, "simulator: no free hardware alarm\n");
+            std::abort();
+        }
+    }
+    alarm_pool_t* pool = new alarm_pool_t{static_cast<uint>(hardware_alarm)};
+    pools.push_back(pool);
+    return pool;
+}
+
+bool Simulator::add_repeating_timer(alarm_pool_t* pool, int64_t delay_us, repeating_timer_callback_t callback,
+                                    void* user_data, repeating_timer_t* out) {
+    if (delay_us == 0) {
+        delay_us = 1;
+    }
+    out->delay_us = delay_us;
+    out->pool = pool;
+    out->alarm_id = static_cast<int32_t>(timers.size() + 1);
+    out->callback = callback;
+    out->user_data = user_data;
+
+    uint64_t period = static_cast<uint64_t>(delay_us < 0 ? -delay_us : delay_us);
+    timers.push_back(Timer{out, time_us() + period});
+    update_next_timer();
+    return true;
+}
+
+bool Simulator::cancel_repeating_timer(repeating_timer_t* timer) {
+    auto it = std::find_if(timers.begin(), timers.end(), [&](const Timer& t) { return t.timer == timer; });
+    if (it == timers.end()) {
+        return false;
+    }
+    timers.erase(it);
+    update_next_timer();
+    return true;
+}
+
+void Simulator::update_next_timer() {
+    next_timer_us = UINT64_MAX;
+    for (const Timer& t : timers) {
+        next_timer_us = std::min(next_timer_us, t.due_us);
+    }
+}
+
+void Simulator::run_timers() {
+    uint64_t now_us = time_us();
+    for (const Timer& t : timers) {
+        if (t.due_us <= now_us) {
+            timer_irq_pending |= 1u << t.timer->pool->hardware_alarm;
+        }
+    }
+    // Raised again once the handler has rescheduled the timers
+    next_timer_us = UINT64_MAX;
+}
+
+void Simulator::flash_erase(uint32_t offset, size_t count) {
+    if (offset % FLASH_SECTOR_SIZE != 0 || count % FLASH_SECTOR_SIZE != 0 || offset + count > flash_memory.size()) {
+        std::fprintf(stderr, "simulator: flash erase of %zu bytes at 0x%x is not sector aligned\n", count, offset);
+        std::abort();
+    }
+    std::fill_n(flash_memory.begin() + offset, count, 0xFF);
+}
+
+void Simulator::flash_program(uint32_t offset, const uint8_t* data, size_t count) {
+    if (offset % FLASH_PAGE_SIZE != 0 || count % FLASH_PAGE_SIZE != 0 || offset + count > flash_memory.size()) {
+        std::fprintf(stderr, "simulator: flash program of %zu bytes at 0x%x is not page aligned\n", count, offset);
+        std::abort();
+    }
+    for (size_t i = 0; i < count; i++) {
+        flash_memory[offset + i] &= data[i];
+    }
+}
+
+void Simulator::wipe_flash() {
+    std::fill(flash_memory.begin(), flash_memory.end(), 0xFF);
+}
+
+void Simulator::UsbPipe::set_mounted(bool new_mounted) {
+    bool was_mounted = mounted;
+    mounted = new_mounted;
+    if (was_mounted && !mounted) {
+        out_bytes.clear();
+        tx_fifo.clear();
+        tud_umount_cb();
+    }
+}
+
+bool Simulator::UsbPipe::device_sof(uint64_t now_us, uint32_t& frame_number) {
+    uint64_t frame = now_us * static_cast<uint64_t>(1000000 + bus_ppm) / 1000000000;
+    if (!sof_enabled || !mounted || frame == last_frame) {
+        return false;
+    }
+    last_frame = frame;
+    frame_number = static_cast<uint32_t>(frame & 0x7FF);
+    return true;
+}
+
+void Simulator::UsbPipe::send(const std::vector<uint8_t>& data) {
+    out_bytes.insert(out_bytes.end(), data.begin(), data.end());
+}
+
+bool Simulator::UsbPipe::receive(std::vector<uint8_t>& transfer, size_t max_length) {
+    // Only complete transfers are handed out
+    size_t packets = 0;
+    size_t length = 0;
+    bool complete = false;
+    while (packets < in_packets.size() && !complete) {
+        length += in_packets[packets].size();
+        complete = in_packets[packets].size() < kMaxPacketSize || length >= max_length;
+        packets++;
+    }
+    if (!complete) {
+        return false;
+    }
+
+    transfer.clear();
+    for (size_t i = 0; i < packets; i++) {
+        transfer.insert(transfer.end(), in_packets.front().begin(), in_packets.front().end());
+        in_packets.pop_front();
+    }
+    return true;
+}
+
+uint32_t Simulator::UsbPipe::device_read(uint8_t* buffer, uint32_t size) {
+    uint32_t count = 0;
+    while (count < size && !out_bytes.empty()) {
+        buffer[count++] = out_bytes.front();
+        out_bytes.pop_front();
+    }
+    return count;
+}
+
+uint32_t Simulator::UsbPipe::device_write(const uint8_t* data, uint32_t size) {
+    uint32_t count = std::min(size, device_write_available());
+    tx_fifo.insert(tx_fifo.end(), data, data + count);
+    return count;
+}
+
+uint32_t Simulator::UsbPipe::device_write_available() const {
+    return CFG_TUD_VENDOR_TX_BUFSIZE - static_cast<uint32_t>(tx_fifo.size());
+}
+
+void Simulator::UsbPipe::device_flush() {
+    // Everything queued goes out as full packets, then a short one
+    for (size_t offset = 0; offset < tx_fifo.size(); offset += kMaxPacketSize) {
+        size_t end = std::min(offset + kMaxPacketSize, tx_fifo.size());
+        in_packets.emplace_back(tx_fifo.begin() + offset, tx_fifo.begin() + end);
+    }
+    tx_fifo.clear();
+}
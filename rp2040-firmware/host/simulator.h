@@ -0,0 +1,244 @@
+#ifndef SIMULATOR_H_
+#define SIMULATOR_H_
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <vector>
+
+#include "hardware/dma.h"
+#include "hardware/flash.h"
+#include "hardware/gpio.h"
+#include "hardware/irq.h"
+#include "pio_emulator.h"
+#include "pico/time.h"
+
+// Cycle-approximate model of the parts of an RP2040 the firmware touches:
+// the system clock, GPIO pads, both PIO blocks, DMA, the NVIC, the alarm
+// timers and the vendor USB interface. The stand-in SDK functions in sdk.cpp
+// and tusb.cpp forward here.
+//
+// Time only moves when hardware is clocked. Firmware code running in the
+// foreground pays for what it does through charge(). An interrupt handler
+// runs to completion once the modelled exception entry has elapsed, and the
+// CPU stays busy for its modelled cost afterwards. That is enough to
+// reproduce FIFO overruns and to estimate the CPU load of the counting path.
+class Simulator {
+ public:
+    static constexpr uint32_t kSysClockHz = 125000000;
+    static constexpr uint32_t kCyclesPerUs = kSysClockHz / 1000000;
+    static constexpr size_t kNumGpios = NUM_BANK0_GPIOS;
+
+    // Cortex-M0+ figures: exception entry and return with the stack
+    // pushes, plus a rough cost for the compiled handler prologue and body
+    struct CpuModel {
+        uint32_t irq_entry_cycles = 16;
+        uint32_t irq_exit_cycles = 12;
+        uint32_t irq_body_cycles = 40;
+        uint32_t io_access_cycles = 3;
+    };
+
+    // Host side of the vendor interface
+    class UsbPipe {
+     public:
+        void set_mounted(bool mounted);
+        [[nodiscard]] bool is_mounted() const { return mounted; }
+
+        // Host to device, one OUT transfer
+        void send(const std::vector<uint8_t>& data);
+        // Device to host, one IN transfer into a buffer of max_length
+        // bytes. Like a bulk transfer it ends on a short packet or when the
+        // buffer is full.
+        static constexpr size_t kMaxPacketSize = 64;
+        [[nodiscard]] bool receive(std::vector<uint8_t>& transfer, size_t max_length = 4 * kMaxPacketSize);
+        [[nodiscard]] size_t pending_in() const { return in_packets.size(); }
+        // A start of frame every millisecond of bus time while mounted.
+        // The bus clock runs this much faster than the device clock.
+        void set_bus_ppm(int32_t ppm) { bus_ppm = ppm; }
+
+        // Called by the TinyUSB stand-in
+        uint32_t device_available() const { return static_cast<uint32_t>(out_bytes.size()); }
+        uint32_t device_read(uint8_t* buffer, uint32_t size);
+        uint32_t device_write(const uint8_t* data, uint32_t size);
+        uint32_t device_write_available() const;
+        void device_flush();
+        void device_sof_enable(bool enabled) { sof_enabled = enabled; }
+        // True once per new frame, with its 11 bit number
+        [[nodiscard]] bool device_sof(uint64_t now_us, uint32_t& frame_number);
+
+     private:
+        bool mounted = true;
+        bool sof_enabled = false;
+        int32_t bus_ppm = 0;
+        uint64_t last_frame = UINT64_MAX;
+        std::deque<uint8_t> out_bytes;
+        std::vector<uint8_t> tx_fifo;
+        std::deque<std::vector<uint8_t>> in_packets;
+    };
+
+    static Simulator& instance();
+
+    void reset();
+
+    // Clock
+    [[nodiscard]] uint64_t cycles() const { return now; }
+    [[nodiscard]] uint64_t time_us() const { return now / kCyclesPerUs; }
+
+    // Stops clocking the PIO blocks, for runs that never move the encoder
+    // inputs. While nothing else is due, time then jumps to the next event,
+    // timer or interrupt instead of ticking through every cycle, which runs
+    // the firmware faster than real time. A blocking write to a full TX
+    // FIFO drops the word then, nothing would ever make room.
+    void set_pio_clocked(bool clocked) { pio_clocked = clocked; }
+    [[nodiscard]] bool is_pio_clocked() const { return pio_clocked; }
+
+    // Runs the hardware for a number of cycles while the CPU is idle
+    void advance(uint64_t count);
+    void advance_us(uint64_t us) { advance(us * kCyclesPerUs); }
+    // Runs until the CPU has spent count cycles outside interrupt handlers
+    void spend(uint64_t count);
+    // Accounts CPU time for an operation, in a handler or the foreground
+    void charge(uint32_t count);
+    [[nodiscard]] bool in_interrupt() const { return in_handler; }
+
+    CpuModel& cpu() { return cpu_model; }
+    // Cycles the CPU spent in interrupt handlers
+    [[nodiscard]] uint64_t irq_cycles() const { return irq_busy_cycles; }
+    [[nodiscard]] uint64_t irq_count() const { return irqs_taken; }
+
+    // GPIO pads. External levels model what is wired to the pins; the pad
+    // follows an output when SIO or the selected PIO drives it.
+    void set_input(uint pin, bool level);
+    [[nodiscard]] uint32_t pads() const;
+    [[nodiscard]] bool pad(uint pin) const { return (pads() >> pin) & 1; }
+    void gpio_init(uint pin);
+    void gpio_set_function(uint pin, gpio_function function);
+    void gpio_set_dir(uint pin, bool out);
+    void gpio_put(uint pin, bool value);
+    // Edge events latch until acknowledged, level events follow the pad.
+    // Only edges of external inputs set through set_input() are seen.
+    void gpio_set_irq_enabled(uint pin, uint32_t events, bool enabled);
+    [[nodiscard]] uint32_t gpio_irq_events(uint pin) const;
+    void gpio_acknowledge_irq(uint pin, uint32_t events);
+
+    PioBlock& pio(uint index) { return pio_blocks[index]; }
+
+    // NVIC
+    void irq_set_handler(uint num, irq_handler_t handler) { irq_handlers[num] = handler; }
+    void irq_set_priority(uint num, uint8_t priority) { irq_priorities[num] = priority; }
+    void irq_set_enabled(uint num, bool enabled);
+    [[nodiscard]] bool irq_is_enabled(uint num) const { return (irq_enabled >> num) & 1; }
+
+    // DMA
+    int dma_claim(bool required);
+    void dma_unclaim(uint channel) { dma_channels[channel].claimed = false; }
+    void dma_configure(uint channel, const dma_channel_config& config, volatile void* write_addr,
+                       const volatile void* read_addr, uint32_t count, bool trigger);
+    void dma_set_count(uint channel, uint32_t count, bool trigger);
+    void dma_start(uint channel);
+    void dma_abort(uint channel) { dma_channels[channel].busy = false; }
+    [[nodiscard]] bool dma_busy(uint channel) const { return dma_channels[channel].busy; }
+
+    // Alarm pools and repeating timers
+    alarm_pool_t* default_pool();
+    alarm_pool_t* create_pool(int hardware_alarm);
+    bool add_repeating_timer(alarm_pool_t* pool, int64_t delay_us, repeating_timer_callback_t callback,
+                             void* user_data, repeating_timer_t* out);
+    bool cancel_repeating_timer(repeating_timer_t* timer);
+
+    UsbPipe& usb() { return usb_pipe; }
+
+    // Flash contents survive reset(), like on the board. wipe_flash() makes
+    // it factory fresh.
+    [[nodiscard]] uint8_t* flash() { return flash_memory.data(); }
+    void flash_erase(uint32_t offset, size_t count);
+    void flash_program(uint32_t offset, const uint8_t* data, size_t count);
+    void wipe_flash();
+
+    // Flash unique ID, most significant byte first as the SDK reports it
+    void set_board_id(uint64_t id) { unique_id = id; }
+    [[nodiscard]] uint64_t board_id() const { return unique_id; }
+
+    // External stimulus such as encoder edges. Runs once the clock reaches
+    // the given cycle, whatever the CPU is busy with at that point.
+    using Event = std::function<void()>;
+    void schedule(uint64_t cycle, Event event) { events.emplace(cycle, std::move(event)); }
+    [[nodiscard]] bool events_pending() const { return !events.empty(); }
+
+ private:
+    Simulator();
+
+    struct DmaChannel {
+        bool claimed = false;
+        bool busy = false;
+        dma_channel_config config{};
+        uintptr_t read_addr = 0;
+        uintptr_t write_addr = 0;
+        uint32_t count = 0;
+        uint32_t remaining = 0;
+    };
+
+    struct Timer {
+        repeating_timer_t* timer;
+        uint64_t due_us;
+    };
+
+    uint64_t now = 0;
+    uint64_t busy_until = 0;
+    int entering_irq = -1;
+    bool in_handler = false;
+    uint64_t handler_cycles = 0;
+    uint64_t irq_busy_cycles = 0;
+    uint64_t irqs_taken = 0;
+    CpuModel cpu_model;
+
+    // Pad state as bit masks, bit n is GPIOn
+    uint32_t func_sio = 0;
+    uint32_t func_pio0 = 0;
+    uint32_t func_pio1 = 0;
+    uint32_t sio_oe = 0;
+    uint32_t sio_out = 0;
+    uint32_t input_levels = 0;
+    std::array<PioBlock, NUM_PIOS> pio_blocks;
+    bool pio_clocked = true;
+    std::array<uint32_t, kNumGpios> gpio_irq_enabled_events{};
+    std::array<uint32_t, kNumGpios> gpio_edge_events{};
+    uint32_t gpio_irq_pins = 0;  // pins with any event enabled
+
+    std::array<irq_handler_t, NUM_IRQS> irq_handlers{};
+    std::array<uint8_t, NUM_IRQS> irq_priorities{};
+    uint32_t irq_enabled = 0;
+    uint32_t timer_irq_pending = 0;
+
+    std::array<DmaChannel, NUM_DMA_CHANNELS> dma_channels{};
+    bool dma_active = false;
+
+    std::vector<alarm_pool_t*> pools;
+    std::vector<Timer> timers;
+    uint64_t next_timer_us = UINT64_MAX;
+
+    UsbPipe usb_pipe;
+    std::vector<uint8_t> flash_memory = std::vector<uint8_t>(PICO_FLASH_SIZE_BYTES, 0xFF);
+    uint64_t unique_id = 0xE6614103E7452D2FULL;
+
+    std::multimap<uint64_t, Event> events;
+
+    static uint32_t read_pads();
+    void tick();
+    void skip_idle(uint64_t end);
+    void run_dma();
+    void run_timers();
+    void run_events();
+    void dispatch_irqs();
+    void run_handler(uint num);
+    uint32_t pending_irqs() const;
+    uint32_t dma_read(uintptr_t addr, dma_channel_transfer_size size);
+    void dma_write(uintptr_t addr, uint32_t value, dma_channel_transfer_size size);
+    bool dma_ready(uint dreq) const;
+    void update_next_timer();
+};
+
+#endif
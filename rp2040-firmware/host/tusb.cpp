@@ -0,0 +1,66 @@
+// TinyUSB vendor interface stand-in, backed by Simulator::usb()
+
+#include "tusb.h"
+
+#include "simulator.h"
+
+namespace {
+
+Simulator::UsbPipe& pipe() {
+    return Simulator::instance().usb();
+}
+
+}  // namespace
+
+bool tusb_init(void) {
+    return true;
+}
+
+void tud_task(void) {
+    pipe().device_flush();
+    // Frames that passed while the loop was busy are reported once, with
+    // the newest number, as if TinyUSB had dropped the others
+    uint32_t frame_number = 0;
+    if (pipe().device_sof(Simulator::instance().time_us(), frame_number)) {
+        tud_sof_cb(frame_number);
+    }
+}
+
+bool tud_mounted(void) {
+    return pipe().is_mounted();
+}
+
+void tud_sof_cb_enable(bool en) {
+    pipe().device_sof_enable(en);
+}
+
+bool tud_vendor_n_mounted(uint8_t itf) {
+    (void)itf;
+    return pipe().is_mounted();
+}
+
+uint32_t tud_vendor_n_available(uint8_t itf) {
+    (void)itf;
+    return pipe().device_available();
+}
+
+uint32_t tud_vendor_n_read(uint8_t itf, void* buffer, uint32_t bufsize) {
+    (void)itf;
+    return pipe().device_read(static_cast<uint8_t*>(buffer), bufsize);
+}
+
+uint32_t tud_vendor_n_write(uint8_t itf, void const* buffer, uint32_t bufsize) {
+    (void)itf;
+    return pipe().device_write(static_cast<const uint8_t*>(buffer), bufsize);
+}
+
+uint32_t tud_vendor_n_write_available(uint8_t itf) {
+    (void)itf;
+    return pipe().device_write_available();
+}
+
+uint32_t tud_vendor_n_write_flush(uint8_t itf) {
+    (void)itf;
+    pipe().device_flush();
+    return 0;
+}
@@ -0,0 +1,194 @@
+// Serves the emulated board on a Unix socket, so that the HAL component and
+// the host tools can run against it without hardware. The firmware runs
+// unchanged on the emulator, kept on the wall clock, with the encoder state
+// machines stopped: the positions only move in test mode.
+//
+// usage: virtual_device [--socket PATH] [--serial HEX] [--loop-us N]
+//
+// The socket is SOCK_SEQPACKET and every message is one bulk transfer, OUT
+// from the host and IN from the device. The first message after a connect
+// is the USB device descriptor followed by the serial number in ASCII. One
+// host at a time; it sees the board unplugged when it disconnects.
+// --loop-us is how much emulated time passes between two passes of the
+// firmware main loop, which adds up to that much to every reply.
+
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "host_board.h"
+#include "tusb.h"
+#include "usb_device.h"
+
+namespace {
+
+constexpr const char* kDefaultSocket = "/tmp/rp2040_encoder.sock";
+constexpr uint64_t kDefaultLoopUs = 20;
+// Larger than any transfer in either direction
+constexpr size_t kMaxTransfer = 1024;
+
+volatile sig_atomic_t stop = 0;
+
+void handle_signal(int) {
+    stop = 1;
+}
+
+int listen_on(const char* path) {
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    if (std::strlen(path) >= sizeof(addr.sun_path)) {
+        std::fprintf(stderr, "virtual_device: socket path %s is too long\n", path);
+        return -1;
+    }
+    std::strcpy(addr.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+    if (fd < 0) {
+        std::perror("virtual_device: socket");
+        return -1;
+    }
+    unlink(path);
+    if (bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 || listen(fd, 1) != 0) {
+        std::fprintf(stderr, "virtual_device: cannot listen on %s: %s\n", path, std::strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Device descriptor and serial number, what the host reads at enumeration
+bool send_hello(int fd, const HostBoard& board) {
+    std::vector<uint8_t> hello(sizeof(tusb_desc_device_t));
+    std::memcpy(hello.data(), tud_descriptor_device_cb(), hello.size());
+    std::string serial = board.string_descriptor(3);
+    hello.insert(hello.end(), serial.begin(), serial.end());
+    return send(fd, hello.data(), hello.size(), MSG_NOSIGNAL) == static_cast<ssize_t>(hello.size());
+}
+
+// OUT transfers waiting on the socket go to the device. False once the
+// host is gone.
+bool receive_transfers(int fd) {
+    std::vector<uint8_t> buffer(kMaxTransfer);
+    for (;;) {
+        ssize_t n = recv(fd, buffer.data(), buffer.size(), MSG_DONTWAIT);
+        if (n > 0) {
+            Simulator::instance().usb().send(std::vector<uint8_t>(buffer.begin(), buffer.begin() + n));
+            continue;
+        }
+        return n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR);
+    }
+}
+
+// IN transfers the device completed go to the host, or nowhere without one.
+// A host that stops reading loses transfers like on a full bus instead of
+// stalling the device.
+bool send_transfers(int fd) {
+    std::vector<uint8_t> transfer;
+    bool ok = true;
+    while (Simulator::instance().usb().receive(transfer, kMaxTransfer)) {
+        if (fd < 0 || !ok) {
+            continue;
+        }
+        ssize_t n = send(fd, transfer.data(), transfer.size(), MSG_NOSIGNAL | MSG_DONTWAIT);
+        ok = n == static_cast<ssize_t>(transfer.size()) || (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK));
+    }
+    return ok;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    const char* path = kDefaultSocket;
+    uint64_t loop_us = kDefaultLoopUs;
+    Simulator& sim = Simulator::instance();
+
+    for (int i = 1; i < argc; i++) {
+        if (std::strcmp(argv[i], "--socket") == 0 && i + 1 < argc) {
+            path = argv[++i];
+        } else if (std::strcmp(argv[i], "--serial") == 0 && i + 1 < argc) {
+            sim.set_board_id(std::strtoull(argv[++i], nullptr, 16));
+        } else if (std::strcmp(argv[i], "--loop-us") == 0 && i + 1 < argc) {
+            loop_us = std::strtoull(argv[++i], nullptr, 10);
+        } else {
+            std::fprintf(stderr, "usage: %s [--socket PATH] [--serial HEX] [--loop-us N]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (loop_us == 0) {
+        loop_us = 1;
+    }
+
+    HostBoard& board = HostBoard::instance();
+    board.boot();
+    sim.set_pio_clocked(false);
+    // Unplugged until a host connects
+    sim.usb().set_mounted(false);
+
+    int listen_fd = listen_on(path);
+    if (listen_fd < 0) {
+        return 1;
+    }
+    signal(SIGINT, handle_signal);
+    signal(SIGTERM, handle_signal);
+    std::printf("virtual_device: serial %s listening on %s\n", board.string_descriptor(3).c_str(), path);
+    std::fflush(stdout);
+
+    int client = -1;
+    auto start = std::chrono::steady_clock::now();
+    uint64_t start_us = sim.time_us();
+    while (!stop) {
+        // Wait while the emulator is ahead of the wall clock, or for the host
+        uint64_t wall_us = std::chrono::duration_cast<std::chrono::microseconds>(
+                               std::chrono::steady_clock::now() - start).count();
+        uint64_t emulated_us = sim.time_us() - start_us;
+        uint64_t ahead_us = emulated_us > wall_us ? emulated_us - wall_us : 0;
+        timespec timeout = {static_cast<time_t>(ahead_us / 1000000), static_cast<long>(ahead_us % 1000000) * 1000};
+        pollfd pfd = {client >= 0 ? client : listen_fd, POLLIN, 0};
+        if (ppoll(&pfd, 1, &timeout, nullptr) < 0 && errno != EINTR) {
+            std::perror("virtual_device: poll");
+            break;
+        }
+
+        if (client < 0 && (pfd.revents & POLLIN)) {
+            client = accept(listen_fd, nullptr, nullptr);
+            if (client >= 0 && send_hello(client, board)) {
+                sim.usb().set_mounted(true);
+                std::printf("virtual_device: host connected\n");
+                std::fflush(stdout);
+            } else if (client >= 0) {
+                close(client);
+                client = -1;
+            }
+        }
+
+        bool connected = client < 0 || receive_transfers(client);
+        board.poll();
+        connected = send_transfers(client) && connected;
+        if (!connected) {
+            close(client);
+            client = -1;
+            sim.usb().set_mounted(false);
+            std::printf("virtual_device: host disconnected\n");
+            std::fflush(stdout);
+        }
+
+        sim.advance_us(loop_us);
+    }
+
+    if (client >= 0) {
+        close(client);
+    }
+    close(listen_fd);
+    unlink(path);
+    return 0;
+}
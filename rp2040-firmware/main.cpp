@@ -5,33 +5,69 @@
 #include "hardware/pll.h"
 #include "hardware/sync.h"
 #include "hardware/xosc.h"
+#include "config_store.h"
+#include "encoder_benchmark.h"
+#include "perf_counters.h"
+#include "pico/flash.h"
+#include "pico/multicore.h"
 #include "pico/stdlib.h"
 #include "position.h"
+#include "position_compare.h"
 #include "quadrature_encoder.h"
 #include "usb_device.h"
 #include "ws2812_led.h"
 
+// Core1 owns the encoder: its PIO interrupt (or DMA) and the sampling timer
+// are set up here so they fire on this core, away from the USB interrupts.
+static void core1_main() {
+    // Lets core0 park this core while ConfigStore writes flash
+    flash_safe_execute_core_init();
+
+    QuadratureEncoder& encoder = QuadratureEncoder::instance();
+    encoder.set_sample_pool(alarm_pool_create_with_unused_hardware_alarm(4));
+    PositionCompare& compare = PositionCompare::instance();
+
+    multicore_fifo_push_blocking(1);
+
+    while (1) {
+        encoder.service();
+        compare.task();
+        tight_loop_contents();
+    }
+}
+
 int main() {
     WS2812Led::instance().set_blue();
 
-    gpio_init(8);
-    gpio_set_dir(8, GPIO_OUT);
-    gpio_put(8, 1);
+    gpio_init(QuadratureEncoder::kLevelShifterEnablePin);
+    gpio_set_dir(QuadratureEncoder::kLevelShifterEnablePin, GPIO_OUT);
+    gpio_put(QuadratureEncoder::kLevelShifterEnablePin, 1);
+
+    if constexpr (ENCODER_DUAL_CORE) {
+        // Wait until core1 has claimed the encoder before anything touches it
+        multicore_launch_core1(core1_main);
+        (void)multicore_fifo_pop_blocking();
+    }
 
     USBDevice::instance();
 
     Position& pos = Position::instance();
 
-    pos.set_scale(0, 0.001);
-    pos.set_scale(1, 0.001);
-    pos.set_scale(2, 0.001);
-    pos.set_scale(3, 0.1);
+    // Settings the host stored replace the scales of the axis profile
+    (void)ConfigStore::instance().load();
     
     pos.enable_test_mode(false);
 
     WS2812Led::instance().set_green();
 
     while (1) {
+        PerfCounters::instance().loop_iteration();
         USBDevice::instance().task();
+        if constexpr (!ENCODER_DUAL_CORE) {
+            QuadratureEncoder::instance().service();
+            PositionCompare::instance().task();
+        }
+        EncoderBenchmark::instance().task();
+        ConfigStore::instance().task();
     }
 }
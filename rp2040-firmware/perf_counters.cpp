@@ -0,0 +1,62 @@
+#include "perf_counters.h"
+
+#include <cstring>
+
+#include "pico/time.h"
+#include "usb_device.h"
+
+PerfCounters& PerfCounters::instance() {
+    static PerfCounters counters;
+    return counters;
+}
+
+void PerfCounters::loop_iteration() {
+    uint32_t now = time_us_32();
+    if (loop_started) {
+        record(Histogram::MAIN_LOOP, now - last_loop_us);
+    }
+    last_loop_us = now;
+    loop_started = true;
+}
+
+void PerfCounters::reset() {
+    stats = {};
+    fifo_max = {};
+    loop_started = false;
+}
+
+bool PerfCounters::get(uint8_t* out, size_t& bytes) const {
+    uint32_t sentinel = USBDevice::PERF_COUNTERS_SENTINEL;
+    memcpy(out, &sentinel, sizeof(sentinel));
+    out[4] = QuadratureEncoder::kNumEncoders;
+    out[5] = kNumBuckets;
+    out[6] = kNumHistograms;
+    out[7] = 0;
+    bytes = 8;
+
+    for (const Stats& s : stats) {
+        uint32_t count = s.count;
+        uint32_t max_us = s.max_us;
+        memcpy(out + bytes, &count, sizeof(count));
+        memcpy(out + bytes + 4, &max_us, sizeof(max_us));
+        bytes += 8;
+    }
+    memcpy(out + bytes, fifo_max.data(), fifo_max.size());
+    bytes += fifo_max.size();
+    return true;
+}
+
+bool PerfCounters::get_histogram(uint8_t index, uint8_t* out, size_t& bytes) const {
+    if (index >= kNumHistograms) {
+        return false;
+    }
+    uint32_t sentinel = USBDevice::PERF_HISTOGRAM_SENTINEL;
+    memcpy(out, &sentinel, sizeof(sentinel));
+    out[4] = index;
+    out[5] = kNumBuckets;
+    out[6] = 0;
+    out[7] = 0;
+    memcpy(out + 8, stats[index].buckets.data(), sizeof(stats[index].buckets));
+    bytes = 8 + sizeof(stats[index].buckets);
+    return true;
+}
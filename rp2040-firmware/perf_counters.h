@@ -0,0 +1,84 @@
+#ifndef PERF_COUNTERS_H_
+#define PERF_COUNTERS_H_
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+#include "quadrature_encoder.h"
+
+// Always-on instrumentation of the hot paths: the encoder interrupt, the
+// main loop and the time a request waits for its reply. Each is a log2
+// histogram of durations in microseconds with its count and maximum; the
+// encoder also keeps the deepest RX FIFO it found per axis.
+//
+// Every histogram has a single writer: the encoder interrupt (both PIO
+// handlers run at the same priority on one core) or the main loop. Readers
+// on either core may see one record half applied, which only matters for
+// the bucket sum against the count.
+class PerfCounters {
+ public:
+    enum class Histogram : uint8_t {
+        ENCODER_IRQ = 0,  // duration of one encoder interrupt
+        MAIN_LOOP = 1,    // period of the core0 main loop
+        USB_REPLY = 2     // request read by USBDevice::task() to reply written
+    };
+    static constexpr size_t kNumHistograms = 3;
+
+    // Bucket 0 counts 0 us, bucket n from 2^(n-1) to 2^n - 1 us, the last
+    // one everything from 16.4 ms up
+    static constexpr size_t kNumBuckets = 16;
+
+    static PerfCounters& instance();
+
+    void record(Histogram histogram, uint32_t duration_us) {
+        Stats& s = stats[static_cast<size_t>(histogram)];
+        s.count++;
+        if (duration_us > s.max_us) {
+            s.max_us = duration_us;
+        }
+        s.buckets[bucket(duration_us)]++;
+    }
+
+    void note_fifo_level(size_t encoder_idx, uint32_t level) {
+        if (level > fifo_max[encoder_idx]) {
+            fifo_max[encoder_idx] = static_cast<uint8_t>(level);
+        }
+    }
+
+    // Once per main loop pass, records the time since the last one
+    void loop_iteration();
+
+    void reset();
+
+    // Sentinel, number of axes, buckets and histograms, then per histogram
+    // the uint32 count and maximum, then the deepest FIFO per axis
+    [[nodiscard]] bool get(uint8_t* out, size_t& bytes) const;
+    // Sentinel, histogram index, number of buckets, then the buckets
+    [[nodiscard]] bool get_histogram(uint8_t index, uint8_t* out, size_t& bytes) const;
+
+    static constexpr size_t bucket(uint32_t duration_us) {
+        if (duration_us == 0) {
+            return 0;
+        }
+        size_t n = 32 - static_cast<size_t>(__builtin_clz(duration_us));
+        return n < kNumBuckets ? n : kNumBuckets - 1;
+    }
+
+ private:
+    PerfCounters() = default;
+
+    struct Stats {
+        uint32_t count;
+        uint32_t max_us;
+        std::array<uint32_t, kNumBuckets> buckets;
+    };
+
+    std::array<Stats, kNumHistograms> stats = {};
+    std::array<uint8_t, QuadratureEncoder::kNumEncoders> fifo_max = {};
+
+    uint32_t last_loop_us = 0;
+    bool loop_started = false;
+};
+
+#endif
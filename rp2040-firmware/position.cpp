@@ -5,6 +5,7 @@
 #include "pico/time.h"
 #include <cstring>
 #include <cmath>
+#include <climits>
 #include <cstdlib>
 
 Position& Position::instance() {
@@ -18,36 +19,165 @@ Position& Position::instance() {
 
 void Position::init() {
     QuadratureEncoder::instance();
+    // Defaults from the axis profile, until the host or stored settings
+    // replace them
+    for (size_t i = 0; i < kPositions; i++) {
+        const AxisProfile& axis = QuadratureEncoder::kProfile[i];
+        scale_factors[i] = axis.type != AxisType::NONE ? 1.0 / axis.counts_per_unit : 0.0;
+    }
     initialized = true;
 }
 
 bool Position::get(uint8_t* out, size_t& bytes) const {
-    if (!initialized) {
+    QuadratureEncoder::Snapshot snapshot;
+    QuadratureEncoder::instance().get_snapshot(snapshot);
+    return get(snapshot, out, bytes);
+}
+
+bool Position::get(const QuadratureEncoder::Snapshot& snapshot, uint8_t* out, size_t& bytes) const {
+    if (!initialized || out == nullptr) {
         return false;
     }
-    
-    if (test_mode) {
-        const_cast<Position*>(this)->update_test_mode();
-    } else {
-        const_cast<Position*>(this)->update_from_encoders();
+
+    Position* self = const_cast<Position*>(this);
+    self->begin_packet(out, bytes);
+    return self->add_sample(snapshot, out, bytes, USBDevice::kMaxFrameSize);
+}
+
+void Position::begin_packet(uint8_t* out, size_t& bytes) {
+    bytes = 0;
+    if (format == Format::SCALED) {
+        return;
     }
-    
-    bytes = sizeof(uint32_t) + sizeof(positions);
-    if (out != nullptr) {
+
+    uint32_t sentinel = USBDevice::COUNTS_DATA_SENTINEL;
+    memcpy(out, &sentinel, sizeof(sentinel));
+    out[4] = static_cast<uint8_t>(format);
+    out[5] = 0;  // sample count
+    out[6] = kPositions;
+    out[7] = velocity_size() > 0 ? kCountsFlagVelocity : 0;
+    memset(out + 8, 0, kCountsHeaderSize - 8);  // first sequence and timestamp
+    bytes = kCountsHeaderSize;
+}
+
+bool Position::add_sample(const QuadratureEncoder::Snapshot& snapshot, uint8_t* out, size_t& bytes,
+                          size_t capacity) {
+    if (!initialized) {
+        return false;
+    }
+
+    if (format == Format::SCALED) {
+        if (bytes != 0 || capacity < kScaledPacketSize) {
+            return false;
+        }
+
+        if (test_mode) {
+            update_test_mode();
+        } else {
+            update_from_counts(snapshot.counts);
+        }
+
         uint32_t sentinel = USBDevice::POSITION_DATA_SENTINEL;
         memcpy(out, &sentinel, sizeof(sentinel));
-        
-        memcpy(out + sizeof(sentinel), reinterpret_cast<const uint8_t*>(positions.data()), sizeof(positions));
+        bytes = sizeof(sentinel);
+        memcpy(out + bytes, reinterpret_cast<const uint8_t*>(positions.data()), sizeof(positions));
+        bytes += sizeof(positions);
+        memcpy(out + bytes, &snapshot.sequence, sizeof(snapshot.sequence));
+        bytes += sizeof(snapshot.sequence);
+        memcpy(out + bytes, &snapshot.timestamp_us, sizeof(snapshot.timestamp_us));
+        bytes += sizeof(snapshot.timestamp_us);
+        return true;
     }
 
+    // Samples in one packet have consecutive sequence numbers and carry
+    // their time as an offset to the first one in the header
+    uint8_t samples = out[5];
+    uint16_t time_offset = 0;
+    if (samples > 0) {
+        uint64_t elapsed = snapshot.timestamp_us - packet_first_timestamp;
+        if (snapshot.sequence != packet_last_sequence + 1 || elapsed > UINT16_MAX) {
+            return false;
+        }
+        time_offset = static_cast<uint16_t>(elapsed);
+    }
+
+    // Count formats skip the scale multiply entirely, the host applies it
+    std::array<int32_t, kPositions> sample;
+    resolve_counts(snapshot.counts, sample);
+
+    // The velocity trailer follows the newest sample, the new sample goes
+    // where the trailer was
+    size_t trailer = velocity_size();
+    size_t end = samples > 0 ? bytes - trailer : bytes;
+
+    if (format == Format::COUNTS_DELTA && samples > 0) {
+        std::array<int16_t, kPositions> deltas;
+        for (size_t i = 0; i < kPositions; i++) {
+            int32_t delta = sample[i] - packet_last_counts[i];
+            if (delta < INT16_MIN || delta > INT16_MAX) {
+                // Too far to encode, start a new packet with absolute counts
+                return false;
+            }
+            deltas[i] = static_cast<int16_t>(delta);
+        }
+        if (end + kDeltaSampleSize + trailer > capacity) {
+            return false;
+        }
+        memcpy(out + end, &time_offset, sizeof(time_offset));
+        memcpy(out + end + sizeof(time_offset), deltas.data(), sizeof(deltas));
+        end += kDeltaSampleSize;
+    } else {
+        if (end + kCountsSampleSize + trailer > capacity) {
+            return false;
+        }
+        memcpy(out + end, &time_offset, sizeof(time_offset));
+        memcpy(out + end + sizeof(time_offset), sample.data(), sizeof(sample));
+        end += kCountsSampleSize;
+    }
+
+    if (trailer > 0) {
+        std::array<float, kPositions> velocities;
+        for (size_t i = 0; i < kPositions; i++) {
+            velocities[i] = QuadratureEncoder::velocity(snapshot.edges[i]);
+        }
+        memcpy(out + end, velocities.data(), sizeof(velocities));
+    }
+    bytes = end + trailer;
+
+    if (samples == 0) {
+        memcpy(out + 8, &snapshot.sequence, sizeof(snapshot.sequence));
+        memcpy(out + 12, &snapshot.timestamp_us, sizeof(snapshot.timestamp_us));
+        packet_first_timestamp = snapshot.timestamp_us;
+    }
+    packet_last_counts = sample;
+    packet_last_sequence = snapshot.sequence;
+    out[5] = samples + 1;
     return true;
 }
 
-void Position::update_from_encoders() {
-    std::array<int32_t, kPositions> counts;
-    QuadratureEncoder::instance().get_all_counts(counts);
+size_t Position::get_single_sample_size() const {
+    if (format == Format::SCALED) {
+        return kScaledPacketSize;
+    }
+    return kCountsHeaderSize + kCountsSampleSize + velocity_size();
+}
+
+void Position::resolve_counts(const std::array<int32_t, kPositions>& counts, std::array<int32_t, kPositions>& out) {
+    if (!test_mode) {
+        out = counts;
+        return;
+    }
+
+    // Test patterns are generated in user units, turn them back into counts
+    update_test_mode();
+    for (size_t i = 0; i < kPositions; i++) {
+        out[i] = scale_factors[i] != 0.0 ? static_cast<int32_t>(lround(positions[i] / scale_factors[i])) : 0;
+    }
+}
+
+void Position::update_from_counts(const std::array<int32_t, kPositions>& counts) {
     for (size_t i = 0; i < kPositions; i++) {
-        positions[i] = static_cast<double>(counts[i]) * scale_factors[i];
+        positions[i] = QuadratureEncoder::is_connected(i) ? static_cast<double>(counts[i]) * scale_factors[i] : 0.0;
     }
 }
 
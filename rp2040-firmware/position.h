@@ -26,7 +26,8 @@ class Position {
         RANDOM_WALK
     } test_pattern = TestPattern::SINE_WAVE;
     
-    void update_from_encoders();
+    void update_from_counts(const std::array<int32_t, kPositions>& counts);
+    void resolve_counts(const std::array<int32_t, kPositions>& counts, std::array<int32_t, kPositions>& out);
     
     void update_test_mode();
 
@@ -37,9 +38,47 @@ class Position {
         EncoderError
     };
 
+    // Wire formats, selected by the host with VENDOR_REQUEST_SET_FORMAT
+    enum class Format : uint8_t {
+        SCALED = 0,       // sentinel + one sample of doubles
+        COUNTS = 1,       // header + int32 counts per sample
+        COUNTS_DELTA = 2  // header + int32 counts, then int16 deltas to the previous sample
+    };
+
+    // Or'ed into the SET_FORMAT argument, count formats then end every packet
+    // with one float velocity per axis, in counts per second at the last
+    // sample. Flagged in the header flags byte.
+    static constexpr uint8_t kVelocityFormatFlag = 0x80;
+    static constexpr uint8_t kCountsFlagVelocity = 0x01;
+
+    // Header in front of COUNTS and COUNTS_DELTA samples
+    static constexpr size_t kCountsHeaderSize = 20;
+    static constexpr size_t kCountsSampleSize = sizeof(uint16_t) + kPositions * sizeof(int32_t);
+    static constexpr size_t kDeltaSampleSize = sizeof(uint16_t) + kPositions * sizeof(int16_t);
+    static constexpr size_t kScaledPacketSize = 2 * sizeof(uint32_t) + kPositions * sizeof(double) + sizeof(uint64_t);
+    static constexpr size_t kVelocitySize = kPositions * sizeof(float);
+
     static Position& instance();
 
     [[nodiscard]] bool get(uint8_t* out, size_t& bytes) const;
+    [[nodiscard]] bool get(const QuadratureEncoder::Snapshot& snapshot, uint8_t* out, size_t& bytes) const;
+
+    // A packet holds one SCALED sample or as many count samples as fit in
+    // capacity bytes. add_sample() returns false when the sample did not fit.
+    void begin_packet(uint8_t* out, size_t& bytes);
+    [[nodiscard]] bool add_sample(const QuadratureEncoder::Snapshot& snapshot, uint8_t* out, size_t& bytes,
+                                  size_t capacity);
+
+    void set_format(uint8_t new_format) {
+        uint8_t base = new_format & ~kVelocityFormatFlag;
+        if (base <= static_cast<uint8_t>(Format::COUNTS_DELTA)) {
+            format = static_cast<Format>(base);
+            velocity = (new_format & kVelocityFormatFlag) != 0;
+        }
+    }
+    [[nodiscard]] Format get_format() const { return format; }
+    // Bytes a packet of one sample takes in the current format
+    [[nodiscard]] size_t get_single_sample_size() const;
 
     void set(size_t pos, double value) {
         if (pos < kPositions) {
@@ -67,6 +106,15 @@ class Position {
     void set_test_pattern(uint8_t pattern);
     [[nodiscard]] bool is_test_mode() const { return test_mode; }
 
+ private:
+    Format format = Format::SCALED;
+    bool velocity = false;
+    [[nodiscard]] size_t velocity_size() const {
+        return velocity && format != Format::SCALED ? kVelocitySize : 0;
+    }
+    std::array<int32_t, kPositions> packet_last_counts{};
+    uint32_t packet_last_sequence = 0;
+    uint64_t packet_first_timestamp = 0;
 };
 
 #endif
@@ -0,0 +1,294 @@
+#include "position_compare.h"
+
+#include <cstring>
+
+#include "hardware/gpio.h"
+#include "hardware/sync.h"
+#include "pico/time.h"
+#include "usb_device.h"
+
+volatile uint32_t PositionCompare::watched_axes = 0;
+
+PositionCompare& PositionCompare::instance() {
+    static PositionCompare compare;
+    static bool initialized = false;
+    if (!initialized) {
+        compare.init();
+        initialized = true;
+    }
+    return compare;
+}
+
+void PositionCompare::init() {
+    for (uint pin : kOutputPins) {
+        gpio_init(pin);
+        gpio_set_dir(pin, GPIO_OUT);
+        gpio_put(pin, false);
+    }
+}
+
+// The encoder path only looks at a channel while its axis is watched, so
+// it is taken out of the mask before being rewritten. With the encoder on
+// core1 an update already past the check can still finish on the old
+// settings; it sees either them or the new ones, as mode is written last.
+void PositionCompare::update_watched_axes() {
+    uint32_t axes = 0;
+    for (const Channel& channel : channels) {
+        if (channel.mode != Mode::OFF && !channel.finished) {
+            axes |= 1u << channel.axis;
+        }
+    }
+    __dmb();
+    watched_axes = axes;
+}
+
+void PositionCompare::disarm(size_t channel_idx) {
+    if (channel_idx >= kNumChannels) {
+        return;
+    }
+    Channel& channel = channels[channel_idx];
+    channel.mode = Mode::OFF;
+    update_watched_axes();
+    channel.num_targets = 0;
+    channel.pulsing = false;
+    channel.level = false;
+    gpio_put(kOutputPins[channel_idx], false);
+}
+
+bool PositionCompare::add_targets(size_t channel_idx, const int32_t* targets, size_t count) {
+    if (channel_idx >= kNumChannels) {
+        return false;
+    }
+    Channel& channel = channels[channel_idx];
+    if (channel.mode != Mode::OFF || channel.num_targets + count > kMaxTargets) {
+        return false;
+    }
+    memcpy(&channel.targets[channel.num_targets], targets, count * sizeof(int32_t));
+    channel.num_targets += count;
+    return true;
+}
+
+bool PositionCompare::arm_list(size_t channel_idx, size_t axis, uint16_t pulse_us) {
+    if (channel_idx >= kNumChannels || axis >= QuadratureEncoder::kNumEncoders) {
+        return false;
+    }
+    Channel& channel = channels[channel_idx];
+    if (channel.mode != Mode::OFF || channel.num_targets == 0) {
+        return false;
+    }
+    int8_t direction = channel.num_targets < 2 || channel.targets[1] > channel.targets[0] ? 1 : -1;
+    for (uint32_t i = 1; i < channel.num_targets; i++) {
+        if ((static_cast<int64_t>(channel.targets[i]) - channel.targets[i - 1]) * direction <= 0) {
+            return false;
+        }
+    }
+
+    channel.axis = static_cast<uint8_t>(axis);
+    channel.pulse_us = pulse_us;
+    channel.direction = direction;
+    channel.finished = false;
+    channel.index = 0;
+    channel.next = channel.targets[0];
+    channel.hits = 0;
+    skip_behind(channel, Mode::LIST);
+    __dmb();
+    channel.mode = Mode::LIST;
+    update_watched_axes();
+    return true;
+}
+
+bool PositionCompare::arm_periodic(size_t channel_idx, size_t axis, int32_t first, int32_t spacing, uint32_t count,
+                                   uint16_t pulse_us) {
+    if (channel_idx >= kNumChannels || axis >= QuadratureEncoder::kNumEncoders || spacing == 0) {
+        return false;
+    }
+    Channel& channel = channels[channel_idx];
+    // The host sends its settings again after a request went astray, that
+    // must not restart a running channel
+    if (channel.mode == Mode::PERIODIC && channel.axis == axis && channel.first == first &&
+        channel.spacing == spacing && channel.count == count && channel.pulse_us == pulse_us) {
+        return true;
+    }
+    disarm(channel_idx);
+    channel.axis = static_cast<uint8_t>(axis);
+    channel.pulse_us = pulse_us;
+    channel.direction = spacing > 0 ? 1 : -1;
+    channel.finished = false;
+    channel.first = first;
+    channel.spacing = spacing;
+    channel.count = count;
+    channel.index = 0;
+    channel.next = first;
+    channel.hits = 0;
+    skip_behind(channel, Mode::PERIODIC);
+    __dmb();
+    channel.mode = Mode::PERIODIC;
+    update_watched_axes();
+    return true;
+}
+
+// Targets the axis already reached when the channel is armed are passed
+// over without firing, the first hit is the next target ahead. An edge
+// between reading the count and arming fires on the edge after it.
+void PositionCompare::skip_behind(Channel& channel, Mode mode) {
+    int32_t count = 0;
+    QuadratureEncoder::instance().get_count(channel.axis, count);
+    advance(channel, mode, count);
+}
+
+// Steps past every target the count reached. A list takes at most
+// kMaxTargets steps; a periodic channel jumps in one, however far behind it
+// was armed, so the encoder interrupt stays short.
+void PositionCompare::advance(Channel& channel, Mode mode, int32_t count) {
+    if (mode == Mode::LIST) {
+        while (!channel.finished && (count - channel.next) * channel.direction >= 0) {
+            channel.index++;
+            channel.finished = channel.index >= channel.num_targets;
+            if (!channel.finished) {
+                channel.next = channel.targets[channel.index];
+            }
+        }
+        return;
+    }
+    if ((count - channel.next) * channel.direction < 0) {
+        return;
+    }
+    // Same sign as the spacing, so the quotient is not negative
+    uint64_t crossed = static_cast<uint64_t>((count - channel.next) / channel.spacing) + 1;
+    // Without an end the index only has to keep moving
+    uint32_t remaining = channel.count != 0 ? channel.count - channel.index : UINT32_MAX;
+    crossed = crossed < remaining ? crossed : remaining;
+    channel.index += static_cast<uint32_t>(crossed);
+    channel.next += static_cast<int64_t>(crossed) * channel.spacing;
+    // Past the last target, or past where a count can go
+    channel.finished = (channel.count != 0 && channel.index >= channel.count) || channel.next > INT32_MAX ||
+                       channel.next < INT32_MIN;
+}
+
+void PositionCompare::update(size_t axis, int32_t count) {
+    for (size_t c = 0; c < kNumChannels; c++) {
+        Channel& channel = channels[c];
+        if (channel.mode == Mode::OFF || channel.finished || channel.axis != axis) {
+            continue;
+        }
+        uint32_t first_index = channel.index;
+        advance(channel, channel.mode, count);
+        if (channel.index != first_index) {
+            fire(c, first_index, count);
+            if (channel.finished) {
+                update_watched_axes();
+            }
+        }
+    }
+}
+
+void PositionCompare::fire(size_t channel_idx, uint32_t first_index, int32_t count) {
+    Channel& channel = channels[channel_idx];
+    // Output first, the bookkeeping can wait
+    if (channel.pulse_us == 0) {
+        channel.level = !channel.level;
+        gpio_put(kOutputPins[channel_idx], channel.level);
+    } else {
+        gpio_put(kOutputPins[channel_idx], true);
+    }
+    uint64_t now_us = time_us_64();
+    if (channel.pulse_us != 0) {
+        channel.pulse_end_us = now_us + channel.pulse_us;
+        channel.pulsing = true;
+    }
+
+    uint32_t crossed = channel.index - first_index;
+    channel.hits = channel.hits + crossed;
+    channel.last_count = count;
+    channel.last_time_us = now_us;
+
+    uint32_t h = head;
+    if (h - tail >= kQueueSize) {
+        // The host fell behind, the hit counter still has it
+        lost = lost + 1;
+        return;
+    }
+    Hit& hit = queue[h % kQueueSize];
+    hit.index = first_index;
+    hit.hits = channel.hits;
+    hit.count = count;
+    hit.timestamp_us = now_us;
+    hit.channel = static_cast<uint8_t>(channel_idx);
+    hit.axis = channel.axis;
+    hit.crossed = static_cast<uint8_t>(crossed > UINT8_MAX ? UINT8_MAX : crossed);
+    __dmb();
+    head = h + 1;
+}
+
+// Runs on the core of the encoder interrupt, so with interrupts off a new
+// pulse cannot start between the check and the end of the old one
+void PositionCompare::task() {
+    for (size_t c = 0; c < kNumChannels; c++) {
+        Channel& channel = channels[c];
+        if (!channel.pulsing) {
+            continue;
+        }
+        uint32_t status = save_and_disable_interrupts();
+        if (channel.pulsing && time_us_64() >= channel.pulse_end_us) {
+            gpio_put(kOutputPins[c], false);
+            channel.pulsing = false;
+        }
+        restore_interrupts(status);
+    }
+}
+
+bool PositionCompare::peek(Hit& hit) const {
+    uint32_t t = tail;
+    if (head == t) {
+        return false;
+    }
+    __dmb();
+    hit = queue[t % kQueueSize];
+    return true;
+}
+
+void PositionCompare::drop() {
+    tail = tail + 1;
+}
+
+bool PositionCompare::get(uint8_t* out, size_t& bytes) const {
+    uint32_t sentinel = USBDevice::COMPARE_STATUS_SENTINEL;
+    memcpy(out, &sentinel, sizeof(sentinel));
+    out[4] = kNumChannels;
+    memset(out + 5, 0, 3);
+    bytes = 8;
+    for (const Channel& channel : channels) {
+        uint8_t* entry = out + bytes;
+        uint32_t total = channel.mode == Mode::PERIODIC ? channel.count : channel.num_targets;
+        uint16_t targets = static_cast<uint16_t>(total > UINT16_MAX ? UINT16_MAX : total);
+        uint32_t index = channel.index;
+        uint32_t hits = channel.hits;
+        entry[0] = static_cast<uint8_t>(channel.mode);
+        entry[1] = channel.axis;
+        memcpy(entry + 2, &targets, sizeof(targets));
+        memcpy(entry + 4, &index, sizeof(index));
+        memcpy(entry + 8, &hits, sizeof(hits));
+        memcpy(entry + 12, &channel.last_count, sizeof(channel.last_count));
+        memcpy(entry + 16, &channel.last_time_us, sizeof(channel.last_time_us));
+        bytes += 24;
+    }
+    return true;
+}
+
+bool PositionCompare::get(const Hit& hit, uint8_t* out, size_t& bytes) const {
+    uint32_t sentinel = USBDevice::COMPARE_HIT_SENTINEL;
+    uint32_t behind = get_pending() > 0 ? get_pending() - 1 : 0;
+    uint32_t lost_hits = lost;
+    memcpy(out, &sentinel, sizeof(sentinel));
+    out[4] = hit.channel;
+    out[5] = hit.axis;
+    out[6] = static_cast<uint8_t>(behind);
+    out[7] = hit.crossed;
+    memcpy(out + 8, &hit.index, sizeof(hit.index));
+    memcpy(out + 12, &hit.hits, sizeof(hit.hits));
+    memcpy(out + 16, &lost_hits, sizeof(lost_hits));
+    memcpy(out + 20, &hit.count, sizeof(hit.count));
+    memcpy(out + 24, &hit.timestamp_us, sizeof(hit.timestamp_us));
+    bytes = 32;
+    return true;
+}
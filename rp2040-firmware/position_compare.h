@@ -0,0 +1,127 @@
+#ifndef POSITION_COMPARE_H_
+#define POSITION_COMPARE_H_
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+#include "quadrature_encoder.h"
+
+// Drives an output when an axis count crosses target positions, to fire a
+// camera or laser at exact scale positions. The encoder path checks the
+// targets with every count it takes, so with the interrupt backend the
+// output changes within the encoder interrupt, microseconds after the edge.
+// The DMA backend sees counts from its service loop and is as late as that.
+//
+// Each channel watches one axis and walks its targets in one direction:
+// an uploaded list, ascending or descending, or first plus a multiple of a
+// spacing. A target counts as crossed once the count reaches it; those
+// the axis already reached when the channel is armed are skipped. Several
+// targets crossed by one count change fire the output once and are
+// reported together.
+class PositionCompare {
+ public:
+    static constexpr size_t kNumChannels = 2;
+    // Free on the RP2040-Zero header in four and eight axis builds
+    static constexpr std::array<uint, kNumChannels> kOutputPins = {28, 29};
+    static constexpr size_t kMaxTargets = 256;
+    // Targets per ADD_COMPARE_TARGETS request
+    static constexpr size_t kTargetsPerRequest = 8;
+
+    static_assert(!profile_uses_pin(QuadratureEncoder::kProfile, kOutputPins[0]) &&
+                      !profile_uses_pin(QuadratureEncoder::kProfile, kOutputPins[1]),
+                  "axis profile uses a position compare output");
+
+    enum class Mode : uint8_t {
+        OFF = 0,
+        LIST = 1,      // the uploaded targets
+        PERIODIC = 2   // first + n * spacing
+    };
+
+    struct Hit {
+        uint32_t index;   // of the first target crossed
+        uint32_t hits;    // targets crossed so far, this one included
+        int32_t count;    // axis count that crossed it
+        uint64_t timestamp_us;
+        uint8_t channel;
+        uint8_t axis;
+        uint8_t crossed;  // targets crossed by this count change
+    };
+
+    static PositionCompare& instance();
+
+    // Disarms the channel, drops its targets and parks the output low
+    void disarm(size_t channel);
+    // Appends to the targets of a disarmed channel, false if it is armed or
+    // they do not fit
+    [[nodiscard]] bool add_targets(size_t channel, const int32_t* targets, size_t count);
+    // The targets must be strictly ascending or descending. An output pulse
+    // of 0 us toggles the output on every hit instead.
+    [[nodiscard]] bool arm_list(size_t channel, size_t axis, uint16_t pulse_us);
+    // count targets, 0 for no end. The sign of spacing sets the direction.
+    // Arming a running channel with the settings it has changes nothing.
+    [[nodiscard]] bool arm_periodic(size_t channel, size_t axis, int32_t first, int32_t spacing, uint32_t count,
+                                    uint16_t pulse_us);
+
+    // From the encoder path with the new count of an axis it watches
+    [[nodiscard]] static bool watches(size_t axis) { return (watched_axes >> axis) & 1; }
+    void update(size_t axis, int32_t count);
+    // Ends output pulses, call regularly from the loop of the encoder core
+    void task();
+
+    // One consumer, USBDevice::task()
+    [[nodiscard]] bool peek(Hit& hit) const;
+    void drop();
+    [[nodiscard]] uint32_t get_pending() const { return head - tail; }
+
+    // Status reply: sentinel, channels, then per channel mode, axis, number
+    // of targets (0 for periodic without end), index of the next one, hits,
+    // and count and timestamp of the last hit
+    [[nodiscard]] bool get(uint8_t* out, size_t& bytes) const;
+    // Pushed packet: sentinel, channel, axis, hits queued behind this one,
+    // targets crossed, index of the first, hits, lost hits, count, timestamp
+    [[nodiscard]] bool get(const Hit& hit, uint8_t* out, size_t& bytes) const;
+
+ private:
+    PositionCompare() = default;
+    void init();
+
+    struct Channel {
+        volatile Mode mode;
+        uint8_t axis;
+        uint16_t pulse_us;
+        int8_t direction;    // +1 when the targets ascend
+        bool finished;
+        std::array<int32_t, kMaxTargets> targets;
+        uint32_t num_targets;
+        int32_t first;
+        int32_t spacing;
+        uint32_t count;
+        // Written by update()
+        uint32_t index;      // of the next target
+        int64_t next;
+        volatile uint32_t hits;
+        int32_t last_count;
+        uint64_t last_time_us;
+        bool level;
+        volatile bool pulsing;
+        uint64_t pulse_end_us;
+    };
+    std::array<Channel, kNumChannels> channels = {};
+
+    // Axes with an armed channel, cleared while a channel is rewritten
+    static volatile uint32_t watched_axes;
+    void update_watched_axes();
+    void skip_behind(Channel& channel, Mode mode);
+    void advance(Channel& channel, Mode mode, int32_t count);
+    void fire(size_t channel_idx, uint32_t first_index, int32_t count);
+
+    // Hits waiting for the host, later ones are lost
+    static constexpr size_t kQueueSize = 16;
+    std::array<Hit, kQueueSize> queue = {};
+    volatile uint32_t head = 0;
+    volatile uint32_t tail = 0;
+    volatile uint32_t lost = 0;
+};
+
+#endif
@@ -0,0 +1,117 @@
+#include "probe_latch.h"
+
+#include <cstring>
+
+#include "hardware/gpio.h"
+#include "hardware/irq.h"
+#include "hardware/sync.h"
+#include "usb_device.h"
+
+ProbeLatch& ProbeLatch::instance() {
+    static ProbeLatch latch;
+    static bool initialized = false;
+    if (!initialized) {
+        latch.init();
+        initialized = true;
+    }
+    return latch;
+}
+
+// The handler takes IO_IRQ_BANK0 on the core that first asks for the
+// instance, which is the USB core
+void ProbeLatch::init() {
+    gpio_init(kProbePin);
+    gpio_set_dir(kProbePin, GPIO_IN);
+    gpio_pull_up(kProbePin);
+
+    irq_set_exclusive_handler(IO_IRQ_BANK0, gpio_irq_handler);
+    irq_set_priority(IO_IRQ_BANK0, 0);
+    irq_set_enabled(IO_IRQ_BANK0, true);
+}
+
+void ProbeLatch::arm(uint8_t new_edges, uint16_t new_holdoff_us) {
+    constexpr uint32_t kBothEdges = GPIO_IRQ_EDGE_RISE | GPIO_IRQ_EDGE_FALL;
+    gpio_set_irq_enabled(kProbePin, kBothEdges, false);
+
+    edges = new_edges & (kEdgeRising | kEdgeFalling);
+    holdoff_us = new_holdoff_us;
+    tail = head;
+    lost = 0;
+    latched = false;
+
+    uint32_t events = ((edges & kEdgeRising) ? GPIO_IRQ_EDGE_RISE : 0) |
+                      ((edges & kEdgeFalling) ? GPIO_IRQ_EDGE_FALL : 0);
+    if (events != 0) {
+        gpio_set_irq_enabled(kProbePin, events, true);
+    }
+}
+
+bool ProbeLatch::peek(Latch& latch) const {
+    uint32_t t = tail;
+    if (head == t) {
+        return false;
+    }
+    __dmb();
+    latch = queue[t % kQueueSize];
+    return true;
+}
+
+void ProbeLatch::drop() {
+    tail = tail + 1;
+}
+
+bool ProbeLatch::get(const Latch& latch, uint8_t* out, size_t& bytes) const {
+    uint32_t sentinel = USBDevice::PROBE_DATA_SENTINEL;
+    uint32_t behind = get_pending() > 0 ? get_pending() - 1 : 0;
+    uint32_t lost_latches = lost;
+    memcpy(out, &sentinel, sizeof(sentinel));
+    out[4] = QuadratureEncoder::kNumEncoders;
+    out[5] = latch.edge;
+    out[6] = static_cast<uint8_t>(behind);
+    out[7] = 0;
+    memcpy(out + 8, &latch.sequence, sizeof(latch.sequence));
+    memcpy(out + 12, &lost_latches, sizeof(lost_latches));
+    memcpy(out + 16, &latch.timestamp_us, sizeof(latch.timestamp_us));
+    memcpy(out + 24, latch.counts.data(), sizeof(latch.counts));
+    bytes = 24 + sizeof(latch.counts);
+    return true;
+}
+
+void ProbeLatch::gpio_irq_handler() {
+    // Time first, the counts are read at most a few microseconds later
+    uint64_t now_us = time_us_64();
+    ProbeLatch& self = instance();
+
+    uint32_t events = gpio_get_irq_event_mask(kProbePin);
+    gpio_acknowledge_irq(kProbePin, events);
+    // A pulse shorter than the interrupt entry leaves both edges set, which
+    // makes a single latch
+    if (events & GPIO_IRQ_EDGE_RISE) {
+        self.latch(kEdgeRising, now_us);
+    } else if (events & GPIO_IRQ_EDGE_FALL) {
+        self.latch(kEdgeFalling, now_us);
+    }
+}
+
+void ProbeLatch::latch(uint8_t edge, uint64_t now_us) {
+    if (latched && now_us - last_latch_us < holdoff_us) {
+        return;
+    }
+    latched = true;
+    last_latch_us = now_us;
+
+    uint32_t h = head;
+    if (h - tail >= kQueueSize) {
+        // The host fell behind, keep the queued latches
+        lost = lost + 1;
+        sequence++;
+        return;
+    }
+    Latch& entry = queue[h % kQueueSize];
+    QuadratureEncoder::instance().get_all_counts(entry.counts);
+    entry.timestamp_us = now_us;
+    entry.sequence = sequence++;
+    entry.edge = edge;
+    __dmb();
+    head = h + 1;
+}
@@ -0,0 +1,77 @@
+#ifndef PROBE_LATCH_H_
+#define PROBE_LATCH_H_
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+#include "quadrature_encoder.h"
+
+// Latches all counts on an edge of the probe input, for edge finding and
+// touch-off. The GPIO interrupt takes the counts and time_us_64() within a
+// few microseconds of the edge, much finer than the sample stream, and
+// queues them until USBDevice pushes them to the host.
+//
+// The interrupt runs at the encoder priority. On one core an encoder
+// interrupt pending at the same time goes first, as it has the lower
+// number, so the latch sees every count up to the edge.
+class ProbeLatch {
+ public:
+    // 3.3 V input with pull-up, not through the level shifter. Free on the
+    // RP2040-Zero header in four and eight axis builds.
+    static constexpr uint kProbePin = 15;
+    static_assert(!profile_uses_pin(QuadratureEncoder::kProfile, kProbePin), "axis profile uses the probe pin");
+
+    static constexpr uint8_t kEdgeRising = 0x01;
+    static constexpr uint8_t kEdgeFalling = 0x02;
+
+    // Latches waiting for the host, later ones are lost
+    static constexpr size_t kQueueSize = 8;
+
+    struct Latch {
+        std::array<int32_t, QuadratureEncoder::kNumEncoders> counts;
+        uint64_t timestamp_us;
+        uint32_t sequence;
+        uint8_t edge;  // kEdgeRising or kEdgeFalling
+    };
+
+    static ProbeLatch& instance();
+
+    // Edges is a mask of kEdgeRising and kEdgeFalling, 0 disarms. Edges
+    // within holdoff_us of a latch are ignored, so a bouncing contact
+    // latches once. Arming drops latches still queued.
+    void arm(uint8_t new_edges, uint16_t new_holdoff_us);
+    [[nodiscard]] uint8_t get_edges() const { return edges; }
+
+    // One consumer, USBDevice::task()
+    [[nodiscard]] bool peek(Latch& latch) const;
+    void drop();
+    [[nodiscard]] uint32_t get_pending() const { return head - tail; }
+    [[nodiscard]] uint32_t get_lost() const { return lost; }
+
+    // Pushed packet: sentinel, number of axes, edge, latches queued behind
+    // this one, reserved, sequence, lost latches, timestamp, counts
+    [[nodiscard]] bool get(const Latch& latch, uint8_t* out, size_t& bytes) const;
+
+    static void gpio_irq_handler();
+
+ private:
+    ProbeLatch() = default;
+    void init();
+
+    volatile uint8_t edges = 0;
+    volatile uint32_t holdoff_us = 0;
+
+    // Written by the interrupt
+    std::array<Latch, kQueueSize> queue = {};
+    volatile uint32_t head = 0;
+    volatile uint32_t tail = 0;
+    volatile uint32_t lost = 0;
+    uint32_t sequence = 0;
+    uint64_t last_latch_us = 0;
+    bool latched = false;
+
+    void latch(uint8_t edge, uint64_t now_us);
+};
+
+#endif
@@ -1,13 +1,23 @@
 #include "quadrature_encoder.h"
 
 #include "hardware/clocks.h"
+#include "hardware/dma.h"
 #include "hardware/gpio.h"
 #include "hardware/irq.h"
+#include "hardware/sync.h"
+#include "perf_counters.h"
+#include "position_compare.h"
 #include "quadrature_encoder.pio.h"
 
 std::array<int32_t, QuadratureEncoder::kNumEncoders> QuadratureEncoder::positions = {};
-PIO QuadratureEncoder::static_pio = nullptr;
+volatile uint32_t QuadratureEncoder::positions_seq = 0;
+std::array<PIO, QuadratureEncoder::kNumPios> QuadratureEncoder::static_pios = {};
 std::array<uint, QuadratureEncoder::kNumEncoders> QuadratureEncoder::static_sm_nums = {};
+std::array<uint, QuadratureEncoder::kNumPios> QuadratureEncoder::static_program_offsets = {};
+std::array<uint32_t, QuadratureEncoder::kNumEncoders> QuadratureEncoder::illegal_transitions = {};
+std::array<uint32_t, QuadratureEncoder::kNumEncoders> QuadratureEncoder::overruns = {};
+std::array<QuadratureEncoder::EdgeTimes, QuadratureEncoder::kNumEncoders> QuadratureEncoder::edge_times = {};
+std::array<int32_t, QuadratureEncoder::kNumEncoders> QuadratureEncoder::static_offsets = {};
 
 QuadratureEncoder& QuadratureEncoder::instance() {
     static QuadratureEncoder encoder;
@@ -21,70 +31,510 @@ QuadratureEncoder& QuadratureEncoder::instance() {
 void QuadratureEncoder::init() {
     setup_pio();
     
-    static_pio = pio;
+    static_pios = pios;
     static_sm_nums = sm_nums;
+    static_program_offsets = program_offsets;
     
-    setup_interrupts();
-
-    count_offsets.fill(0);
+    count_offsets = {};
+    static_offsets.fill(0);
+    illegal_transitions.fill(0);
+    overruns.fill(0);
     positions.fill(0);
+    edge_times = {};
 
     for (size_t i = 0; i < kNumEncoders; i++) {
-        pio_sm_clear_fifos(pio, sm_nums[i]);
+        if (is_connected(i)) {
+            pio_sm_clear_fifos(pios[i / kEncodersPerPio], sm_nums[i]);
+        }
+    }
+
+    if constexpr (kBackend == Backend::DMA) {
+        setup_dma();
+    } else {
+        setup_interrupts();
     }
 }
 
 void QuadratureEncoder::setup_pio() {
-    uint offset = pio_add_program(pio, &quadrature_encoder_program);
+    constexpr std::array<PIO, 2> kPios = {pio0, pio1};
 
-    for (size_t i = 0; i < kNumEncoders; i++) {
-        uint sm = pio_claim_unused_sm(pio, true);
-        sm_nums[i] = sm;
+    for (size_t p = 0; p < kNumPios; p++) {
+        PIO pio = kPios[p];
+        pios[p] = pio;
+
+        // The jump table must sit at offset 0 of every block
+        uint offset = pio_add_program(pio, &quadrature_encoder_program);
+        program_offsets[p] = offset;
 
-        uint pin_base = kBasePin + (i * kPinsPerEncoder);
-        quadrature_encoder_program_init(pio, sm, offset, pin_base, 0);
+        for (size_t i = p * kEncodersPerPio; i < (p + 1) * kEncodersPerPio; i++) {
+            samplings[i] = Sampling{};
+            if (!is_connected(i)) {
+                continue;
+            }
+            uint sm = pio_claim_unused_sm(pio, true);
+            sm_nums[i] = sm;
+            uint pin = kProfile[i].pin;
+            pio_sm_config c = quadrature_encoder_program_get_config(offset, pin, samplings[i].clkdiv_int,
+                                                                    samplings[i].clkdiv_frac,
+                                                                    samplings[i].filter_samples);
+            quadrature_encoder_program_init(pio, sm, offset, pin, &c);
+        }
     }
 }
 
 void QuadratureEncoder::setup_interrupts() {
-    pio_set_irqn_source_enabled(pio, 0, pis_sm0_rx_fifo_not_empty, true);
-    pio_set_irqn_source_enabled(pio, 0, pis_sm1_rx_fifo_not_empty, true);
-    pio_set_irqn_source_enabled(pio, 0, pis_sm2_rx_fifo_not_empty, true);
-    pio_set_irqn_source_enabled(pio, 0, pis_sm3_rx_fifo_not_empty, true);
-    
-    irq_set_exclusive_handler(PIO0_IRQ_0, pio_irq_handler);
-    irq_set_priority(PIO0_IRQ_0, 0);
-    irq_set_enabled(PIO0_IRQ_0, true);
+    constexpr std::array<uint, 2> kPioIrqs = {PIO0_IRQ_0, PIO1_IRQ_0};
+    // Written so that only handlers for blocks in use get instantiated
+    constexpr std::array<irq_handler_t, 2> kHandlers = {pio_irq_handler<0>, pio_irq_handler<kNumPios - 1>};
+
+    for (size_t p = 0; p < kNumPios; p++) {
+        for (size_t i = p * kEncodersPerPio; i < (p + 1) * kEncodersPerPio; i++) {
+            if (!is_connected(i)) {
+                continue;
+            }
+            auto source = static_cast<pio_interrupt_source>(pis_sm0_rx_fifo_not_empty + sm_nums[i]);
+            pio_set_irqn_source_enabled(pios[p], 0, source, true);
+            // Raised by the program on an illegal transition
+            auto flag = static_cast<pio_interrupt_source>(pis_interrupt0 + sm_nums[i]);
+            pio_set_irqn_source_enabled(pios[p], 0, flag, true);
+        }
+
+        irq_set_exclusive_handler(kPioIrqs[p], kHandlers[p]);
+        irq_set_priority(kPioIrqs[p], 0);
+        irq_set_enabled(kPioIrqs[p], true);
+    }
 }
 
-void QuadratureEncoder::pio_irq_handler() {
-    if (!static_pio) return;
-    
+void QuadratureEncoder::setup_dma() {
     for (size_t i = 0; i < kNumEncoders; i++) {
-        while (!pio_sm_is_rx_fifo_empty(static_pio, static_sm_nums[i])) {
-            positions[i] = (int32_t)static_pio->rxf[static_sm_nums[i]];
+        if (!is_connected(i)) {
+            continue;
+        }
+        dma_channels[i] = dma_claim_unused_channel(true);
+
+        dma_channel_config c = dma_channel_get_default_config(dma_channels[i]);
+        channel_config_set_transfer_data_size(&c, DMA_SIZE_32);
+        channel_config_set_read_increment(&c, false);
+        channel_config_set_write_increment(&c, false);
+        PIO pio = pios[i / kEncodersPerPio];
+        channel_config_set_dreq(&c, pio_get_dreq(pio, sm_nums[i], false));
+        channel_config_set_high_priority(&c, true);
+        dma_channel_configure(dma_channels[i], &c, &positions[i], &pio->rxf[sm_nums[i]], UINT32_MAX, false);
+
+        start_dma(i);
+    }
+}
+
+void QuadratureEncoder::start_dma(size_t encoder_idx) {
+    dma_channel_set_trans_count(dma_channels[encoder_idx], UINT32_MAX, true);
+}
+
+void QuadratureEncoder::service() {
+    if constexpr (ENCODER_DUAL_CORE) {
+        // A setting written again meanwhile bumps the request once more and
+        // is applied on the next pass
+        for (size_t i = 0; i < kNumEncoders; i++) {
+            uint32_t requests = sampling_requests[i];
+            if (requests != sampling_applied[i]) {
+                sampling_applied[i] = requests;
+                __dmb();
+                apply_sampling(i);
+            }
+        }
+    }
+
+    if constexpr (kBackend == Backend::DMA) {
+        // A channel stops after 2^32 edges. The state machine keeps counting
+        // in X meanwhile, so re-arming it loses no counts, only freshness.
+        for (size_t i = 0; i < kNumEncoders; i++) {
+            if (is_connected(i) && !dma_channel_is_busy(dma_channels[i])) {
+                start_dma(i);
+            }
+        }
+
+        // Without an interrupt per edge, edges are timed when this loop sees
+        // the count change, so only as finely as it is called. Interrupts
+        // stay off while the seqlock is odd so a reader on this core cannot
+        // spin on it.
+        uint32_t now_us = time_us_32();
+        for (size_t i = 0; i < kNumEncoders; i++) {
+            int32_t count = positions[i];
+            if (is_connected(i) && count != edge_times[i].count) {
+                uint32_t status = save_and_disable_interrupts();
+                positions_seq = positions_seq + 1;
+                __compiler_memory_barrier();
+                record_edge(i, count, now_us);
+                compare(i);
+                __compiler_memory_barrier();
+                positions_seq = positions_seq + 1;
+                restore_interrupts(status);
+            }
+        }
+
+        for (size_t p = 0; p < kNumPios; p++) {
+            count_illegal_transitions(p);
+            recover_overruns(p);
+        }
+
+        // The channels keep the FIFOs near empty, a deep one means the bus
+        // held them off
+        for (size_t i = 0; i < kNumEncoders; i++) {
+            if (!is_connected(i)) {
+                continue;
+            }
+            uint level = pio_sm_get_rx_fifo_level(pios[i / kEncodersPerPio], sm_nums[i]);
+            PerfCounters::instance().note_fifo_level(i, level);
+        }
+    }
+}
+
+bool QuadratureEncoder::set_sampling(size_t encoder_idx, const Sampling& new_sampling) {
+    if (encoder_idx >= kNumEncoders || !is_connected(encoder_idx) || new_sampling.clkdiv_int == 0 || new_sampling.filter_samples == 0 ||
+        new_sampling.filter_samples > kMaxFilterSamples) {
+        return false;
+    }
+    samplings[encoder_idx] = new_sampling;
+    if constexpr (ENCODER_DUAL_CORE) {
+        // Reprogrammed by service() on core1, which also restarts state
+        // machines of this PIO after overruns
+        __dmb();
+        sampling_requests[encoder_idx] = sampling_requests[encoder_idx] + 1;
+    } else {
+        apply_sampling(encoder_idx);
+    }
+    return true;
+}
+
+// Enabling and disabling a state machine rewrites the CTRL register of its
+// whole PIO, so this must not interleave with republish() for another
+// encoder: it runs on the encoder core with the interrupts off.
+void QuadratureEncoder::apply_sampling(size_t encoder_idx) {
+    uint32_t status = save_and_disable_interrupts();
+    const Sampling& sampling = samplings[encoder_idx];
+    size_t p = encoder_idx / kEncodersPerPio;
+    pio_sm_config c = quadrature_encoder_program_get_config(program_offsets[p], kProfile[encoder_idx].pin,
+                                                            sampling.clkdiv_int, sampling.clkdiv_frac,
+                                                            sampling.filter_samples);
+    // Keeps X and Y, so the count and the A/B state, but clears the FIFO
+    pio_sm_init(pios[p], sm_nums[encoder_idx], program_offsets[p] + quadrature_encoder_offset_start, &c);
+    republish(encoder_idx);
+    restore_interrupts(status);
+}
+
+void QuadratureEncoder::count_illegal_transitions(size_t pio_idx) {
+    PIO pio = static_pios[pio_idx];
+    // The program raises the flag numbered like its state machine
+    uint32_t flags = pio->irq & ((1u << kEncodersPerPio) - 1);
+    if (flags == 0) {
+        return;
+    }
+    pio->irq = flags;
+    for (size_t i = pio_idx * kEncodersPerPio; i < (pio_idx + 1) * kEncodersPerPio; i++) {
+        if (is_connected(i) && ((flags >> static_sm_nums[i]) & 1)) {
+            illegal_transitions[i]++;
+        }
+    }
+}
+
+void QuadratureEncoder::recover_overruns(size_t pio_idx) {
+    PIO pio = static_pios[pio_idx];
+    uint32_t stalls = pio->fdebug >> PIO_FDEBUG_RXSTALL_LSB;
+    for (size_t i = pio_idx * kEncodersPerPio; i < (pio_idx + 1) * kEncodersPerPio; i++) {
+        uint sm = static_sm_nums[i];
+        if (is_connected(i) && ((stalls >> sm) & 1)) {
+            pio->fdebug = 1u << (PIO_FDEBUG_RXSTALL_LSB + sm);
+            overruns[i]++;
+            republish(i);
+        }
+    }
+}
+
+// A push into a full FIFO loses the newest count, so what was drained is
+// older than X, and an encoder that stands still pushes nothing to fix it.
+// Unless the state machine is already accepting an edge, which ends in a
+// push, restart its sampling and push X from outside.
+void QuadratureEncoder::republish(size_t encoder_idx) {
+    size_t p = encoder_idx / kEncodersPerPio;
+    PIO pio = static_pios[p];
+    uint sm = static_sm_nums[encoder_idx];
+    uint offset = static_program_offsets[p];
+
+    pio_sm_set_enabled(pio, sm, false);
+    uint pc = pio_sm_get_pc(pio, sm) - offset;
+    bool accepting = (pc > quadrature_encoder_offset_minus1 && pc < quadrature_encoder_offset_start) ||
+                     pc > quadrature_encoder_offset_plus1;
+    if (!accepting) {
+        pio_sm_exec(pio, sm, pio_encode_jmp(offset + quadrature_encoder_offset_start));
+        pio_sm_exec(pio, sm, pio_encode_mov(pio_isr, pio_x));
+        pio_sm_exec(pio, sm, pio_encode_push(false, false));
+    }
+    pio_sm_set_enabled(pio, sm, true);
+}
+
+void QuadratureEncoder::record_edge(size_t encoder_idx, int32_t count, uint32_t now_us) {
+    EdgeTimes& e = edge_times[encoder_idx];
+    int32_t step = count - e.count;
+    int32_t span = e.count - e.ref_count;
+    if (now_us - e.time_us >= kVelocityTimeoutUs) {
+        // Moving again after standing still, the next edge gives the first
+        // period
+        e.ref_count = count;
+        e.ref_time_us = now_us;
+        e.has_mid = false;
+    } else if ((step > 0 && span < 0) || (step < 0 && span > 0)) {
+        // Turned around, measure from the last edge before the turn
+        e.ref_count = e.count;
+        e.ref_time_us = e.time_us;
+        e.has_mid = false;
+    } else if (!e.has_mid) {
+        if (now_us - e.ref_time_us >= kVelocityWindowUs) {
+            e.mid_count = count;
+            e.mid_time_us = now_us;
+            e.has_mid = true;
+        }
+    } else if (now_us - e.mid_time_us >= kVelocityWindowUs) {
+        e.ref_count = e.mid_count;
+        e.ref_time_us = e.mid_time_us;
+        e.mid_count = count;
+        e.mid_time_us = now_us;
+    }
+    e.count = count;
+    e.time_us = now_us;
+}
+
+// Only axes a compare channel watches pay for more than the mask test
+void QuadratureEncoder::compare(size_t encoder_idx) {
+    if (PositionCompare::watches(encoder_idx)) {
+        PositionCompare::instance().update(encoder_idx,
+                                           oriented(encoder_idx, positions[encoder_idx]) - static_offsets[encoder_idx]);
+    }
+}
+
+float QuadratureEncoder::velocity(const EdgeSpan& edge) {
+    if (edge.counts == 0 || edge.span_us == 0 || edge.age_us >= kVelocityTimeoutUs) {
+        return 0.0f;
+    }
+    if (edge.age_us > edge.span_us) {
+        // No edge for longer than the whole span: slowing down, by now at
+        // most one count since the last edge
+        float bound = 1e6f / static_cast<float>(edge.age_us);
+        return edge.counts > 0 ? bound : -bound;
+    }
+    return static_cast<float>(edge.counts) * 1e6f / static_cast<float>(edge.span_us);
+}
+
+// Drains the encoders of one PIO block
+template <size_t kPio>
+void QuadratureEncoder::pio_irq_handler() {
+    static_assert(kPio < kNumPios);
+    PIO pio = static_pios[kPio];
+    if (!pio) return;
+
+    // One timestamp for every edge drained in this pass
+    uint32_t now_us = time_us_32();
+
+    positions_seq = positions_seq + 1;
+    __compiler_memory_barrier();
+
+    // Only a full FIFO can have lost a push, so FDEBUG is left alone
+    // unless a drain emptied one
+    bool full = false;
+    for (size_t i = kPio * kEncodersPerPio; i < (kPio + 1) * kEncodersPerPio; i++) {
+        if (!is_connected(i)) {
+            continue;
+        }
+        uint drained = 0;
+        while (!pio_sm_is_rx_fifo_empty(pio, static_sm_nums[i])) {
+            positions[i] = (int32_t)pio->rxf[static_sm_nums[i]];
+            drained++;
+        }
+        full |= drained >= kFifoDepth;
+        PerfCounters::instance().note_fifo_level(i, drained);
+        if (positions[i] != edge_times[i].count) {
+            record_edge(i, positions[i], now_us);
+            compare(i);
         }
     }
     
-    pio_interrupt_clear(static_pio, 0);
+    __compiler_memory_barrier();
+    positions_seq = positions_seq + 1;
+
+    count_illegal_transitions(kPio);
+    if (full) {
+        recover_overruns(kPio);
+    }
+
+    PerfCounters::instance().record(PerfCounters::Histogram::ENCODER_IRQ, time_us_32() - now_us);
 }
 
 
-void QuadratureEncoder::get_all_counts(std::array<int32_t, kNumEncoders>& counts) const {
+// With the DMA backend positions_seq only changes when service() times an
+// edge and each word is written atomically, so a snapshot spans at most a few
+// bus cycles.
+void QuadratureEncoder::read_raw_positions(std::array<int32_t, kNumEncoders>& raw) const {
+    uint32_t seq;
+    do {
+        seq = positions_seq;
+        __compiler_memory_barrier();
+        raw = positions;
+        __compiler_memory_barrier();
+    } while ((seq & 1) || seq != positions_seq);
+}
+
+void QuadratureEncoder::capture(Snapshot& snapshot) const {
+    uint32_t seq;
+    uint32_t generation;
+    std::array<uint32_t, kNumEncoders> edge_time_us;
+    do {
+        seq = positions_seq;
+        generation = offsets_generation;
+        __compiler_memory_barrier();
+        const std::array<int32_t, kNumEncoders>& offsets = count_offsets[generation & 1];
+        for (size_t i = 0; i < kNumEncoders; i++) {
+            const EdgeTimes& e = edge_times[i];
+            snapshot.counts[i] = is_connected(i) ? oriented(i, positions[i]) - offsets[i] : 0;
+            snapshot.edges[i].counts = oriented(i, e.count - e.ref_count);
+            snapshot.edges[i].span_us = e.time_us - e.ref_time_us;
+            edge_time_us[i] = e.time_us;
+        }
+        snapshot.timestamp_us = time_us_64();
+        __compiler_memory_barrier();
+    } while ((seq & 1) || seq != positions_seq || generation != offsets_generation);
+
     for (size_t i = 0; i < kNumEncoders; i++) {
-        counts[i] = positions[i] - count_offsets[i];
+        snapshot.edges[i].age_us = static_cast<uint32_t>(snapshot.timestamp_us) - edge_time_us[i];
     }
 }
 
+void QuadratureEncoder::get_snapshot(Snapshot& snapshot) {
+    capture(snapshot);
+    snapshot.sequence = snapshot_sequence++;
+}
+
+void QuadratureEncoder::get_all_counts(std::array<int32_t, kNumEncoders>& counts) const {
+    Snapshot snapshot;
+    capture(snapshot);
+    counts = snapshot.counts;
+}
+
 void QuadratureEncoder::get_count(size_t encoder_idx, int32_t& count) const {
-    count = positions[encoder_idx] - count_offsets[encoder_idx];
+    std::array<int32_t, kNumEncoders> counts;
+    get_all_counts(counts);
+    count = counts[encoder_idx];
+}
+
+void QuadratureEncoder::update_offset(size_t encoder_idx, int32_t new_count) {
+    std::array<int32_t, kNumEncoders> raw;
+    read_raw_positions(raw);
+
+    uint32_t generation = offsets_generation;
+    std::array<int32_t, kNumEncoders>& next = count_offsets[(generation + 1) & 1];
+    next = count_offsets[generation & 1];
+    // Set offset so that current position - offset = new_count
+    next[encoder_idx] = oriented(encoder_idx, raw[encoder_idx]) - new_count;
+
+    __compiler_memory_barrier();
+    offsets_generation = generation + 1;
+    static_offsets[encoder_idx] = next[encoder_idx];
 }
 
 void QuadratureEncoder::reset_count(size_t encoder_idx) {
-    count_offsets[encoder_idx] = positions[encoder_idx];
+    update_offset(encoder_idx, 0);
 }
 
 void QuadratureEncoder::set_count(size_t encoder_idx, int32_t new_count) {
-    // Set offset so that current position - offset = new_count
-    count_offsets[encoder_idx] = positions[encoder_idx] - new_count;
-}
\ No newline at end of file
+    update_offset(encoder_idx, new_count);
+}
+
+bool QuadratureEncoder::start_sampling(uint32_t rate_hz) {
+    stop_sampling();
+    if (rate_hz == 0) {
+        return false;
+    }
+
+    // Only the consumer side is touched here, the producer may be running
+    // on the other core until the timer is armed again
+    sample_tail = sample_head;
+    dropped_samples = 0;
+    reported_valid = false;
+
+    if (sample_pool == nullptr) {
+        sample_pool = alarm_pool_get_default();
+    }
+
+    // Negative delay means the period is measured from callback start to start
+    int64_t period_us = -static_cast<int64_t>(1000000 / rate_hz);
+    sampling = alarm_pool_add_repeating_timer_us(sample_pool, period_us, sample_timer_callback, this, &timer);
+    return sampling;
+}
+
+void QuadratureEncoder::stop_sampling() {
+    if (sampling) {
+        cancel_repeating_timer(&timer);
+        sampling = false;
+    }
+}
+
+bool QuadratureEncoder::sample_timer_callback(repeating_timer_t* rt) {
+    QuadratureEncoder* self = static_cast<QuadratureEncoder*>(rt->user_data);
+
+    uint32_t head = self->sample_head;
+    if (head - self->sample_tail >= kSampleQueueSize) {
+        // Consumer fell behind, keep the queued samples and drop this one.
+        // The sequence still advances so the host sees the gap.
+        self->dropped_samples = self->dropped_samples + 1;
+        self->sample_sequence++;
+        return true;
+    }
+
+    Snapshot& snapshot = self->sample_queue[head % kSampleQueueSize];
+    self->capture(snapshot);
+    if (self->keepalive_us != 0 && !self->should_report(snapshot)) {
+        // The slot is still free, the next sample overwrites it
+        return true;
+    }
+    snapshot.sequence = self->sample_sequence++;
+    __dmb();
+    self->sample_head = head + 1;
+    return true;
+}
+
+bool QuadratureEncoder::should_report(const Snapshot& snapshot) {
+    bool moving = false;
+    for (const EdgeSpan& edge : snapshot.edges) {
+        // velocity(edge) != 0 without the float division
+        moving |= edge.counts != 0 && edge.span_us != 0 && edge.age_us < kVelocityTimeoutUs;
+    }
+    // One more sample once everything stopped, so the host sees zero
+    // velocities and not the last decaying ones
+    bool report = !reported_valid || moving || reported_moving || snapshot.counts != reported_counts ||
+                  snapshot.timestamp_us - reported_time_us >= keepalive_us;
+    if (report) {
+        reported_counts = snapshot.counts;
+        reported_time_us = snapshot.timestamp_us;
+        reported_moving = moving;
+        reported_valid = true;
+    }
+    return report;
+}
+
+bool QuadratureEncoder::peek_sample(Snapshot& snapshot) const {
+    uint32_t tail = sample_tail;
+    if (tail == sample_head) {
+        return false;
+    }
+
+    __dmb();
+    snapshot = sample_queue[tail % kSampleQueueSize];
+    return true;
+}
+
+void QuadratureEncoder::drop_sample() {
+    uint32_t tail = sample_tail;
+    if (tail == sample_head) {
+        return;
+    }
+
+    __dmb();
+    sample_tail = tail + 1;
+}
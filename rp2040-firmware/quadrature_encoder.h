@@ -5,23 +5,110 @@
 #include <cstddef>
 #include <cstdint>
 
+#include "axis_profile.h"
 #include "hardware/pio.h"
 #include "pico/time.h"
 #include "hardware/gpio.h"
 
+// Build with ENCODER_DMA_BACKEND=1 to drain the state machine FIFOs with DMA
+// instead of taking an interrupt on every encoder edge.
+#ifndef ENCODER_DMA_BACKEND
+#define ENCODER_DMA_BACKEND 0
+#endif
+
+// Build with ENCODER_DUAL_CORE=1 to run the encoder interrupts and the
+// sampling timer on core1, leaving core0 to the USB stack.
+#ifndef ENCODER_DUAL_CORE
+#define ENCODER_DUAL_CORE 0
+#endif
+
+// Build with ENCODER_COUNT=8 to run four more encoders on pio1. That takes
+// every state machine, so the status LED and the on-device benchmark are
+// left out of such builds.
+#ifndef ENCODER_COUNT
+#define ENCODER_COUNT 4
+#endif
+static_assert(ENCODER_COUNT == 4 || ENCODER_COUNT == 8, "ENCODER_COUNT must be 4 or 8");
+
 class QuadratureEncoder {
  public:
-    static constexpr size_t kNumEncoders = 4;
+    static constexpr size_t kNumEncoders = ENCODER_COUNT;
+    static constexpr size_t kEncodersPerPio = NUM_PIO_STATE_MACHINES;
+    static constexpr size_t kNumPios = kNumEncoders / kEncodersPerPio;
 
-    static constexpr uint kBasePin = 0;
+    // Pins, directions and default scales, see axis_profile.h. Axes of type
+    // NONE take no state machine interrupt or DMA channel and read 0.
+#ifdef AXIS_PROFILE
+    static_assert(std::tuple_size_v<decltype(kMachineProfile)> == kNumEncoders,
+                  "kMachineProfile needs ENCODER_COUNT axes");
+    static constexpr BoardProfile<kNumEncoders> kProfile = kMachineProfile;
+#else
+    static constexpr BoardProfile<kNumEncoders> kProfile = default_axis_profile<kNumEncoders>();
+#endif
     static constexpr uint kPinsPerEncoder = 2;
 
+    // TXS0108E output enable, high passes the scale signals through
+    static constexpr uint kLevelShifterEnablePin = 8;
+
+    static_assert(is_valid_axis_profile(kProfile), "axis profile has overlapping or out of range pins");
+    static_assert(!profile_uses_pin(kProfile, kLevelShifterEnablePin), "axis profile uses the level shifter pin");
+
+    [[nodiscard]] static constexpr bool is_connected(size_t encoder_idx) {
+        return kProfile[encoder_idx].type != AxisType::NONE;
+    }
+
+    enum class Backend : uint8_t {
+        IRQ = 0,
+        DMA = 1
+    };
+    static constexpr Backend kBackend = ENCODER_DMA_BACKEND ? Backend::DMA : Backend::IRQ;
+
     enum class EncoderError {
         InvalidIndex,
         NotInitialized,
         PIOError
     };
 
+    // Velocity comes from edge timestamps: counts between two edges over the
+    // time between them. At low speed the two are consecutive edges (period
+    // measurement), at high speed at least kVelocityWindowUs apart (count
+    // difference over a window, still timed on edges).
+    static constexpr uint32_t kVelocityWindowUs = 1000;
+    // Slower than two counts per second reads as standing still
+    static constexpr uint32_t kVelocityTimeoutUs = 500000;
+
+    // What velocity() needs, cheap enough to take with every sample
+    struct EdgeSpan {
+        int32_t counts;   // between the two edges
+        uint32_t span_us; // between the two edges
+        uint32_t age_us;  // since the later edge
+    };
+
+    // All axes captured at one instant. The sequence number increments per
+    // snapshot so the host can spot dropped or repeated samples.
+    struct Snapshot {
+        std::array<int32_t, kNumEncoders> counts;
+        std::array<EdgeSpan, kNumEncoders> edges;
+        uint64_t timestamp_us;
+        uint32_t sequence;
+    };
+
+    // Sampling of one encoder: the state machine clock divider, 1 to 65535
+    // and 255/256ths, and the debounce, 1 to kMaxFilterSamples. A change
+    // counts once the A/B inputs differed from the accepted state for that
+    // many samples in a row, whichever neighbour they were in; the last one
+    // is taken. A sample takes six state machine clocks, 48 ns undivided at
+    // 125 MHz.
+    struct Sampling {
+        uint16_t clkdiv_int = 1;
+        uint8_t clkdiv_frac = 0;
+        uint8_t filter_samples = 1;
+    };
+    static constexpr uint8_t kMaxFilterSamples = 32;
+
+    // Counts per second, signed
+    [[nodiscard]] static float velocity(const EdgeSpan& edge);
+
     static QuadratureEncoder& instance();
 
     void init();
@@ -30,38 +117,155 @@ class QuadratureEncoder {
 
     void get_all_counts(std::array<int32_t, kNumEncoders>& counts) const;
 
+    void get_snapshot(Snapshot& snapshot);
+
     void reset_count(size_t encoder_idx);
     
     void set_count(size_t encoder_idx, int32_t new_count);
 
-    constexpr void set_max_step_rate(int max_rate) {
-        max_step_rate = max_rate;
-    }
+    // Keeps the DMA backend running, call regularly from the main loop
+    void service();
+
+    // Samples all counts from a repeating timer into a small queue that the
+    // USB task drains, so frames are taken at a fixed cadence. The queue has
+    // one producer and one consumer, which may run on different cores.
+    [[nodiscard]] bool start_sampling(uint32_t rate_hz);
+    void stop_sampling();
+    [[nodiscard]] bool is_sampling() const { return sampling; }
+    [[nodiscard]] bool peek_sample(Snapshot& snapshot) const;
+    void drop_sample();
+    [[nodiscard]] uint32_t get_dropped_samples() const { return dropped_samples; }
+    // Report on change: with a keepalive the timer only queues a sample when
+    // a count moved, a velocity has yet to settle to zero or keepalive_us
+    // passed since the last queued one. Skipped samples take no sequence
+    // number. 0 queues every sample.
+    void set_keepalive(uint32_t new_keepalive_us) { keepalive_us = new_keepalive_us; }
+
+    // The sampling timer fires on the core that created the pool
+    void set_sample_pool(alarm_pool_t* pool) { sample_pool = pool; }
+    [[nodiscard]] alarm_pool_t* get_sample_pool() const { return sample_pool; }
 
+    // Reprograms the state machine of one encoder, keeping its count.
+    // Counts queued in its FIFO at that moment are replaced by the current
+    // one. False for an index or setting out of range. Dual-core builds
+    // apply it on core1 within a pass of its loop.
+    [[nodiscard]] bool set_sampling(size_t encoder_idx, const Sampling& new_sampling);
+    [[nodiscard]] const Sampling& get_sampling(size_t encoder_idx) const { return samplings[encoder_idx]; }
 
+    // Transitions that changed both inputs at once, so skipped a state and
+    // were not counted, and counts the state machine found its FIFO full
+    // for. A run of either faster than the interrupt (IRQ backend) or the
+    // service() loop (DMA backend) notices them counts once.
+    [[nodiscard]] uint32_t get_illegal_transitions(size_t encoder_idx) const {
+        return illegal_transitions[encoder_idx];
+    }
+    [[nodiscard]] uint32_t get_overruns(size_t encoder_idx) const { return overruns[encoder_idx]; }
+
+    template <size_t kPio>
     static void pio_irq_handler();
+    static bool sample_timer_callback(repeating_timer_t* rt);
 
  private:
     QuadratureEncoder() = default;
     bool initialized = false;
 
-    PIO pio = pio0;
+    // Encoder i runs on pios[i / kEncodersPerPio]
+    std::array<PIO, kNumPios> pios = {};
     std::array<uint, kNumEncoders> sm_nums = {};
+    std::array<uint, kNumPios> program_offsets = {};
+    std::array<Sampling, kNumEncoders> samplings = {};
+    // Dual core: set_sampling() on core0 counts requests, service() on
+    // core1 applies them
+    std::array<volatile uint32_t, kNumEncoders> sampling_requests = {};
+    std::array<uint32_t, kNumEncoders> sampling_applied = {};
+    void apply_sampling(size_t encoder_idx);
 
-    std::array<int32_t, kNumEncoders> count_offsets = {};
+    // Offsets are double buffered: writers fill the inactive copy and then
+    // bump the generation, so readers never see a half-updated set.
+    std::array<std::array<int32_t, kNumEncoders>, 2> count_offsets = {};
+    volatile uint32_t offsets_generation = 0;
     
+    // Written by pio_irq_handler under a seqlock, odd while an update is in
+    // progress. Readers retry instead of blocking the IRQ. The handlers of
+    // both PIO blocks share it; they run at the same priority on the same
+    // core and so never interrupt each other.
     static std::array<int32_t, kNumEncoders> positions;
-    static PIO static_pio;
+    static volatile uint32_t positions_seq;
+    static std::array<PIO, kNumPios> static_pios;
     static std::array<uint, kNumEncoders> static_sm_nums;
+    static std::array<uint, kNumPios> static_program_offsets;
+
+    // Written by whichever of pio_irq_handler and service() the backend uses
+    static std::array<uint32_t, kNumEncoders> illegal_transitions;
+    static std::array<uint32_t, kNumEncoders> overruns;
+    static void count_illegal_transitions(size_t pio_idx);
+    static void recover_overruns(size_t pio_idx);
+    static void republish(size_t encoder_idx);
+
+    // Latest edge and the start of the velocity span per axis, under the
+    // positions seqlock. mid becomes the next span start once it is a
+    // window past ref, so the span stays between one and two windows long.
+    struct EdgeTimes {
+        int32_t count;
+        uint32_t time_us;
+        int32_t ref_count;
+        uint32_t ref_time_us;
+        int32_t mid_count;
+        uint32_t mid_time_us;
+        bool has_mid;
+    };
+    static std::array<EdgeTimes, kNumEncoders> edge_times;
+    static void record_edge(size_t encoder_idx, int32_t count, uint32_t now_us);
+
+    // Offsets in effect, one word per axis, for the position compare check
+    // in the handlers, which cannot take the double buffered set
+    static std::array<int32_t, kNumEncoders> static_offsets;
+    static void compare(size_t encoder_idx);
+
+    // RX FIFO of each state machine, with the TX FIFO joined in
+    static constexpr uint kFifoDepth = 8;
 
     uint32_t last_fifo_drain = 0;
     static constexpr uint32_t kFifoDrainInterval = 1;
 
-    int max_step_rate = 0;
     repeating_timer_t timer;
+    alarm_pool_t* sample_pool = nullptr;
+
+    static constexpr size_t kSampleQueueSize = 16;
+    std::array<Snapshot, kSampleQueueSize> sample_queue = {};
+    volatile uint32_t sample_head = 0;
+    volatile uint32_t sample_tail = 0;
+    volatile uint32_t dropped_samples = 0;
+    bool sampling = false;
+    uint32_t sample_sequence = 0;
+    uint32_t snapshot_sequence = 0;
+
+    // Producer side of report on change
+    volatile uint32_t keepalive_us = 0;
+    std::array<int32_t, kNumEncoders> reported_counts = {};
+    uint64_t reported_time_us = 0;
+    bool reported_moving = false;
+    bool reported_valid = false;
+    [[nodiscard]] bool should_report(const Snapshot& snapshot);
+
+    void read_raw_positions(std::array<int32_t, kNumEncoders>& raw) const;
+    // Raw counts in the direction of the profile, folds away for axes that
+    // are not inverted
+    [[nodiscard]] static constexpr int32_t oriented(size_t encoder_idx, int32_t raw) {
+        // Negated unsigned, counts wrap like the state machine's X
+        return kProfile[encoder_idx].inverted ? static_cast<int32_t>(0u - static_cast<uint32_t>(raw)) : raw;
+    }
+    void capture(Snapshot& snapshot) const;
+    void update_offset(size_t encoder_idx, int32_t new_count);
+
+    // One channel per state machine copies every pushed count straight
+    // into positions[], so the FIFO never fills and the CPU is not involved
+    std::array<int, kNumEncoders> dma_channels = {};
 
     void setup_pio();
     void setup_interrupts();
+    void setup_dma();
+    void start_dma(size_t encoder_idx);
 };
 
 #endif
\ No newline at end of file
@@ -52,8 +52,9 @@
 #define CFG_TUD_MIDI 0
 #define CFG_TUD_VENDOR 1
 
-// Vendor FIFO size of TX and RX
+// Vendor FIFO size of TX and RX. TX holds a whole reply frame, which can
+// span several packets.
 #define CFG_TUD_VENDOR_RX_BUFSIZE 64
-#define CFG_TUD_VENDOR_TX_BUFSIZE 64
+#define CFG_TUD_VENDOR_TX_BUFSIZE 256
 
 #endif  // TUSB_CONFIG_H_
\ No newline at end of file
@@ -1,15 +1,28 @@
 #include "usb_device.h"
 
+#include <algorithm>
 #include <array>
 #include <cstring>
 
 #include "hardware/gpio.h"
 #include "hardware/irq.h"
 #include "pico/time.h"
+#include "pico/unique_id.h"
+#include "config_store.h"
+#include "encoder_benchmark.h"
+#include "encoder_capture.h"
+#include "perf_counters.h"
 #include "position.h"
+#include "position_compare.h"
+#include "probe_latch.h"
+#include "quadrature_encoder.h"
 #include "tusb.h"
 #include "version.h"
 #include "ws2812_led.h"
+
+#define STRINGIFY_(x) #x
+#define STRINGIFY(x) STRINGIFY_(x)
+
 tusb_desc_device_t const desc_device = {.bLength = sizeof(tusb_desc_device_t),
                                         .bDescriptorType = TUSB_DESC_DEVICE,
                                         .bcdUSB = 0x0200,
@@ -19,7 +32,14 @@ tusb_desc_device_t const desc_device = {.bLength = sizeof(tusb_desc_device_t),
                                         .bMaxPacketSize0 = CFG_TUD_ENDPOINT0_SIZE,
                                         .idVendor = USBDevice::VENDOR_ID,
                                         .idProduct = USBDevice::PRODUCT_ID,
-                                        .bcdDevice = 0x0100,
+                                        // 2.0 adds framed requests, 2.1 velocities,
+                                        // 2.2 report on change, 2.3 sampling
+                                        // settings, 2.4 perf counters, 2.5
+                                        // the probe latch, 2.6 stored
+                                        // settings and the handshake, 2.7
+                                        // the start of frame clock, 2.8
+                                        // position compare
+                                        .bcdDevice = 0x0280,
                                         .iManufacturer = 0x01,
                                         .iProduct = 0x02,
                                         .iSerialNumber = 0x03,
@@ -28,13 +48,18 @@ tusb_desc_device_t const desc_device = {.bLength = sizeof(tusb_desc_device_t),
 uint8_t const desc_configuration[] = {
     TUD_CONFIG_DESCRIPTOR(1, 1, 0, TUD_CONFIG_DESC_LEN + TUD_VENDOR_DESC_LEN, TUSB_DESC_CONFIG_ATT_REMOTE_WAKEUP, 100),
 
-    TUD_VENDOR_DESCRIPTOR(USBDevice::VENDOR_INTERFACE, 0, USBDevice::EP_VENDOR_OUT, USBDevice::EP_VENDOR_IN, 64)};
+    TUD_VENDOR_DESCRIPTOR(USBDevice::VENDOR_INTERFACE, 4, USBDevice::EP_VENDOR_OUT, USBDevice::EP_VENDOR_IN, 64)};
+
+// The serial number is the flash unique ID, filled in by init(), so every
+// board can be told apart. The firmware build moves to the interface name.
+static char serial_string[2 * PICO_UNIQUE_BOARD_ID_SIZE_BYTES + 1];
 
 char const* string_desc_arr[] = {
     (const char[]){0x09, 0x04},
     "RP2040",
     "Quadrature Encoder",
-    "4ENC-" GIT_SHORT_SHA "-" GIT_COMMIT_DATE_SHORT,
+    serial_string,
+    STRINGIFY(ENCODER_COUNT) "ENC-" GIT_SHORT_SHA "-" GIT_COMMIT_DATE_SHORT,
 };
 
 USBDevice& USBDevice::instance() {
@@ -47,7 +72,10 @@ USBDevice& USBDevice::instance() {
 }
 
 void USBDevice::init() {
+    pico_get_unique_board_id_string(serial_string, sizeof(serial_string));
     tusb_init();
+    // TinyUSB only reports start of frame events when asked to
+    tud_sof_cb_enable(true);
     
     // Set USB interrupt to lower priority than encoder interrupts
     irq_set_priority(USBCTRL_IRQ, 255);  // Lowest priority
@@ -56,87 +84,631 @@ void USBDevice::init() {
 void USBDevice::task() {
     tud_task();
 
-    while (tud_vendor_n_available(VENDOR_INTERFACE)) {
-        std::array<uint8_t, 64> request_buf{};
-        uint32_t count = tud_vendor_n_read(VENDOR_INTERFACE, request_buf.data(), request_buf.size());
-        if (count > 0) {
-            static bool flip = false;
-            if (flip) {
-                WS2812Led::instance().set_color(64, 64, 0);
+    flush_reply();
+    receive_requests();
+    flush_reply();
+    if (reply_bytes == 0 && rx_bytes == 0) {
+        // Everything read was answered, or needed no answer
+        request_timed = false;
+    }
+
+    download_task();
+    probe_task();
+    compare_task();
+    stream_task();
+    led_task();
+}
+
+void USBDevice::unmounted() {
+    // Host went away, stop queueing frames nobody will read
+    set_stream_rate(0);
+    keepalive_ms = 0;
+    apply_keepalive();
+    EncoderCapture::instance().cancel_download();
+    ProbeLatch::instance().arm(0, 0);
+    for (size_t i = 0; i < PositionCompare::kNumChannels; i++) {
+        PositionCompare::instance().disarm(i);
+    }
+    rx_bytes = 0;
+    reply_bytes = 0;
+    sof_frames = 0;
+    sof_us = 0;
+}
+
+// TinyUSB calls tud_sof_cb() from tud_task(), not the interrupt, so the time
+// lags the frame start by up to a main loop pass. The host measures over
+// seconds of frames, which makes that a few ppm at most. Frames missed while
+// the loop was busy are counted from the frame numbers.
+void USBDevice::start_of_frame(uint32_t frame_number) {
+    frame_number &= 0x7FF;
+    if (sof_us != 0) {
+        sof_frames += (frame_number - sof_frame_number) & 0x7FF;
+    }
+    sof_frame_number = frame_number;
+    sof_us = time_us_64();
+}
+
+uint16_t USBDevice::frame_crc(const uint8_t* data, size_t length) {
+    uint16_t crc = 0xFFFF;
+    for (size_t i = 0; i < length; i++) {
+        crc ^= static_cast<uint16_t>(data[i] << 8);
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc & 0x8000) ? static_cast<uint16_t>((crc << 1) ^ 0x1021) : static_cast<uint16_t>(crc << 1);
+        }
+    }
+    return crc;
+}
+
+// Argument bytes following each request code
+static size_t argument_length(uint8_t request) {
+    switch (request) {
+        case USBDevice::VENDOR_REQUEST_SET_TEST_MODE:
+        case USBDevice::VENDOR_REQUEST_RESET_POSITION:
+        case USBDevice::VENDOR_REQUEST_SET_FORMAT:
+        case USBDevice::VENDOR_REQUEST_GET_PERF_HISTOGRAM:
+            return 1;
+        case USBDevice::VENDOR_REQUEST_SET_STREAM:
+        case USBDevice::VENDOR_REQUEST_SET_KEEPALIVE:
+            return 2;
+        case USBDevice::VENDOR_REQUEST_SET_PROBE:
+            return 3;
+        case USBDevice::VENDOR_REQUEST_SET_SCALE:
+            return 1 + sizeof(double);
+        case USBDevice::VENDOR_REQUEST_SET_SAMPLING:
+            return 5;
+        case USBDevice::VENDOR_REQUEST_START_CAPTURE:
+            return 14;
+        case USBDevice::VENDOR_REQUEST_SET_COMPARE:
+            return 18;
+        case USBDevice::VENDOR_REQUEST_ADD_COMPARE_TARGETS:
+            return 2 + PositionCompare::kTargetsPerRequest * sizeof(int32_t);
+        case USBDevice::VENDOR_REQUEST_READ_CAPTURE:
+            return 8;
+        default:
+            return 0;
+    }
+}
+
+void USBDevice::receive_requests() {
+    // A reply still waiting for the TX FIFO or a capture download holds back
+    // further requests, so whatever is sent leaves in order and in
+    // transfers of its own
+    while (reply_bytes == 0 && !EncoderCapture::instance().is_downloading()) {
+        if (rx_bytes < rx_buffer.size() && tud_vendor_n_available(VENDOR_INTERFACE)) {
+            uint32_t count = tud_vendor_n_read(VENDOR_INTERFACE, rx_buffer.data() + rx_bytes,
+                                               rx_buffer.size() - rx_bytes);
+            activity |= count > 0;
+            rx_bytes += count;
+            if (count > 0 && !request_timed) {
+                request_us = time_us_32();
+                request_timed = true;
+            }
+        }
+        if (rx_bytes == 0) {
+            return;
+        }
+
+        size_t used = rx_buffer[0] == kFrameMagic ? handle_frame(rx_buffer.data(), rx_bytes)
+                                                  : handle_bare_requests(rx_buffer.data(), rx_bytes);
+        if (used == 0) {
+            // The rest of a request is still on its way
+            if (!tud_vendor_n_available(VENDOR_INTERFACE)) {
+                return;
+            }
+            continue;
+        }
+        memmove(rx_buffer.data(), rx_buffer.data() + used, rx_bytes - used);
+        rx_bytes -= used;
+    }
+}
+
+// Handles bare requests up to the next frame or an incomplete request,
+// returns the bytes used
+size_t USBDevice::handle_bare_requests(const uint8_t* data, size_t count) {
+    size_t i = 0;
+    while (i < count && data[i] != kFrameMagic) {
+        uint8_t request = data[i];
+        size_t length = argument_length(request);
+        if (i + 1 + length > count) {
+            break;
+        }
+
+        switch (request) {
+            case VENDOR_REQUEST_GET_POSITION:
+            case VENDOR_REQUEST_GET_SCALE:
+            case VENDOR_REQUEST_GET_BENCHMARK:
+            case VENDOR_REQUEST_GET_CAPTURE:
+            case VENDOR_REQUEST_GET_ENCODER_STATUS:
+            case VENDOR_REQUEST_GET_PERF_COUNTERS:
+            case VENDOR_REQUEST_GET_PERF_HISTOGRAM:
+            case VENDOR_REQUEST_HANDSHAKE:
+            case VENDOR_REQUEST_GET_CLOCK:
+            case VENDOR_REQUEST_GET_COMPARE:
+                (void)send_reply(request, data + i + 1);
+                break;
+            case VENDOR_REQUEST_READ_CAPTURE: {
+                uint32_t first;
+                uint32_t count;
+                memcpy(&first, data + i + 1, sizeof(first));
+                memcpy(&count, data + i + 5, sizeof(count));
+                // Nothing is sent when there is nothing to read
+                (void)EncoderCapture::instance().start_download(first, count);
+                // The rest waits until the download is out
+                return i + 1 + length;
+            }
+            default:
+                // Unknown bytes are skipped one at a time
+                (void)execute_entry(request, data + i + 1, length);
+                break;
+        }
+        i += 1 + length;
+    }
+    return i;
+}
+
+// Executes one complete frame and queues its reply. Returns the bytes used,
+// or 0 while the frame is incomplete.
+size_t USBDevice::handle_frame(const uint8_t* data, size_t count) {
+    if (count < kFrameHeaderSize) {
+        return 0;
+    }
+
+    uint16_t length = 0;
+    uint16_t request_id = 0;
+    memcpy(&length, data + 4, sizeof(length));
+    memcpy(&request_id, data + 6, sizeof(request_id));
+
+    size_t frame_size = kFrameOverhead + length;
+    if (frame_size > kMaxRequestFrameSize) {
+        // Not the start of a frame, resynchronize on the next magic byte
+        return 1;
+    }
+    if (count < frame_size) {
+        return 0;
+    }
+
+    uint16_t crc = 0;
+    memcpy(&crc, data + kFrameHeaderSize + length, sizeof(crc));
+    begin_reply(request_id);
+    if (crc != frame_crc(data, kFrameHeaderSize + length)) {
+        // Skipped as a whole, its bytes must not run as bare requests
+        finish_reply(FrameStatus::BAD_CRC);
+        return frame_size;
+    }
+    if (data[1] != kFrameVersion) {
+        finish_reply(FrameStatus::BAD_VERSION);
+        return frame_size;
+    }
+
+    FrameStatus status = FrameStatus::OK;
+    size_t offset = kFrameHeaderSize;
+    size_t end = kFrameHeaderSize + length;
+    while (offset < end && status == FrameStatus::OK) {
+        if (offset + 2 > end || offset + 2 + data[offset + 1] > end) {
+            status = FrameStatus::BAD_REQUEST;
+            break;
+        }
+        status = execute_entry(data[offset], data + offset + 2, data[offset + 1]);
+        offset += 2 + data[offset + 1];
+    }
+    finish_reply(status);
+    return frame_size;
+}
+
+// Runs one request with its arguments. Requests that return data add it to
+// the reply frame under construction.
+USBDevice::FrameStatus USBDevice::execute_entry(uint8_t request, const uint8_t* args, size_t length) {
+    static std::array<uint8_t, kMaxFrameSize> data{};
+    size_t bytes = 0;
+
+    switch (request) {
+        case VENDOR_REQUEST_GET_POSITION:
+        case VENDOR_REQUEST_GET_SCALE:
+        case VENDOR_REQUEST_GET_BENCHMARK:
+        case VENDOR_REQUEST_GET_CAPTURE:
+        case VENDOR_REQUEST_GET_ENCODER_STATUS:
+        case VENDOR_REQUEST_GET_PERF_COUNTERS:
+        case VENDOR_REQUEST_HANDSHAKE:
+        case VENDOR_REQUEST_GET_CLOCK:
+        case VENDOR_REQUEST_GET_COMPARE:
+        case VENDOR_REQUEST_GET_PERF_HISTOGRAM: {
+            if (length != argument_length(request)) {
+                return FrameStatus::BAD_REQUEST;
+            }
+            if (!get_reply(request, args, data.data(), bytes)) {
+                bytes = 0;
+            }
+            return add_reply_entry(request, data.data(), bytes) ? FrameStatus::OK : FrameStatus::REPLY_TOO_LARGE;
+        }
+        case VENDOR_REQUEST_SET_TEST_MODE:
+        case VENDOR_REQUEST_SET_SCALE:
+        case VENDOR_REQUEST_RESET_POSITION:
+        case VENDOR_REQUEST_SET_FORMAT:
+        case VENDOR_REQUEST_SET_STREAM:
+        case VENDOR_REQUEST_SET_KEEPALIVE:
+        case VENDOR_REQUEST_SET_SAMPLING:
+        case VENDOR_REQUEST_RESET_PERF_COUNTERS:
+        case VENDOR_REQUEST_SET_PROBE:
+        case VENDOR_REQUEST_SET_COMPARE:
+        case VENDOR_REQUEST_ADD_COMPARE_TARGETS:
+        case VENDOR_REQUEST_RUN_BENCHMARK:
+        case VENDOR_REQUEST_START_CAPTURE:
+        case VENDOR_REQUEST_TRIGGER_CAPTURE:
+            if (length != argument_length(request)) {
+                return FrameStatus::BAD_REQUEST;
+            }
+            break;
+        default:
+            return FrameStatus::BAD_REQUEST;
+    }
+
+    switch (request) {
+        case VENDOR_REQUEST_SET_TEST_MODE:
+            set_test_mode(args[0]);
+            break;
+        case VENDOR_REQUEST_SET_SCALE: {
+            double scale;
+            memcpy(&scale, args + 1, sizeof(scale));
+            if (args[0] < QuadratureEncoder::kNumEncoders) {
+                Position::instance().set_scale(args[0], scale);
+                ConfigStore::instance().changed();
+            }
+            break;
+        }
+        case VENDOR_REQUEST_RESET_POSITION:
+            if (args[0] < QuadratureEncoder::kNumEncoders) {
+                (void)Position::instance().reset_encoder(args[0]);
+            }
+            break;
+        case VENDOR_REQUEST_SET_FORMAT:
+            Position::instance().set_format(args[0]);
+            break;
+        case VENDOR_REQUEST_SET_STREAM:
+            set_stream_rate(args[0] | (args[1] << 8));
+            break;
+        case VENDOR_REQUEST_SET_KEEPALIVE:
+            keepalive_ms = args[0] | (args[1] << 8);
+            apply_keepalive();
+            break;
+        case VENDOR_REQUEST_SET_SAMPLING: {
+            QuadratureEncoder::Sampling sampling;
+            sampling.clkdiv_int = static_cast<uint16_t>(args[1] | (args[2] << 8));
+            sampling.clkdiv_frac = args[3];
+            sampling.filter_samples = args[4];
+            if (QuadratureEncoder::instance().set_sampling(args[0], sampling)) {
+                ConfigStore::instance().changed();
+            }
+            break;
+        }
+        case VENDOR_REQUEST_RESET_PERF_COUNTERS:
+            PerfCounters::instance().reset();
+            break;
+        case VENDOR_REQUEST_SET_PROBE:
+            ProbeLatch::instance().arm(args[0], static_cast<uint16_t>(args[1] | (args[2] << 8)));
+            break;
+        case VENDOR_REQUEST_SET_COMPARE: {
+            PositionCompare& compare = PositionCompare::instance();
+            uint16_t pulse_us = static_cast<uint16_t>(args[4] | (args[5] << 8));
+            int32_t first;
+            int32_t spacing;
+            uint32_t count;
+            memcpy(&first, args + 6, sizeof(first));
+            memcpy(&spacing, args + 10, sizeof(spacing));
+            memcpy(&count, args + 14, sizeof(count));
+            // A refused setting leaves the channel disarmed, GET_COMPARE
+            // shows it
+            if (args[2] == static_cast<uint8_t>(PositionCompare::Mode::LIST)) {
+                (void)compare.arm_list(args[0], args[1], pulse_us);
+            } else if (args[2] == static_cast<uint8_t>(PositionCompare::Mode::PERIODIC)) {
+                (void)compare.arm_periodic(args[0], args[1], first, spacing, count, pulse_us);
             } else {
-                WS2812Led::instance().set_off();
+                compare.disarm(args[0]);
             }
-            flip ^= 1;
-            for (uint32_t i = 0; i < count; i++) {
-                switch (request_buf[i]) {
-                    case VENDOR_REQUEST_GET_POSITION:
-                        (void)send_position_data();
-                        break;
-                    case VENDOR_REQUEST_SET_TEST_MODE:
-                        if (i + 1 < count) {
-                            uint8_t mode = request_buf[i + 1];
-                            if (mode == 0) {
-                                Position::instance().enable_test_mode(false);
-                            } else {
-                                Position::instance().enable_test_mode(true);
-                                Position::instance().set_test_pattern(mode - 1);
-                            }
-                            i++;
-                        }
-                        break;
-                    case VENDOR_REQUEST_SET_SCALE:
-                        if (i + 9 <= count) {
-                            uint8_t encoder_index = request_buf[i + 1];
-                            double scale;
-                            memcpy(&scale, &request_buf[i + 2], sizeof(double));
-                            if (encoder_index < 4) {
-                                Position::instance().set_scale(encoder_index, scale);
-                            }
-                            i += 9;
-                        }
-                        break;
-                    case VENDOR_REQUEST_GET_SCALE:
-                        (void)send_scale_data();
-                        break;
-                    case VENDOR_REQUEST_RESET_POSITION:
-                        if (i + 1 < count) {
-                            uint8_t encoder_index = request_buf[i + 1];
-                            if (encoder_index < 4) {
-                                (void)Position::instance().reset_encoder(encoder_index);
-                            }
-                            i++;
-                        }
-                        break;
-                }
+            break;
+        }
+        case VENDOR_REQUEST_ADD_COMPARE_TARGETS: {
+            std::array<int32_t, PositionCompare::kTargetsPerRequest> targets;
+            memcpy(targets.data(), args + 2, sizeof(targets));
+            (void)PositionCompare::instance().add_targets(args[0], targets.data(),
+                                                          std::min<size_t>(args[1], targets.size()));
+            break;
+        }
+        case VENDOR_REQUEST_RUN_BENCHMARK:
+            // Stops streaming, the counts are meaningless meanwhile
+            set_stream_rate(0);
+            EncoderBenchmark::instance().start();
+            break;
+        case VENDOR_REQUEST_START_CAPTURE: {
+            uint32_t rate_hz;
+            int32_t threshold;
+            uint32_t pre_samples;
+            memcpy(&rate_hz, args, sizeof(rate_hz));
+            memcpy(&threshold, args + 6, sizeof(threshold));
+            memcpy(&pre_samples, args + 10, sizeof(pre_samples));
+            EncoderCapture& capture = EncoderCapture::instance();
+            if (rate_hz == 0) {
+                capture.stop();
+            } else {
+                // A refused capture stays idle, GET_CAPTURE shows it
+                (void)capture.start(rate_hz, static_cast<EncoderCapture::Trigger>(args[4]), args[5], threshold,
+                                    pre_samples);
             }
+            break;
         }
+        case VENDOR_REQUEST_TRIGGER_CAPTURE:
+            EncoderCapture::instance().trigger_now();
+            break;
     }
+    return FrameStatus::OK;
 }
 
-bool USBDevice::send_position_data() {
-    if (!initialized) {
+void USBDevice::set_test_mode(uint8_t mode) {
+    if (mode == 0) {
+        Position::instance().enable_test_mode(false);
+    } else {
+        Position::instance().enable_test_mode(true);
+        Position::instance().set_test_pattern(mode - 1);
+    }
+    apply_keepalive();
+}
+
+// Test patterns move without the counts changing, they stream every sample
+void USBDevice::apply_keepalive() {
+    bool every_sample = keepalive_ms == 0 || Position::instance().is_test_mode();
+    QuadratureEncoder::instance().set_keepalive(every_sample ? 0 : keepalive_ms * 1000);
+}
+
+// Blinks while requests or frames pass. Only here, at a bounded rate, since
+// every LED update waits on its PIO FIFO.
+void USBDevice::led_task() {
+    uint64_t now = time_us_64();
+    if (now - led_changed_us < kLedBlinkUs || (!activity && !led_on)) {
+        return;
+    }
+    led_on = activity && !led_on;
+    if (led_on) {
+        WS2812Led::instance().set_color(64, 64, 0);
+    } else {
+        WS2812Led::instance().set_off();
+    }
+    led_changed_us = now;
+    activity = false;
+}
+
+void USBDevice::begin_reply(uint16_t request_id) {
+    reply[0] = kFrameMagic;
+    reply[1] = kFrameVersion;
+    reply[2] = static_cast<uint8_t>(FrameStatus::OK);
+    reply[3] = 0;
+    memset(&reply[4], 0, sizeof(uint16_t));
+    memcpy(&reply[6], &request_id, sizeof(request_id));
+    reply_bytes = kFrameHeaderSize;
+}
+
+bool USBDevice::add_reply_entry(uint8_t request, const uint8_t* data, size_t length) {
+    // Room is kept for the CRC and a padding entry
+    if (reply_bytes + 2 + length + sizeof(uint16_t) + 2 > reply.size()) {
         return false;
     }
+    reply[reply_bytes++] = request;
+    reply[reply_bytes++] = static_cast<uint8_t>(length);
+    memcpy(&reply[reply_bytes], data, length);
+    reply_bytes += length;
+    return true;
+}
+
+void USBDevice::finish_reply(FrameStatus status) {
+    // A transfer that is an exact multiple of the packet size would leave
+    // the host waiting for more
+    if ((reply_bytes + sizeof(uint16_t)) % kPacketSize == 0) {
+        reply[reply_bytes++] = FRAME_ENTRY_PADDING;
+        reply[reply_bytes++] = 0;
+    }
+    reply[2] = static_cast<uint8_t>(status);
+    uint16_t length = static_cast<uint16_t>(reply_bytes - kFrameHeaderSize);
+    memcpy(&reply[4], &length, sizeof(length));
+    uint16_t crc = frame_crc(reply.data(), reply_bytes);
+    memcpy(&reply[reply_bytes], &crc, sizeof(crc));
+    reply_bytes += sizeof(crc);
+}
 
+void USBDevice::flush_reply() {
+    if (reply_bytes == 0) {
+        return;
+    }
     if (!tud_vendor_n_mounted(VENDOR_INTERFACE)) {
-        return false;
+        reply_bytes = 0;
+        return;
+    }
+    if (tud_vendor_n_write_available(VENDOR_INTERFACE) != CFG_TUD_VENDOR_TX_BUFSIZE) {
+        return;
+    }
+    (void)write_reply(reply.data(), reply_bytes);
+    reply_bytes = 0;
+}
+
+// Writes the answer to a request, bare or framed, and times it
+uint32_t USBDevice::write_reply(const uint8_t* data, size_t bytes) {
+    uint32_t written = tud_vendor_n_write(VENDOR_INTERFACE, data, bytes);
+    if (request_timed) {
+        PerfCounters::instance().record(PerfCounters::Histogram::USB_REPLY, time_us_32() - request_us);
+        request_timed = false;
+    }
+    return written;
+}
+
+void USBDevice::set_stream_rate(uint32_t rate_hz) {
+    if (rate_hz > kMaxStreamRateHz) {
+        rate_hz = kMaxStreamRateHz;
+    }
+
+    QuadratureEncoder& encoder = QuadratureEncoder::instance();
+    if (rate_hz == 0) {
+        encoder.stop_sampling();
+        stream_rate_hz = 0;
+        return;
+    }
+
+    stream_rate_hz = encoder.start_sampling(rate_hz) ? rate_hz : 0;
+}
+
+// Feeds a capture download into the TX FIFO packet by packet. The host knows
+// the length from GET_CAPTURE and reads exactly that many bytes.
+void USBDevice::download_task() {
+    EncoderCapture& capture = EncoderCapture::instance();
+    if (!capture.is_downloading() || reply_bytes != 0) {
+        return;
+    }
+    if (!tud_vendor_n_mounted(VENDOR_INTERFACE)) {
+        capture.cancel_download();
+        return;
     }
 
-    static std::array<uint8_t, 64> buffer{};
+    std::array<uint8_t, kPacketSize> packet;
+    while (capture.is_downloading() && tud_vendor_n_write_available(VENDOR_INTERFACE) >= kPacketSize) {
+        size_t bytes = capture.read_download(packet.data(), packet.size());
+        (void)tud_vendor_n_write(VENDOR_INTERFACE, packet.data(), bytes);
+    }
+    (void)tud_vendor_n_write_flush(VENDOR_INTERFACE);
+}
+
+// Pushes one latch per call, in a transfer of its own, ahead of the stream
+void USBDevice::probe_task() {
+    ProbeLatch& probe = ProbeLatch::instance();
+    if (reply_bytes != 0 || EncoderCapture::instance().is_downloading() || probe.get_pending() == 0) {
+        return;
+    }
+
+    if (!tud_vendor_n_mounted(VENDOR_INTERFACE) ||
+        tud_vendor_n_write_available(VENDOR_INTERFACE) != CFG_TUD_VENDOR_TX_BUFSIZE) {
+        return;
+    }
+
+    std::array<uint8_t, kPacketSize> buffer{};
+    ProbeLatch::Latch latch;
     size_t bytes = 0;
+    if (!probe.peek(latch) || !probe.get(latch, buffer.data(), bytes)) {
+        return;
+    }
+    if (tud_vendor_n_write(VENDOR_INTERFACE, buffer.data(), bytes) == bytes) {
+        probe.drop();
+        activity = true;
+    }
+}
 
-    if (!Position::instance().get(buffer.data(), bytes)) {
-        return false;
+// Pushes one hit per call like probe_task(), after any probe latch
+void USBDevice::compare_task() {
+    PositionCompare& compare = PositionCompare::instance();
+    if (reply_bytes != 0 || EncoderCapture::instance().is_downloading() || compare.get_pending() == 0 ||
+        ProbeLatch::instance().get_pending() != 0) {
+        return;
     }
 
-    uint32_t written = tud_vendor_n_write(VENDOR_INTERFACE, buffer.data(), bytes);
-    if (bytes != written) {
-        return false;
+    if (!tud_vendor_n_mounted(VENDOR_INTERFACE) ||
+        tud_vendor_n_write_available(VENDOR_INTERFACE) != CFG_TUD_VENDOR_TX_BUFSIZE) {
+        return;
+    }
+
+    std::array<uint8_t, kPacketSize> buffer{};
+    PositionCompare::Hit hit;
+    size_t bytes = 0;
+    if (!compare.peek(hit) || !compare.get(hit, buffer.data(), bytes)) {
+        return;
+    }
+    if (tud_vendor_n_write(VENDOR_INTERFACE, buffer.data(), bytes) == bytes) {
+        compare.drop();
+        activity = true;
     }
-    return true;
+}
+
+void USBDevice::stream_task() {
+    // A pending reply or capture download goes first
+    if (stream_rate_hz == 0 || reply_bytes != 0 || EncoderCapture::instance().is_downloading()) {
+        return;
+    }
+
+    if (!tud_vendor_n_mounted(VENDOR_INTERFACE)) {
+        return;
+    }
+
+    static std::array<uint8_t, kMaxFrameSize> buffer{};
+    QuadratureEncoder::Snapshot snapshot;
+    QuadratureEncoder& encoder = QuadratureEncoder::instance();
+    Position& pos = Position::instance();
+
+    // Only queue a frame once the previous one has left the TX FIFO so that
+    // every IN transfer carries exactly one frame. Samples that queued up
+    // meanwhile are batched into it as far as the format allows. Count
+    // batches stay short of a whole USB packet, or of two when a single
+    // sample does not fit one, as with eight axes and velocities; a scaled
+    // eight-axis frame needs more than that.
+    size_t capacity = buffer.size();
+    if (pos.get_format() != Position::Format::SCALED) {
+        capacity = pos.get_single_sample_size() < kPacketSize ? kPacketSize - 1 : 2 * kPacketSize - 1;
+    }
+    while (tud_vendor_n_write_available(VENDOR_INTERFACE) == CFG_TUD_VENDOR_TX_BUFSIZE) {
+        size_t bytes = 0;
+        pos.begin_packet(buffer.data(), bytes);
+
+        bool added = false;
+        while (encoder.peek_sample(snapshot)) {
+            if (!pos.add_sample(snapshot, buffer.data(), bytes, capacity)) {
+                break;
+            }
+            encoder.drop_sample();
+            added = true;
+        }
+
+        if (!added) {
+            break;
+        }
+
+        if (tud_vendor_n_write(VENDOR_INTERFACE, buffer.data(), bytes) != bytes) {
+            break;
+        }
+        activity = true;
+    }
+}
+
+bool USBDevice::send_position_data() {
+    return send_reply(VENDOR_REQUEST_GET_POSITION, nullptr);
 }
 
 bool USBDevice::send_scale_data() {
+    return send_reply(VENDOR_REQUEST_GET_SCALE, nullptr);
+}
+
+// The data a get request returns, for bare requests and reply frames alike.
+// args holds argument_length(request) bytes.
+bool USBDevice::get_reply(uint8_t request, const uint8_t* args, uint8_t* out, size_t& bytes) const {
+    switch (request) {
+        case VENDOR_REQUEST_GET_POSITION:
+            return Position::instance().get(out, bytes);
+        case VENDOR_REQUEST_GET_SCALE:
+            return get_scale_data(out, bytes);
+        case VENDOR_REQUEST_GET_BENCHMARK:
+            return EncoderBenchmark::instance().get(out, bytes);
+        case VENDOR_REQUEST_GET_CAPTURE:
+            return EncoderCapture::instance().get(out, bytes);
+        case VENDOR_REQUEST_GET_ENCODER_STATUS:
+            return get_encoder_status(out, bytes);
+        case VENDOR_REQUEST_GET_PERF_COUNTERS:
+            return PerfCounters::instance().get(out, bytes);
+        case VENDOR_REQUEST_GET_PERF_HISTOGRAM:
+            return PerfCounters::instance().get_histogram(args[0], out, bytes);
+        case VENDOR_REQUEST_HANDSHAKE:
+            return get_handshake(out, bytes);
+        case VENDOR_REQUEST_GET_CLOCK:
+            return get_clock_data(out, bytes);
+        case VENDOR_REQUEST_GET_COMPARE:
+            return PositionCompare::instance().get(out, bytes);
+        default:
+            return false;
+    }
+}
+
+// Answers a bare get request in a transfer of its own
+bool USBDevice::send_reply(uint8_t request, const uint8_t* args) {
     if (!initialized) {
         return false;
     }
@@ -145,22 +717,84 @@ bool USBDevice::send_scale_data() {
         return false;
     }
 
-    static std::array<uint8_t, 36> buffer{};
+    static std::array<uint8_t, kMaxFrameSize> buffer{};
+    size_t bytes = 0;
+
+    if (!get_reply(request, args, buffer.data(), bytes)) {
+        return false;
+    }
+
+    uint32_t written = write_reply(buffer.data(), bytes);
+    if (bytes != written) {
+        return false;
+    }
+    return true;
+}
+bool USBDevice::get_scale_data(uint8_t* out, size_t& bytes) const {
     Position& pos = Position::instance();
-    
+
     uint32_t sentinel = SCALE_DATA_SENTINEL;
-    memcpy(buffer.data(), &sentinel, sizeof(sentinel));
-    
-    for (size_t i = 0; i < 4; i++) {
+    memcpy(out, &sentinel, sizeof(sentinel));
+    bytes = sizeof(sentinel);
+
+    for (size_t i = 0; i < QuadratureEncoder::kNumEncoders; i++) {
         double scale = pos.get_scale(i);
-        memcpy(&buffer[sizeof(sentinel) + i * sizeof(double)], &scale, sizeof(double));
+        memcpy(out + bytes, &scale, sizeof(scale));
+        bytes += sizeof(scale);
     }
+    return true;
+}
 
-    uint32_t written = tud_vendor_n_write(VENDOR_INTERFACE, buffer.data(), buffer.size());
-    if (buffer.size() != written) {
-        return false;
+bool USBDevice::get_encoder_status(uint8_t* out, size_t& bytes) const {
+    QuadratureEncoder& encoder = QuadratureEncoder::instance();
+
+    uint32_t sentinel = ENCODER_STATUS_SENTINEL;
+    memcpy(out, &sentinel, sizeof(sentinel));
+    bytes = sizeof(sentinel);
+
+    // [uint32 illegal transitions][uint32 overruns][uint16 clock divider]
+    // [uint8 divider 256ths][uint8 filter samples] per axis
+    for (size_t i = 0; i < QuadratureEncoder::kNumEncoders; i++) {
+        uint32_t illegal = encoder.get_illegal_transitions(i);
+        uint32_t overruns = encoder.get_overruns(i);
+        const QuadratureEncoder::Sampling& sampling = encoder.get_sampling(i);
+        memcpy(out + bytes, &illegal, sizeof(illegal));
+        memcpy(out + bytes + 4, &overruns, sizeof(overruns));
+        memcpy(out + bytes + 8, &sampling.clkdiv_int, sizeof(sampling.clkdiv_int));
+        out[bytes + 10] = sampling.clkdiv_frac;
+        out[bytes + 11] = sampling.filter_samples;
+        bytes += 12;
     }
+    return true;
+}
+
+// Ready unless the benchmark is running, the counts mean nothing then
+bool USBDevice::get_handshake(uint8_t* out, size_t& bytes) const {
+    ConfigStore& store = ConfigStore::instance();
+    uint32_t sentinel = HANDSHAKE_SENTINEL;
+    uint32_t hash = ConfigStore::settings_hash();
+    uint32_t saves = store.get_saves();
+    memcpy(out, &sentinel, sizeof(sentinel));
+    out[4] = EncoderBenchmark::instance().is_running() ? 0 : 1;
+    out[5] = QuadratureEncoder::kNumEncoders;
+    out[6] = store.is_from_flash() ? 1 : 0;
+    out[7] = 0;
+    memcpy(out + 8, &hash, sizeof(hash));
+    memcpy(out + 12, &saves, sizeof(saves));
+    bytes = 16;
+    return true;
+}
 
+// [frames:4][start of frame us:8][now us:8], the start of frame time is 0
+// until the first one
+bool USBDevice::get_clock_data(uint8_t* out, size_t& bytes) const {
+    uint32_t sentinel = CLOCK_DATA_SENTINEL;
+    uint64_t now_us = time_us_64();
+    memcpy(out, &sentinel, sizeof(sentinel));
+    memcpy(out + 4, &sof_frames, sizeof(sof_frames));
+    memcpy(out + 8, &sof_us, sizeof(sof_us));
+    memcpy(out + 16, &now_us, sizeof(now_us));
+    bytes = 24;
     return true;
 }
 
@@ -220,5 +854,13 @@ void tud_vendor_tx_cb(uint8_t itf, uint32_t sent_bytes) {
     (void)sent_bytes;
 }
 
+void tud_umount_cb(void) {
+    USBDevice::instance().unmounted();
+}
+
+void tud_sof_cb(uint32_t frame_count) {
+    USBDevice::instance().start_of_frame(frame_count);
+}
+
 
 }
\ No newline at end of file
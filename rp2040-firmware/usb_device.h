@@ -1,6 +1,7 @@
 #ifndef USB_DEVICE_H_
 #define USB_DEVICE_H_
 
+#include <array>
 #include <cstddef>
 #include <cstdint>
 
@@ -20,9 +21,102 @@ class USBDevice {
     static constexpr uint8_t VENDOR_REQUEST_SET_SCALE = 0x03;
     static constexpr uint8_t VENDOR_REQUEST_GET_SCALE = 0x04;
     static constexpr uint8_t VENDOR_REQUEST_RESET_POSITION = 0x05;
+    static constexpr uint8_t VENDOR_REQUEST_SET_STREAM = 0x06;
+    static constexpr uint8_t VENDOR_REQUEST_SET_FORMAT = 0x07;
+    static constexpr uint8_t VENDOR_REQUEST_RUN_BENCHMARK = 0x08;
+    static constexpr uint8_t VENDOR_REQUEST_GET_BENCHMARK = 0x09;
+    static constexpr uint8_t VENDOR_REQUEST_START_CAPTURE = 0x0A;
+    static constexpr uint8_t VENDOR_REQUEST_GET_CAPTURE = 0x0B;
+    // Bare only: the samples follow as a raw bulk stream, not as a reply
+    static constexpr uint8_t VENDOR_REQUEST_READ_CAPTURE = 0x0C;
+    static constexpr uint8_t VENDOR_REQUEST_TRIGGER_CAPTURE = 0x0D;
+    // uint16 keepalive in ms: streams only samples that changed, and one
+    // after each keepalive period without. 0 streams every sample.
+    static constexpr uint8_t VENDOR_REQUEST_SET_KEEPALIVE = 0x0E;
+    // [uint8 axis][uint16 clock divider][uint8 divider 256ths][uint8 filter
+    // samples], see QuadratureEncoder::Sampling. Out of range is ignored.
+    static constexpr uint8_t VENDOR_REQUEST_SET_SAMPLING = 0x0F;
+    // Per axis: illegal transitions, overruns and the sampling setting
+    static constexpr uint8_t VENDOR_REQUEST_GET_ENCODER_STATUS = 0x10;
+    // Counts and maxima of the PerfCounters histograms
+    static constexpr uint8_t VENDOR_REQUEST_GET_PERF_COUNTERS = 0x11;
+    // uint8 histogram index, returns its buckets
+    static constexpr uint8_t VENDOR_REQUEST_GET_PERF_HISTOGRAM = 0x12;
+    static constexpr uint8_t VENDOR_REQUEST_RESET_PERF_COUNTERS = 0x13;
+    // [uint8 edges][uint16 holdoff in us], see ProbeLatch::arm(). Latches
+    // are pushed like streamed frames.
+    static constexpr uint8_t VENDOR_REQUEST_SET_PROBE = 0x14;
+    // Readiness and the ConfigStore settings hash, the first request of a
+    // connection
+    static constexpr uint8_t VENDOR_REQUEST_HANDSHAKE = 0x15;
+    // The newest USB start of frame against time_us_64(), for the host to
+    // put device timestamps on its own clock
+    static constexpr uint8_t VENDOR_REQUEST_GET_CLOCK = 0x16;
+    // [uint8 channel][uint8 axis][uint8 mode][uint8 reserved][uint16 pulse
+    // in us][int32 first][int32 spacing][uint32 count], see PositionCompare.
+    // Mode 0 disarms and drops the targets, 1 arms the uploaded ones, 2
+    // count targets spaced from first. Hits are pushed like streamed frames.
+    static constexpr uint8_t VENDOR_REQUEST_SET_COMPARE = 0x17;
+    // [uint8 channel][uint8 number][int32 targets, kTargetsPerRequest of
+    // them], appended to the targets of a disarmed channel
+    static constexpr uint8_t VENDOR_REQUEST_ADD_COMPARE_TARGETS = 0x18;
+    static constexpr uint8_t VENDOR_REQUEST_GET_COMPARE = 0x19;
+
+    static constexpr size_t kPacketSize = 64;
+    // Frames larger than a packet go out as one transfer ending in a short
+    // packet. No frame is an exact multiple of kPacketSize, the host would
+    // wait for more otherwise.
+    static constexpr size_t kMaxFrameSize = 2 * kPacketSize;
+
+    static constexpr uint32_t kMaxStreamRateHz = 10000;
+    // The activity LED changes at most this often
+    static constexpr uint32_t kLedBlinkUs = 100000;
     
     static constexpr uint32_t POSITION_DATA_SENTINEL = 0x3F8A7C91;
     static constexpr uint32_t SCALE_DATA_SENTINEL = 0x7B2D4E8F;
+    static constexpr uint32_t COUNTS_DATA_SENTINEL = 0x5C1E93A6;
+    static constexpr uint32_t BENCHMARK_DATA_SENTINEL = 0x2A6F0B3D;
+    static constexpr uint32_t CAPTURE_DATA_SENTINEL = 0x6D4B2E17;
+    static constexpr uint32_t ENCODER_STATUS_SENTINEL = 0x4E1C7A25;
+    static constexpr uint32_t PERF_COUNTERS_SENTINEL = 0x1F5D3B79;
+    static constexpr uint32_t PERF_HISTOGRAM_SENTINEL = 0x6C2A8E41;
+    static constexpr uint32_t PROBE_DATA_SENTINEL = 0x2B9E4D63;
+    static constexpr uint32_t HANDSHAKE_SENTINEL = 0x58C3A1E6;
+    static constexpr uint32_t CLOCK_DATA_SENTINEL = 0x0C7F5E92;
+    static constexpr uint32_t COMPARE_STATUS_SENTINEL = 0x3A7E5C19;
+    static constexpr uint32_t COMPARE_HIT_SENTINEL = 0x71D2B84F;
+
+    // Framed requests batch any number of the requests above into one OUT
+    // transfer and are answered by exactly one reply frame. Both directions
+    // use the same layout, all fields little endian:
+    //
+    //   [magic][version][status][reserved][uint16 payload length]
+    //   [uint16 request id][payload][uint16 CRC]
+    //
+    // The payload is a list of [request][length][arguments] entries with the
+    // same arguments as the bare requests. The reply echoes the request id
+    // and carries one [request][length][data] entry per request that returns
+    // data, with the data the bare request would send. The CRC is
+    // CRC-16/CCITT-FALSE over header and payload. Bare requests keep working;
+    // the magic is not a request code, so the two can be told apart.
+    static constexpr uint8_t kFrameMagic = 0xA5;
+    static constexpr uint8_t kFrameVersion = 1;
+    static constexpr size_t kFrameHeaderSize = 8;
+    static constexpr size_t kFrameOverhead = kFrameHeaderSize + sizeof(uint16_t);
+    static constexpr size_t kMaxRequestFrameSize = 256;
+    static constexpr size_t kMaxReplyFrameSize = CFG_TUD_VENDOR_TX_BUFSIZE;
+    // Reply entry that only pads the frame off a multiple of kPacketSize
+    static constexpr uint8_t FRAME_ENTRY_PADDING = 0x00;
+
+    enum class FrameStatus : uint8_t {
+        OK = 0,
+        BAD_CRC = 1,          // nothing was executed
+        BAD_VERSION = 2,      // nothing was executed
+        BAD_REQUEST = 3,      // unknown request or wrong argument length, later entries skipped
+        REPLY_TOO_LARGE = 4   // the replies did not fit one frame, later entries skipped
+    };
+
+    [[nodiscard]] static uint16_t frame_crc(const uint8_t* data, size_t length);
     
     enum class USBError {
         NotInitialized,
@@ -36,10 +130,72 @@ class USBDevice {
     void task();
     [[nodiscard]] bool send_position_data();
     [[nodiscard]] bool send_scale_data();
+    // Any get request, args as in a request entry
+    [[nodiscard]] bool send_reply(uint8_t request, const uint8_t* args);
+
+    void set_stream_rate(uint32_t rate_hz);
+    // Drops the stream and any half-received request
+    void unmounted();
+    // From tud_sof_cb() with the 11 bit frame number
+    void start_of_frame(uint32_t frame_number);
+    [[nodiscard]] uint32_t get_stream_rate() const { return stream_rate_hz; }
 
  private:
     USBDevice() = default;
     bool initialized = false;
+
+    uint32_t stream_rate_hz = 0;
+    uint32_t keepalive_ms = 0;
+
+    // Set by any request or streamed frame, shown by led_task()
+    bool activity = false;
+    bool led_on = false;
+    uint64_t led_changed_us = 0;
+
+    // OUT bytes not handled yet, a frame can span several packets
+    std::array<uint8_t, kMaxRequestFrameSize> rx_buffer{};
+    size_t rx_bytes = 0;
+
+    // Reply frame waiting for an empty TX FIFO, so that it leaves in a
+    // transfer of its own and never behind a streamed frame
+    std::array<uint8_t, kMaxReplyFrameSize> reply{};
+    size_t reply_bytes = 0;
+
+    // When task() read the first bytes of the request the next reply
+    // answers, for the USB_REPLY histogram
+    uint32_t request_us = 0;
+    bool request_timed = false;
+
+    // Frames since the first start of frame, counted on from the 11 bit
+    // frame numbers, and when the newest one was seen. 0 before the first.
+    uint32_t sof_frames = 0;
+    uint32_t sof_frame_number = 0;
+    uint64_t sof_us = 0;
+
+    void receive_requests();
+    [[nodiscard]] size_t handle_bare_requests(const uint8_t* data, size_t count);
+    [[nodiscard]] size_t handle_frame(const uint8_t* data, size_t count);
+    FrameStatus execute_entry(uint8_t request, const uint8_t* args, size_t length);
+    void begin_reply(uint16_t request_id);
+    [[nodiscard]] bool add_reply_entry(uint8_t request, const uint8_t* data, size_t length);
+    void finish_reply(FrameStatus status);
+    void flush_reply();
+    uint32_t write_reply(const uint8_t* data, size_t bytes);
+
+    [[nodiscard]] bool get_reply(uint8_t request, const uint8_t* args, uint8_t* out, size_t& bytes) const;
+    [[nodiscard]] bool get_scale_data(uint8_t* out, size_t& bytes) const;
+    [[nodiscard]] bool get_encoder_status(uint8_t* out, size_t& bytes) const;
+    [[nodiscard]] bool get_handshake(uint8_t* out, size_t& bytes) const;
+    [[nodiscard]] bool get_clock_data(uint8_t* out, size_t& bytes) const;
+    void set_test_mode(uint8_t mode);
+    void apply_keepalive();
+
+    void led_task();
+
+    void download_task();
+    void probe_task();
+    void compare_task();
+    void stream_task();
 };
 
 #endif
\ No newline at end of file
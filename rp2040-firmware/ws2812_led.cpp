@@ -13,6 +13,10 @@ WS2812Led& WS2812Led::instance() {
 }
 
 void WS2812Led::init() {
+    if constexpr (!kAvailable) {
+        return;
+    }
+    pio_sm_claim(pio, sm);
     uint offset = pio_add_program(pio, &ws2812_program);
     ws2812_program_init(pio, sm, offset, PICO_DEFAULT_WS2812_PIN, 800000, false);
 }
@@ -39,5 +43,8 @@ void WS2812Led::set_off() {
 }
 
 void WS2812Led::put_pixel(uint32_t pixel_grb) {
+    if constexpr (!kAvailable) {
+        return;
+    }
     pio_sm_put_blocking(pio, sm, pixel_grb << 8u);
 }
\ No newline at end of file
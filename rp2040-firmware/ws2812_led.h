@@ -3,6 +3,7 @@
 
 #include <cstdint>
 #include "hardware/pio.h"
+#include "quadrature_encoder.h"
 
 class WS2812Led {
 public:
@@ -20,6 +21,9 @@ private:
     
     void init();
     void put_pixel(uint32_t pixel_grb);
+
+    // Eight-encoder builds need every state machine of pio1
+    static constexpr bool kAvailable = QuadratureEncoder::kNumPios < 2;
     
     PIO pio = pio1;
     uint sm = 0;
@@ -79,7 +79,7 @@ def get_position_once(dev):
         time.sleep(0.05)
         
         # Read response
-        data = dev.read(EP_IN, 64, timeout=100)
+        data = dev.read(EP_IN, 128, timeout=100)
         
         # Parse the data: [sentinel:4 bytes][positions:32 bytes] = 36 bytes total
         if len(data) >= 36:
@@ -90,7 +90,7 @@ def get_position_once(dev):
                 # Clear USB read queue to remove any stale data
                 try:
                     while True:
-                        dev.read(EP_IN, 64, timeout=1)
+                        dev.read(EP_IN, 128, timeout=1)
                 except usb.core.USBTimeoutError:
                     pass  # Queue is now empty
                 return None
@@ -119,7 +119,7 @@ def get_position_fast(dev):
         # No artificial delay - let USB handle timing
         
         # Read response with short timeout
-        data = dev.read(EP_IN, 64, timeout=10)
+        data = dev.read(EP_IN, 128, timeout=10)
         
         # Parse the data: [sentinel:4 bytes][positions:32 bytes] = 36 bytes total
         if len(data) >= 36:
@@ -129,7 +129,7 @@ def get_position_fast(dev):
                 # Clear USB read queue to remove any stale data (silently in fast mode)
                 try:
                     while True:
-                        dev.read(EP_IN, 64, timeout=1)
+                        dev.read(EP_IN, 128, timeout=1)
                 except usb.core.USBTimeoutError:
                     pass  # Queue is now empty
                 return None  # Invalid data, silently ignore in fast mode
@@ -157,7 +157,7 @@ def get_scale_data(dev):
         time.sleep(0.05)
         
         # Read response
-        data = dev.read(EP_IN, 64, timeout=100)
+        data = dev.read(EP_IN, 128, timeout=100)
         
         # Parse the data: [sentinel:4 bytes][scales:32 bytes] = 36 bytes total
         if len(data) >= 36:
@@ -168,7 +168,7 @@ def get_scale_data(dev):
                 # Clear USB read queue to remove any stale data
                 try:
                     while True:
-                        dev.read(EP_IN, 64, timeout=1)
+                        dev.read(EP_IN, 128, timeout=1)
                 except usb.core.USBTimeoutError:
                     pass  # Queue is now empty
                 return None